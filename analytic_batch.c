@@ -0,0 +1,90 @@
+#include "analytic_batch.h"
+
+/* The phase is advanced by a rotation recurrence and re-anchored to an exact
+ * cos/sin every ANALYTIC_ANCHOR states, which bounds the accumulated drift
+ * to a few ulps. Chunks are whole multiples of the anchor interval. */
+#define ANALYTIC_ANCHOR 256
+#define ANALYTIC_CHUNK (16 * ANALYTIC_ANCHOR)
+
+typedef struct AnalyticJob
+{
+    double t_0, Dt;
+    Trajectory *trajectory;
+}AnalyticJob;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void fill_analytic_chunk (size_t begin, size_t end, void *ctx);
+void fill_analytic_block (AnalyticJob *job, size_t begin, size_t end);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+bool fill_analytic_states (double t_0, double Dt, Trajectory *trajectory)
+{
+  if (!trajectory)
+  { return false; }
+  AnalyticJob job = {t_0, Dt, trajectory};
+  return parallel_for (trajectory->size, ANALYTIC_CHUNK, fill_analytic_chunk,
+                       &job);
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+void fill_analytic_chunk (size_t begin, size_t end, void *ctx)
+{
+  for (size_t i = begin; i < end; i += ANALYTIC_ANCHOR)
+  {
+    size_t block_end = i + ANALYTIC_ANCHOR;
+    fill_analytic_block (ctx, i, block_end < end ? block_end : end);
+  }
+}
+
+void fill_analytic_block (AnalyticJob *job, size_t begin, size_t end)
+{
+  Trajectory *trajectory = job->trajectory;
+  double w = (q / m) * B;
+  double cos_step = cos (w * job->Dt);
+  double sin_step = sin (w * job->Dt);
+  double t_begin = job->t_0 + begin * job->Dt;
+  double c = cos (w * t_begin);
+  double s = sin (w * t_begin);
+
+  /* The phase recurrence is inherently serial, so it only stores cos/sin in
+   * the a columns; the loop below derives every column and vectorises. */
+  double *restrict cos_wt = trajectory->a_y + begin;
+  double *restrict sin_wt = trajectory->a_z + begin;
+  size_t n = end - begin;
+  for (size_t i = 0; i < n; ++i)
+  {
+    cos_wt[i] = c;
+    sin_wt[i] = s;
+    double next_c = c * cos_step - s * sin_step;
+    s = s * cos_step + c * sin_step;
+    c = next_c;
+  }
+
+  double *restrict time = trajectory->time + begin;
+  double *restrict r_y = trajectory->r_y + begin;
+  double *restrict r_z = trajectory->r_z + begin;
+  double *restrict v_y = trajectory->v_y + begin;
+  double *restrict v_z = trajectory->v_z + begin;
+  const double drift = E / B;
+  const double radius = (2 / w) * drift;
+  for (size_t i = 0; i < n; ++i)
+  {
+    double t = job->t_0 + (begin + i) * job->Dt;
+    time[i] = t;
+    r_y[i] = radius * cos_wt[i] - radius;
+    r_z[i] = radius * sin_wt[i] + drift * t;
+    v_y[i] = -2 * drift * sin_wt[i];
+    v_z[i] = drift * (2 * cos_wt[i] + 1);
+    cos_wt[i] = (q / m) * (E - B * v_z[i]);
+    sin_wt[i] = (q / m) * (B * v_y[i]);
+  }
+}
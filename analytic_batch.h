@@ -0,0 +1,9 @@
+#ifndef ANALYTIC_BATCH_H
+#define ANALYTIC_BATCH_H
+
+#include "trajectory.h"
+#include "parallel.h"
+
+bool fill_analytic_states (double t_0, double Dt, Trajectory *trajectory);
+
+#endif
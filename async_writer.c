@@ -0,0 +1,154 @@
+#include "async_writer.h"
+
+#define STATE_ROW "%" PRIu64 ",%lf,%lf,%lf,%lf,%lf,%lf,%lf\n"
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void *writer_thread (void *arg);
+void publish_chunk (AsyncWriter *writer);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+AsyncWriter *open_async_writer (FILE *f, bool owns_file, ROW_PRINTER
+*printer)
+{
+  if (!f)
+  { return NULL; }
+  AsyncWriter *writer = malloc (sizeof (AsyncWriter));
+  if (!writer)
+  { return NULL; }
+  writer->f = f;
+  writer->owns_file = owns_file;
+  writer->printer = printer;
+  writer->ring[0].count = 0;
+  writer->head = 0;
+  writer->tail = 0;
+  writer->closed = false;
+  pthread_mutex_init (&writer->lock, NULL);
+  pthread_cond_init (&writer->not_empty, NULL);
+  pthread_cond_init (&writer->not_full, NULL);
+  if (pthread_create (&writer->thread, NULL, writer_thread, writer))
+  {
+    pthread_mutex_destroy (&writer->lock);
+    pthread_cond_destroy (&writer->not_empty);
+    pthread_cond_destroy (&writer->not_full);
+    free (writer);
+    return NULL;
+  }
+  return writer;
+}
+
+/* The chunk at head belongs to the producer alone until it is published,
+ * so filling it needs no lock. */
+void push_row (AsyncWriter *writer, const WriterRow *row)
+{
+  WriterChunk *chunk = &writer->ring[writer->head % WRITER_RING];
+  chunk->rows[chunk->count++] = *row;
+  if (chunk->count == WRITER_CHUNK)
+  {
+    publish_chunk (writer);
+  }
+}
+
+bool close_async_writer (AsyncWriter **p_writer)
+{
+  AsyncWriter *writer = *p_writer;
+  if (!writer)
+  { return false; }
+  if (writer->ring[writer->head % WRITER_RING].count)
+  {
+    publish_chunk (writer);
+  }
+  pthread_mutex_lock (&writer->lock);
+  writer->closed = true;
+  pthread_cond_signal (&writer->not_empty);
+  pthread_mutex_unlock (&writer->lock);
+  pthread_join (writer->thread, NULL);
+  pthread_mutex_destroy (&writer->lock);
+  pthread_cond_destroy (&writer->not_empty);
+  pthread_cond_destroy (&writer->not_full);
+  bool ret = !ferror (writer->f);
+  if (writer->owns_file)
+  {
+    ret = !fclose (writer->f) && ret;
+  }
+  else
+  {
+    fflush (writer->f);
+  }
+  free (writer);
+  *p_writer = NULL;
+  return ret;
+}
+
+void print_state_row (FILE *f, const WriterRow *row)
+{
+  fprintf (f, STATE_ROW, row->index, row->values[0], row->values[1],
+           row->values[2], row->values[3], row->values[4], row->values[5],
+           row->values[6]);
+}
+
+void fill_state_row (WriterRow *row, uint64_t index, TimeState *time_state)
+{
+  row->index = index;
+  row->values[0] = time_state->time;
+  row->values[1] = time_state->r->_y;
+  row->values[2] = time_state->r->_z;
+  row->values[3] = time_state->v->_y;
+  row->values[4] = time_state->v->_z;
+  row->values[5] = time_state->a->_y;
+  row->values[6] = time_state->a->_z;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+/* Hands the chunk being filled to the writer thread, first waiting for a
+ * free slot when the writer has fallen WRITER_RING chunks behind. */
+void publish_chunk (AsyncWriter *writer)
+{
+  pthread_mutex_lock (&writer->lock);
+  size_t head = ++writer->head;
+  pthread_cond_signal (&writer->not_empty);
+  while (head - writer->tail >= WRITER_RING)
+  {
+    pthread_cond_wait (&writer->not_full, &writer->lock);
+  }
+  pthread_mutex_unlock (&writer->lock);
+  writer->ring[head % WRITER_RING].count = 0;
+}
+
+void *writer_thread (void *arg)
+{
+  AsyncWriter *writer = arg;
+  size_t tail = 0;
+  pthread_mutex_lock (&writer->lock);
+  while (true)
+  {
+    while (tail == writer->head && !writer->closed)
+    {
+      pthread_cond_wait (&writer->not_empty, &writer->lock);
+    }
+    if (tail == writer->head)
+    {
+      pthread_mutex_unlock (&writer->lock);
+      return NULL;
+    }
+    pthread_mutex_unlock (&writer->lock);
+
+    WriterChunk *chunk = &writer->ring[tail % WRITER_RING];
+    for (size_t i = 0; i < chunk->count; ++i)
+    {
+      writer->printer (writer->f, &chunk->rows[i]);
+    }
+
+    pthread_mutex_lock (&writer->lock);
+    writer->tail = ++tail;
+    pthread_cond_signal (&writer->not_full);
+  }
+}
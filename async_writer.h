@@ -0,0 +1,52 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include "structs.h"
+#include <pthread.h>
+
+#define WRITER_CHUNK 512
+#define WRITER_RING 16
+#define WRITER_COLUMNS 7
+
+typedef struct WriterRow
+{
+    uint64_t index;
+    double values[WRITER_COLUMNS];
+}WriterRow;
+
+typedef void (ROW_PRINTER)(FILE *f, const WriterRow *row);
+
+typedef struct WriterChunk
+{
+    size_t count;
+    WriterRow rows[WRITER_CHUNK];
+}WriterChunk;
+
+/* Single producer, single consumer ring of row chunks. The integration
+ * thread fills ring[head % WRITER_RING] and publishes it by advancing head;
+ * the writer thread formats ring[tail % WRITER_RING] and frees it by
+ * advancing tail. A full ring stalls the producer, which bounds the memory
+ * to WRITER_RING chunks whatever the trajectory length. Only head, tail
+ * and closed are shared, under lock; either side sleeps on its condition
+ * while it has to wait for the other. */
+typedef struct AsyncWriter
+{
+    FILE *f;
+    bool owns_file;
+    ROW_PRINTER *printer;
+    WriterChunk ring[WRITER_RING];
+    size_t head, tail;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    pthread_t thread;
+}AsyncWriter;
+
+AsyncWriter *open_async_writer (FILE *f, bool owns_file, ROW_PRINTER
+*printer);
+void push_row (AsyncWriter *writer, const WriterRow *row);
+bool close_async_writer (AsyncWriter **p_writer);
+void print_state_row (FILE *f, const WriterRow *row);
+void fill_state_row (WriterRow *row, uint64_t index, TimeState *time_state);
+
+#endif
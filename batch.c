@@ -0,0 +1,224 @@
+#include "batch.h"
+
+#define REAL double
+#define ACC double
+#define KERNEL(name) name ## _double
+#include "batch_kernels.h"
+#include "batch3_kernels.h"
+#undef REAL
+#undef ACC
+#undef KERNEL
+
+#define REAL float
+#define ACC float
+#define KERNEL(name) name ## _single
+#include "batch_kernels.h"
+#include "batch3_kernels.h"
+#undef REAL
+#undef ACC
+#undef KERNEL
+
+#define REAL float
+#define ACC double
+#define KERNEL(name) name ## _mixed
+#include "batch_kernels.h"
+#include "batch3_kernels.h"
+#undef REAL
+#undef ACC
+#undef KERNEL
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+typedef void (TILE_KERNEL)(Batch *, size_t, size_t, Method, double);
+typedef void (TILE_KERNEL_3D)(Batch *, size_t, size_t, Method, double,
+                              const Field3 *);
+
+typedef struct BatchJob
+{
+    Batch *batch;
+    Method method;
+    double Dt;
+    TILE_KERNEL *run_tile;
+    TILE_KERNEL_3D *run_tile_3d;
+    const Field3 *field;
+}BatchJob;
+
+TILE_KERNEL *get_tile_kernel (Precision precision);
+TILE_KERNEL_3D *get_tile_kernel_3d (Precision precision);
+void run_tiles (size_t begin, size_t end, void *ctx);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+Batch *alloc_batch_3d (size_t size)
+{
+  Batch *batch = alloc_batch (size);
+  if (!batch)
+  { return NULL; }
+  batch->r_x = alloc_first_touch (size, sizeof (double));
+  batch->v_x = alloc_first_touch (size, sizeof (double));
+  if (!batch->r_x || !batch->v_x)
+  {
+    free_batch (&batch);
+    return NULL;
+  }
+  return batch;
+}
+
+Batch *alloc_batch (size_t size)
+{
+  Batch *batch = calloc (1, sizeof (Batch));
+  if (!batch)
+  { return NULL; }
+  batch->size = size;
+  batch->r_y = alloc_first_touch (size, sizeof (double));
+  batch->r_z = alloc_first_touch (size, sizeof (double));
+  batch->v_y = alloc_first_touch (size, sizeof (double));
+  batch->v_z = alloc_first_touch (size, sizeof (double));
+  batch->qm = alloc_first_touch (size, sizeof (double));
+  batch->species = alloc_first_touch (size, sizeof (unsigned char));
+  batch->steps = alloc_first_touch (size, sizeof (unsigned int));
+  batch->did_exit = alloc_first_touch (size, sizeof (bool));
+  if (!batch->r_y || !batch->r_z || !batch->v_y || !batch->v_z
+      || !batch->qm || !batch->species || !batch->steps
+      || !batch->did_exit)
+  {
+    free_batch (&batch);
+    return NULL;
+  }
+  return batch;
+}
+
+void free_batch (Batch **p_batch)
+{
+  Batch *batch = *p_batch;
+  if (!batch)
+  { return; }
+  free (batch->r_x);
+  free (batch->r_y);
+  free (batch->r_z);
+  free (batch->v_x);
+  free (batch->v_y);
+  free (batch->v_z);
+  free (batch->qm);
+  free (batch->species);
+  free (batch->steps);
+  free (batch->did_exit);
+  free (batch);
+  *p_batch = NULL;
+}
+
+bool copy_batch (Batch *dest, Batch *src)
+{
+  if (!dest || !src || dest->size != src->size
+      || !dest->r_x != !src->r_x)
+  { return false; }
+  size_t size = src->size;
+  if (src->r_x)
+  {
+    memcpy (dest->r_x, src->r_x, size * sizeof (double));
+    memcpy (dest->v_x, src->v_x, size * sizeof (double));
+  }
+  memcpy (dest->r_y, src->r_y, size * sizeof (double));
+  memcpy (dest->r_z, src->r_z, size * sizeof (double));
+  memcpy (dest->v_y, src->v_y, size * sizeof (double));
+  memcpy (dest->v_z, src->v_z, size * sizeof (double));
+  memcpy (dest->qm, src->qm, size * sizeof (double));
+  memcpy (dest->species, src->species, size * sizeof (unsigned char));
+  memcpy (dest->steps, src->steps, size * sizeof (unsigned int));
+  memcpy (dest->did_exit, src->did_exit, size * sizeof (bool));
+  return true;
+}
+
+bool run_batch (Batch *batch, Method method, double Dt, Precision precision,
+                const Field3 *field)
+{
+  /* The SoA kernels are hand-written for the three classic methods only. */
+  if (!batch || !is_batch_method (method))
+  { return false; }
+  Field3 default_field = get_default_field ();
+  if (!field)
+  { field = &default_field; }
+  /* Tiles whose particles all hit the plates early finish long before
+   * tiles that are transmitted, hence stealing rather than fixed slices. */
+  BatchJob job = {batch, method, Dt, get_tile_kernel (precision),
+                  get_tile_kernel_3d (precision), field};
+  size_t num_of_tiles = (batch->size + BATCH_TILE - 1) / BATCH_TILE;
+  return steal_for (num_of_tiles, 1, run_tiles, &job);
+}
+
+double get_species_qm (const Species *species)
+{
+  return species->charge / species->mass;
+}
+
+/* The fastest gyration of the mix, which the step has to resolve. */
+double get_max_species_qm (const Species *species, unsigned int
+num_of_species)
+{
+  double max_qm = 0;
+  for (unsigned int i = 0; i < num_of_species; ++i)
+  {
+    max_qm = fmax (max_qm, fabs (get_species_qm (&species[i])));
+  }
+  return max_qm;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+TILE_KERNEL *get_tile_kernel (Precision precision)
+{
+  switch (precision)
+  {
+    case SINGLE_PRECISION:
+      return run_tile_single;
+
+    case MIXED_PRECISION:
+      return run_tile_mixed;
+
+    default:
+      return run_tile_double;
+  }
+}
+
+TILE_KERNEL_3D *get_tile_kernel_3d (Precision precision)
+{
+  switch (precision)
+  {
+    case SINGLE_PRECISION:
+      return run_tile_3d_single;
+
+    case MIXED_PRECISION:
+      return run_tile_3d_mixed;
+
+    default:
+      return run_tile_3d_double;
+  }
+}
+
+void run_tiles (size_t begin, size_t end, void *ctx)
+{
+  BatchJob *job = ctx;
+  Batch *batch = job->batch;
+  for (size_t tile = begin; tile < end; ++tile)
+  {
+    size_t tile_begin = tile * BATCH_TILE;
+    size_t tile_end = tile_begin + BATCH_TILE;
+    if (tile_end > batch->size)
+    { tile_end = batch->size; }
+    if (batch->r_x)
+    {
+      job->run_tile_3d (batch, tile_begin, tile_end, job->method, job->Dt,
+                        job->field);
+    }
+    else
+    {
+      job->run_tile (batch, tile_begin, tile_end, job->method, job->Dt);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "methods.h"
+#include "field_map.h"
+#include "parallel.h"
+
+#define BATCH_TILE 64
+#define MAX_BATCH_STEPS 1000000
+#define MAX_SPECIES 16
+
+typedef enum Precision
+{
+    DOUBLE_PRECISION,
+    SINGLE_PRECISION,
+    MIXED_PRECISION
+}Precision;
+
+/* One ion species of a mixed beam, its charge and mass in the units of q
+ * and m, and the share of the particles drawn from it. */
+typedef struct Species
+{
+    double charge, mass, share;
+}Species;
+
+/* Structure of arrays holding many independent particles, so the stepping
+ * kernels can run one particle per vector lane. Every particle carries its
+ * own q / m, so one tile may mix species; species is the index of the
+ * particle's species, for the statistics. The x columns are only allocated
+ * for 3D batches and are NULL otherwise. */
+typedef struct Batch
+{
+    size_t size;
+    double *r_x, *r_y, *r_z, *v_x, *v_y, *v_z;
+    double *qm;
+    unsigned char *species;
+    unsigned int *steps;
+    bool *did_exit;
+}Batch;
+
+Batch *alloc_batch (size_t size);
+Batch *alloc_batch_3d (size_t size);
+void free_batch (Batch **p_batch);
+bool copy_batch (Batch *dest, Batch *src);
+bool run_batch (Batch *batch, Method method, double Dt, Precision precision,
+                const Field3 *field);
+double get_species_qm (const Species *species);
+double get_max_species_qm (const Species *species, unsigned int
+num_of_species);
+
+#endif
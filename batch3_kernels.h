@@ -0,0 +1,278 @@
+/* Three dimensional counterpart of batch_kernels.h for arbitrarily oriented
+ * uniform fields. Like it, this file is a template without an include guard
+ * and expects REAL, ACC and KERNEL(name) to be defined by the includer. The
+ * 2D kernels stay separate so the aligned-field runs pay nothing for the
+ * extra dimension. Non-uniform fields are read from a field map. */
+
+typedef struct KERNEL (Lane3)
+{
+    REAL x, y, z;
+}KERNEL (Lane3);
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void KERNEL (run_tile_3d) (Batch *batch, size_t begin, size_t end, Method
+method, double Dt, const Field3 *field);
+
+/***************************/
+/*        KERNELS          */
+/***************************/
+
+static inline KERNEL (Lane3) KERNEL (lane3) (REAL x, REAL y, REAL z)
+{
+  KERNEL (Lane3) ret = {x, y, z};
+  return ret;
+}
+
+static inline KERNEL (Lane3) KERNEL (axpy3) (REAL a, KERNEL (Lane3) x,
+                                             KERNEL (Lane3) y)
+{
+  return KERNEL (lane3) (a * x.x + y.x, a * x.y + y.y, a * x.z + y.z);
+}
+
+/* (q / m) (e + v x b) scaled by Dt, with the field already in REAL. */
+static inline KERNEL (Lane3) KERNEL (accel3) (KERNEL (Lane3) v,
+                                              const REAL *e, const REAL *b,
+                                              REAL qm_Dt)
+{
+  return KERNEL (lane3) (qm_Dt * (e[0] + v.y * b[2] - v.z * b[1]),
+                         qm_Dt * (e[1] + v.z * b[0] - v.x * b[2]),
+                         qm_Dt * (e[2] + v.x * b[1] - v.y * b[0]));
+}
+
+static inline void KERNEL (euler_increment_3d) (KERNEL (Lane3) v,
+                                                const REAL *e, const REAL *b,
+                                                REAL qm_Dt, REAL Dt,
+                                                KERNEL (Lane3) *dr,
+                                                KERNEL (Lane3) *dv)
+{
+  *dv = KERNEL (accel3) (v, e, b, qm_Dt);
+  *dr = KERNEL (lane3) (v.x * Dt, v.y * Dt, v.z * Dt);
+}
+
+static inline void KERNEL (midpoint_increment_3d) (KERNEL (Lane3) v,
+                                                   const REAL *e,
+                                                   const REAL *b, REAL qm_Dt,
+                                                   REAL Dt,
+                                                   KERNEL (Lane3) *dr,
+                                                   KERNEL (Lane3) *dv)
+{
+  KERNEL (Lane3) k_1 = KERNEL (accel3) (v, e, b, qm_Dt);
+  KERNEL (Lane3) mid = KERNEL (axpy3) ((REAL) 0.5, k_1, v);
+  *dv = KERNEL (accel3) (mid, e, b, qm_Dt);
+  *dr = KERNEL (lane3) (mid.x * Dt, mid.y * Dt, mid.z * Dt);
+}
+
+static inline void KERNEL (runge_kutta_increment_3d) (KERNEL (Lane3) v,
+                                                      const REAL *e,
+                                                      const REAL *b,
+                                                      REAL qm_Dt, REAL Dt,
+                                                      KERNEL (Lane3) *dr,
+                                                      KERNEL (Lane3) *dv)
+{
+  const REAL half = (REAL) 0.5;
+  const REAL sixth = (REAL) 1 / 6;
+  KERNEL (Lane3) k_1 = KERNEL (accel3) (v, e, b, qm_Dt);
+  KERNEL (Lane3) v_2 = KERNEL (axpy3) (half, k_1, v);
+  KERNEL (Lane3) k_2 = KERNEL (accel3) (v_2, e, b, qm_Dt);
+  KERNEL (Lane3) v_3 = KERNEL (axpy3) (half, k_2, v);
+  KERNEL (Lane3) k_3 = KERNEL (accel3) (v_3, e, b, qm_Dt);
+  KERNEL (Lane3) v_4 = KERNEL (axpy3) (1, k_3, v);
+  KERNEL (Lane3) k_4 = KERNEL (accel3) (v_4, e, b, qm_Dt);
+  *dv = KERNEL (lane3) (sixth * (k_1.x + 2 * k_2.x + 2 * k_3.x + k_4.x),
+                        sixth * (k_1.y + 2 * k_2.y + 2 * k_3.y + k_4.y),
+                        sixth * (k_1.z + 2 * k_2.z + 2 * k_3.z + k_4.z));
+  REAL sixth_Dt = sixth * Dt;
+  *dr = KERNEL (lane3) (sixth_Dt * (v.x + 2 * v_2.x + 2 * v_3.x + v_4.x),
+                        sixth_Dt * (v.y + 2 * v_2.y + 2 * v_3.y + v_4.y),
+                        sixth_Dt * (v.z + 2 * v_2.z + 2 * v_3.z + v_4.z));
+}
+
+/* One step through a field map. All three methods only feed the previous
+ * stage into the next one, so the stages are driven by the per-stage
+ * coefficient of that stage and its weight in the final sum. Each stage
+ * looks up the fields of the whole tile in one batched call. */
+static void KERNEL (map_step_3d) (size_t n, Method method, ACC *r[3],
+                                  ACC *v[3], const int *done, REAL Dt,
+                                  const REAL *qm_Dt,
+                                  const FieldMap *field_map)
+{
+  static const double euler_a[] = {0}, euler_b[] = {1};
+  static const double midpoint_a[] = {0, 0.5}, midpoint_b[] = {0, 1};
+  static const double runge_kutta_a[] = {0, 0.5, 0.5, 1};
+  static const double runge_kutta_b[] = {1.0 / 6, 1.0 / 3, 1.0 / 3, 1.0 / 6};
+  const double *stage_a = runge_kutta_a, *stage_b = runge_kutta_b;
+  int stages = 4;
+  if (method == EULER)
+  {
+    stage_a = euler_a;
+    stage_b = euler_b;
+    stages = 1;
+  }
+  else if (method == MIDPOINT)
+  {
+    stage_a = midpoint_a;
+    stage_b = midpoint_b;
+    stages = 2;
+  }
+
+  double pos[3][BATCH_TILE], e[3][BATCH_TILE], b[3][BATCH_TILE];
+  double *const p_pos[3] = {pos[0], pos[1], pos[2]};
+  double *p_e[3] = {e[0], e[1], e[2]}, *p_b[3] = {b[0], b[1], b[2]};
+  REAL vel[3][BATCH_TILE], k_r[3][BATCH_TILE], k_v[3][BATCH_TILE];
+  REAL sum_r[3][BATCH_TILE], sum_v[3][BATCH_TILE];
+
+  for (int d = 0; d < 3; ++d)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      k_r[d][i] = 0;
+      k_v[d][i] = 0;
+      sum_r[d][i] = 0;
+      sum_v[d][i] = 0;
+    }
+  }
+
+  for (int s = 0; s < stages; ++s)
+  {
+    const REAL a = (REAL) stage_a[s], w = (REAL) stage_b[s];
+    for (int d = 0; d < 3; ++d)
+    {
+      for (size_t i = 0; i < n; ++i)
+      {
+        pos[d][i] = (double) (r[d][i] + (ACC) (a * k_r[d][i]));
+        vel[d][i] = (REAL) v[d][i] + a * k_v[d][i];
+      }
+    }
+    sample_field_map_batch (field_map, n, p_pos, p_e, p_b);
+    for (size_t i = 0; i < n; ++i)
+    {
+      k_v[0][i] = qm_Dt[i] * ((REAL) e[0][i] + vel[1][i] * (REAL) b[2][i]
+                              - vel[2][i] * (REAL) b[1][i]);
+      k_v[1][i] = qm_Dt[i] * ((REAL) e[1][i] + vel[2][i] * (REAL) b[0][i]
+                              - vel[0][i] * (REAL) b[2][i]);
+      k_v[2][i] = qm_Dt[i] * ((REAL) e[2][i] + vel[0][i] * (REAL) b[1][i]
+                              - vel[1][i] * (REAL) b[0][i]);
+    }
+    for (int d = 0; d < 3; ++d)
+    {
+      for (size_t i = 0; i < n; ++i)
+      {
+        k_r[d][i] = vel[d][i] * Dt;
+        sum_r[d][i] += w * k_r[d][i];
+        sum_v[d][i] += w * k_v[d][i];
+      }
+    }
+  }
+
+  for (int d = 0; d < 3; ++d)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      ACC live = (ACC) !done[i];
+      r[d][i] += live * (ACC) sum_r[d][i];
+      v[d][i] += live * (ACC) sum_v[d][i];
+    }
+  }
+}
+
+#define TILE_STEP_3D(INCREMENT) \
+  for (size_t i = 0; i < n; ++i) \
+  { \
+    KERNEL (Lane3) dr, dv; \
+    INCREMENT (KERNEL (lane3) ((REAL) v_x[i], (REAL) v_y[i], \
+                               (REAL) v_z[i]), \
+               e, b, qm_Dt[i], dt, &dr, &dv); \
+    ACC live = (ACC) !done[i]; \
+    r_x[i] += live * (ACC) dr.x; \
+    r_y[i] += live * (ACC) dr.y; \
+    r_z[i] += live * (ACC) dr.z; \
+    v_x[i] += live * (ACC) dv.x; \
+    v_y[i] += live * (ACC) dv.y; \
+    v_z[i] += live * (ACC) dv.z; \
+  }
+
+void KERNEL (run_tile_3d) (Batch *batch, size_t begin, size_t end, Method
+method, double Dt, const Field3 *field)
+{
+  ACC r_x[BATCH_TILE], r_y[BATCH_TILE], r_z[BATCH_TILE];
+  ACC v_x[BATCH_TILE], v_y[BATCH_TILE], v_z[BATCH_TILE];
+  REAL qm_Dt[BATCH_TILE];
+  int done[BATCH_TILE], did_exit[BATCH_TILE];
+  unsigned int steps[BATCH_TILE];
+  size_t n = end - begin;
+  const REAL dt = (REAL) Dt;
+  const REAL e[3] = {(REAL) field->e._x, (REAL) field->e._y,
+                     (REAL) field->e._z};
+  const REAL b[3] = {(REAL) field->b._x, (REAL) field->b._y,
+                     (REAL) field->b._z};
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    r_x[i] = (ACC) batch->r_x[begin + i];
+    r_y[i] = (ACC) batch->r_y[begin + i];
+    r_z[i] = (ACC) batch->r_z[begin + i];
+    v_x[i] = (ACC) batch->v_x[begin + i];
+    v_y[i] = (ACC) batch->v_y[begin + i];
+    v_z[i] = (ACC) batch->v_z[begin + i];
+    qm_Dt[i] = (REAL) (batch->qm[begin + i] * Dt);
+    done[i] = 0;
+    did_exit[i] = 0;
+    steps[i] = 0;
+  }
+
+  size_t active = n;
+  for (unsigned int s = 0; s < MAX_BATCH_STEPS && active; ++s)
+  {
+    if (field->map)
+    {
+      ACC *r[3] = {r_x, r_y, r_z}, *v[3] = {v_x, v_y, v_z};
+      KERNEL (map_step_3d) (n, method, r, v, done, dt, qm_Dt, field->map);
+    }
+    else
+    {
+      switch (method)
+      {
+        case EULER:
+          TILE_STEP_3D (KERNEL (euler_increment_3d))
+          break;
+
+        case MIDPOINT:
+          TILE_STEP_3D (KERNEL (midpoint_increment_3d))
+          break;
+
+        default:
+          TILE_STEP_3D (KERNEL (runge_kutta_increment_3d))
+          break;
+      }
+    }
+
+    active = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+      int live = !done[i];
+      int exited = r_z[i] > (ACC) LENGTH;
+      int hit = r_y[i] > (ACC) R;
+      steps[i] += live;
+      did_exit[i] |= live & exited;
+      done[i] |= exited | hit;
+      active += !done[i];
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    batch->r_x[begin + i] = (double) r_x[i];
+    batch->r_y[begin + i] = (double) r_y[i];
+    batch->r_z[begin + i] = (double) r_z[i];
+    batch->v_x[begin + i] = (double) v_x[i];
+    batch->v_y[begin + i] = (double) v_y[i];
+    batch->v_z[begin + i] = (double) v_z[i];
+    batch->steps[begin + i] = steps[i];
+    batch->did_exit[begin + i] = did_exit[i];
+  }
+}
+
+#undef TILE_STEP_3D
@@ -0,0 +1,152 @@
+/* Stepping kernels of the batched engine, written once and instantiated by
+ * batch.c for every precision. There is intentionally no include guard: the
+ * includer defines REAL (type of the stage arithmetic), ACC (type the state
+ * is accumulated in) and KERNEL(name) (suffix of the instance) before every
+ * inclusion, and undefines them afterwards. */
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void KERNEL (run_tile) (Batch *batch, size_t begin, size_t end, Method
+method, double Dt);
+
+/***************************/
+/*        KERNELS          */
+/***************************/
+
+static inline void KERNEL (euler_increment) (REAL v_y, REAL v_z, REAL qm,
+                                             REAL Dt, REAL *dr_y,
+                                             REAL *dr_z, REAL *dv_y,
+                                             REAL *dv_z)
+{
+  *dv_y = qm * ((REAL) E - (REAL) B * v_z) * Dt;
+  *dv_z = qm * ((REAL) B * v_y) * Dt;
+  *dr_y = v_y * Dt;
+  *dr_z = v_z * Dt;
+}
+
+static inline void KERNEL (midpoint_increment) (REAL v_y, REAL v_z,
+                                                REAL qm, REAL Dt,
+                                                REAL *dr_y, REAL *dr_z,
+                                                REAL *dv_y, REAL *dv_z)
+{
+  REAL k_1_y = qm * ((REAL) E - (REAL) B * v_z) * Dt;
+  REAL k_1_z = qm * ((REAL) B * v_y) * Dt;
+  REAL mid_y = v_y + (REAL) 0.5 * k_1_y;
+  REAL mid_z = v_z + (REAL) 0.5 * k_1_z;
+  *dv_y = qm * ((REAL) E - (REAL) B * mid_z) * Dt;
+  *dv_z = qm * ((REAL) B * mid_y) * Dt;
+  *dr_y = mid_y * Dt;
+  *dr_z = mid_z * Dt;
+}
+
+static inline void KERNEL (runge_kutta_increment) (REAL v_y, REAL v_z,
+                                                   REAL qm, REAL Dt,
+                                                   REAL *dr_y, REAL *dr_z,
+                                                   REAL *dv_y, REAL *dv_z)
+{
+  const REAL half = (REAL) 0.5;
+  const REAL sixth = (REAL) 1 / 6;
+  REAL k_1_y = qm * ((REAL) E - (REAL) B * v_z) * Dt;
+  REAL k_1_z = qm * ((REAL) B * v_y) * Dt;
+  REAL v_2_y = v_y + half * k_1_y;
+  REAL v_2_z = v_z + half * k_1_z;
+  REAL k_2_y = qm * ((REAL) E - (REAL) B * v_2_z) * Dt;
+  REAL k_2_z = qm * ((REAL) B * v_2_y) * Dt;
+  REAL v_3_y = v_y + half * k_2_y;
+  REAL v_3_z = v_z + half * k_2_z;
+  REAL k_3_y = qm * ((REAL) E - (REAL) B * v_3_z) * Dt;
+  REAL k_3_z = qm * ((REAL) B * v_3_y) * Dt;
+  REAL v_4_y = v_y + k_3_y;
+  REAL v_4_z = v_z + k_3_z;
+  REAL k_4_y = qm * ((REAL) E - (REAL) B * v_4_z) * Dt;
+  REAL k_4_z = qm * ((REAL) B * v_4_y) * Dt;
+  *dv_y = sixth * (k_1_y + 2 * k_2_y + 2 * k_3_y + k_4_y);
+  *dv_z = sixth * (k_1_z + 2 * k_2_z + 2 * k_3_z + k_4_z);
+  *dr_y = sixth * (v_y + 2 * v_2_y + 2 * v_3_y + v_4_y) * Dt;
+  *dr_z = sixth * (v_z + 2 * v_2_z + 2 * v_3_z + v_4_z) * Dt;
+}
+
+/* Advances every lane of the tile by one step. Lanes that already left the
+ * filter are carried along with a zero increment instead of being branched
+ * around, which keeps the loop free of control flow. q / m is loaded per
+ * lane like the state, so mixed species cost no branch either. */
+#define TILE_STEP(INCREMENT) \
+  for (size_t i = 0; i < n; ++i) \
+  { \
+    REAL dr_y, dr_z, dv_y, dv_z; \
+    INCREMENT ((REAL) v_y[i], (REAL) v_z[i], qm[i], dt, &dr_y, &dr_z, \
+               &dv_y, &dv_z); \
+    ACC live = (ACC) !done[i]; \
+    r_y[i] += live * (ACC) dr_y; \
+    r_z[i] += live * (ACC) dr_z; \
+    v_y[i] += live * (ACC) dv_y; \
+    v_z[i] += live * (ACC) dv_z; \
+  }
+
+void KERNEL (run_tile) (Batch *batch, size_t begin, size_t end, Method
+method, double Dt)
+{
+  ACC r_y[BATCH_TILE], r_z[BATCH_TILE], v_y[BATCH_TILE], v_z[BATCH_TILE];
+  REAL qm[BATCH_TILE];
+  int done[BATCH_TILE], did_exit[BATCH_TILE];
+  unsigned int steps[BATCH_TILE];
+  size_t n = end - begin;
+  const REAL dt = (REAL) Dt;
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    r_y[i] = (ACC) batch->r_y[begin + i];
+    r_z[i] = (ACC) batch->r_z[begin + i];
+    v_y[i] = (ACC) batch->v_y[begin + i];
+    v_z[i] = (ACC) batch->v_z[begin + i];
+    qm[i] = (REAL) batch->qm[begin + i];
+    done[i] = 0;
+    did_exit[i] = 0;
+    steps[i] = 0;
+  }
+
+  size_t active = n;
+  for (unsigned int s = 0; s < MAX_BATCH_STEPS && active; ++s)
+  {
+    switch (method)
+    {
+      case EULER:
+        TILE_STEP (KERNEL (euler_increment))
+        break;
+
+      case MIDPOINT:
+        TILE_STEP (KERNEL (midpoint_increment))
+        break;
+
+      default:
+        TILE_STEP (KERNEL (runge_kutta_increment))
+        break;
+    }
+
+    active = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+      int live = !done[i];
+      int exited = r_z[i] > (ACC) LENGTH;
+      int hit = r_y[i] > (ACC) R;
+      steps[i] += live;
+      did_exit[i] |= live & exited;
+      done[i] |= exited | hit;
+      active += !done[i];
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    batch->r_y[begin + i] = (double) r_y[i];
+    batch->r_z[begin + i] = (double) r_z[i];
+    batch->v_y[begin + i] = (double) v_y[i];
+    batch->v_z[begin + i] = (double) v_z[i];
+    batch->steps[begin + i] = steps[i];
+    batch->did_exit[begin + i] = did_exit[i];
+  }
+}
+
+#undef TILE_STEP
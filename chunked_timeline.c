@@ -0,0 +1,132 @@
+#include "chunked_timeline.h"
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool spill_oldest_chunk (ChunkedTimeline *timeline);
+bool read_spilled_chunk (ChunkedTimeline *timeline, uint64_t chunk);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+ChunkedTimeline *alloc_chunked_time_line (size_t chunk_size, size_t
+resident_chunks)
+{
+  if (!chunk_size || !resident_chunks)
+  { return NULL; }
+  ChunkedTimeline *timeline = calloc (1, sizeof (ChunkedTimeline));
+  if (!timeline)
+  { return NULL; }
+  timeline->chunk_size = chunk_size;
+  timeline->resident_chunks = resident_chunks;
+  timeline->read_chunk = NO_CHUNK;
+  timeline->chunks = calloc (resident_chunks, sizeof (RkState *));
+  timeline->read_buffer = malloc (chunk_size * sizeof (RkState));
+  if (!timeline->chunks || !timeline->read_buffer)
+  {
+    free_chunked_time_line (&timeline);
+    return NULL;
+  }
+  for (size_t i = 0; i < resident_chunks; ++i)
+  {
+    timeline->chunks[i] = malloc (chunk_size * sizeof (RkState));
+    if (!timeline->chunks[i])
+    {
+      free_chunked_time_line (&timeline);
+      return NULL;
+    }
+  }
+  return timeline;
+}
+
+/* Chunk c lives in slot c % resident_chunks. Starting a chunk whose slot
+ * still holds an unspilled one writes that older chunk out first, which
+ * keeps the spill file in chunk order. */
+bool append_chunked_state (ChunkedTimeline *timeline, const TimeState
+*time_state)
+{
+  uint64_t chunk = timeline->size / timeline->chunk_size;
+  size_t offset = timeline->size % timeline->chunk_size;
+  if (!offset && chunk >= timeline->resident_chunks
+      && !spill_oldest_chunk (timeline))
+  { return false; }
+  RkState *slot = timeline->chunks[chunk % timeline->resident_chunks];
+  slot[offset] = (RkState) {time_state->time, *time_state->r,
+                            *time_state->v, *time_state->a};
+  timeline->size++;
+  return true;
+}
+
+bool get_chunked_state (ChunkedTimeline *timeline, uint64_t index, RkState
+*state)
+{
+  if (index >= timeline->size)
+  { return false; }
+  uint64_t chunk = index / timeline->chunk_size;
+  size_t offset = index % timeline->chunk_size;
+  if (chunk >= timeline->spilled_chunks)
+  {
+    *state = timeline->chunks[chunk % timeline->resident_chunks][offset];
+    return true;
+  }
+  if (chunk != timeline->read_chunk && !read_spilled_chunk (timeline, chunk))
+  { return false; }
+  *state = timeline->read_buffer[offset];
+  return true;
+}
+
+void free_chunked_time_line (ChunkedTimeline **p_timeline)
+{
+  ChunkedTimeline *timeline = *p_timeline;
+  if (!timeline)
+  { return; }
+  if (timeline->chunks)
+  {
+    for (size_t i = 0; i < timeline->resident_chunks; ++i)
+    {
+      free (timeline->chunks[i]);
+    }
+  }
+  if (timeline->spill)
+  { fclose (timeline->spill); }
+  free (timeline->chunks);
+  free (timeline->read_buffer);
+  free (timeline);
+  *p_timeline = NULL;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+bool spill_oldest_chunk (ChunkedTimeline *timeline)
+{
+  if (!timeline->spill)
+  {
+    timeline->spill = tmpfile ();
+    if (!timeline->spill)
+    { return false; }
+  }
+  uint64_t chunk = timeline->spilled_chunks;
+  RkState *slot = timeline->chunks[chunk % timeline->resident_chunks];
+  if (fseeko (timeline->spill, 0, SEEK_END)
+      || fwrite (slot, sizeof (RkState), timeline->chunk_size,
+                 timeline->spill) != timeline->chunk_size)
+  { return false; }
+  timeline->spilled_chunks++;
+  return true;
+}
+
+bool read_spilled_chunk (ChunkedTimeline *timeline, uint64_t chunk)
+{
+  off_t position = (off_t) (chunk * timeline->chunk_size * sizeof (RkState));
+  timeline->read_chunk = NO_CHUNK;
+  if (fseeko (timeline->spill, position, SEEK_SET)
+      || fread (timeline->read_buffer, sizeof (RkState), timeline->chunk_size,
+                timeline->spill) != timeline->chunk_size)
+  { return false; }
+  timeline->read_chunk = chunk;
+  return true;
+}
@@ -0,0 +1,34 @@
+#ifndef CHUNKED_TIMELINE_H
+#define CHUNKED_TIMELINE_H
+
+#include "methods.h"
+
+#define CHUNK_STATES 65536
+#define RESIDENT_CHUNKS 4
+#define NO_CHUNK UINT64_MAX
+
+/* A timeline that keeps only its newest resident_chunks chunks of
+ * chunk_size states in memory. Older chunks are appended in order to an
+ * anonymous spill file, so chunk c sits at c * chunk_size states into it
+ * and every state can still be read back by index. Reads of spilled
+ * chunks go through a one chunk buffer, so a forward scan costs one read
+ * per chunk. */
+typedef struct ChunkedTimeline
+{
+    size_t chunk_size, resident_chunks;
+    uint64_t size, spilled_chunks;
+    RkState **chunks;
+    FILE *spill;
+    RkState *read_buffer;
+    uint64_t read_chunk;
+}ChunkedTimeline;
+
+ChunkedTimeline *alloc_chunked_time_line (size_t chunk_size, size_t
+resident_chunks);
+bool append_chunked_state (ChunkedTimeline *timeline, const TimeState
+*time_state);
+bool get_chunked_state (ChunkedTimeline *timeline, uint64_t index, RkState
+*state);
+void free_chunked_time_line (ChunkedTimeline **p_timeline);
+
+#endif
@@ -0,0 +1,150 @@
+#include "etd_engine.h"
+#include <complex.h>
+
+#define ETD_PHI 5
+#define ETD_SERIES_RADIUS 1.
+#define ETD_SERIES_TERMS 20
+
+/* A state as two complex numbers, y + i z: the velocity then only rotates,
+ * w' = i omega w + n, and the position integrates it, rho' = w. */
+typedef struct EtdState
+{
+    double time;
+    double complex rho, w;
+}EtdState;
+
+/* phi_0 to phi_(ETD_PHI - 1) of one argument. */
+typedef struct EtdPhi
+{
+    double complex phi[ETD_PHI];
+}EtdPhi;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void get_phi (double complex z, EtdPhi *phi);
+double complex get_etd_force (const EtdPhysics *physics, const EtdState
+*state);
+void propagate (const EtdPhi *phi, double h, const EtdState *in, EtdState
+*out);
+void add_phi_force (const EtdPhi *phi, int k, double h, double complex n,
+                    EtdState *state);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* Cox and Matthews' ETDRK4 on u' = A u + N(t, u), with u = (rho, w) and
+ * A = [[0, 1], [0, i omega]]. The matrix functions of that A close in
+ * terms of the scalar ones of z = i omega h:
+ *   e^(hA) (rho, w) = (rho + h phi_1(z) w, e^z w),
+ *   phi_k(hA) (0, n) = (h phi_(k+1)(z) n, phi_k(z) n),
+ * so the rotation, and the drift of a constant force such as q E / m, are
+ * exact for any Dt. Only the perturbation is sampled at the stages, and
+ * Dt only has to resolve how it changes along the orbit. */
+void etd_step (const EtdPhysics *physics, const RkState *in, double Dt,
+               RkState *out)
+{
+  double w = physics->fields.qm * physics->fields.b;
+  EtdPhi full, half;
+  get_phi (I * w * Dt, &full);
+  get_phi (I * w * Dt / 2, &half);
+
+  EtdState u = {in->time, in->r._y + I * in->r._z, in->v._y + I * in->v._z};
+  double complex n_u = get_etd_force (physics, &u);
+  EtdState a, b, c, next;
+  propagate (&half, Dt / 2, &u, &a);
+  b = a;
+  add_phi_force (&half, 1, Dt / 2, n_u, &a);
+  double complex n_a = get_etd_force (physics, &a);
+  add_phi_force (&half, 1, Dt / 2, n_a, &b);
+  double complex n_b = get_etd_force (physics, &b);
+  propagate (&half, Dt / 2, &a, &c);
+  add_phi_force (&half, 1, Dt / 2, 2 * n_b - n_u, &c);
+  double complex n_c = get_etd_force (physics, &c);
+
+  propagate (&full, Dt, &u, &next);
+  add_phi_force (&full, 1, Dt, n_u, &next);
+  add_phi_force (&full, 2, Dt, -3 * n_u + 2 * (n_a + n_b) - n_c, &next);
+  add_phi_force (&full, 3, Dt, 4 * (n_u - n_a - n_b + n_c), &next);
+
+  out->time = next.time;
+  out->r = (Vec) {creal (next.rho), cimag (next.rho)};
+  out->v = (Vec) {creal (next.w), cimag (next.w)};
+  out->a = get_rk_a (&physics->fields, out->v);
+  if (physics->perturbation)
+  {
+    Vec extra = physics->perturbation (out->time, out->r, out->v,
+                                       physics->ctx);
+    out->a._y += extra._y;
+    out->a._z += extra._z;
+  }
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+/* phi_0 (z) = e^z and phi_(k+1) (z) = (phi_k (z) - 1 / k!) / z. The
+ * recurrence cancels badly for small z, where the Taylor series
+ * phi_k (z) = sum_j z^j / (j + k)! is used instead. */
+void get_phi (double complex z, EtdPhi *phi)
+{
+  if (cabs (z) >= ETD_SERIES_RADIUS)
+  {
+    phi->phi[0] = cexp (z);
+    double factorial = 1;
+    for (int k = 0; k + 1 < ETD_PHI; ++k)
+    {
+      phi->phi[k + 1] = (phi->phi[k] - 1 / factorial) / z;
+      factorial *= k + 1;
+    }
+    return;
+  }
+  double factorial = 1;
+  for (int k = 0; k < ETD_PHI; ++k)
+  {
+    /* Horner on sum_j z^j k! / (j + k)!, scaled by 1 / k! at the end. */
+    double complex sum = 1;
+    for (int j = ETD_SERIES_TERMS; j > 0; --j)
+    {
+      sum = 1 + sum * z / (j + k);
+    }
+    phi->phi[k] = sum / factorial;
+    factorial *= k + 1;
+  }
+}
+
+/* The part of w' that is not the rotation. */
+double complex get_etd_force (const EtdPhysics *physics, const EtdState
+*state)
+{
+  double complex n = physics->fields.qm
+                     * (physics->fields.e + I * physics->fields.e_z);
+  if (physics->perturbation)
+  {
+    Vec r = {creal (state->rho), cimag (state->rho)};
+    Vec v = {creal (state->w), cimag (state->w)};
+    Vec extra = physics->perturbation (state->time, r, v, physics->ctx);
+    n += extra._y + I * extra._z;
+  }
+  return n;
+}
+
+/* e^(hA) applied to in. */
+void propagate (const EtdPhi *phi, double h, const EtdState *in, EtdState
+*out)
+{
+  out->time = in->time + h;
+  out->rho = in->rho + h * phi->phi[1] * in->w;
+  out->w = phi->phi[0] * in->w;
+}
+
+/* Adds h phi_k(hA) (0, n). */
+void add_phi_force (const EtdPhi *phi, int k, double h, double complex n,
+                    EtdState *state)
+{
+  state->rho += h * h * phi->phi[k + 1] * n;
+  state->w += h * phi->phi[k] * n;
+}
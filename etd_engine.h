@@ -0,0 +1,23 @@
+#ifndef ETD_ENGINE_H
+#define ETD_ENGINE_H
+
+#include "rk_engine.h"
+
+/* Extra acceleration at (t, r, v) on top of the uniform crossed fields,
+ * e.g. sampled from a field map or a space charge grid. */
+typedef Vec (ETD_PERTURBATION)(double t, Vec r, Vec v, void *ctx);
+
+/* The uniform fields give the stiff linear part, which the exponential
+ * integrator takes exactly; the perturbation, when not NULL, is the
+ * remainder it treats explicitly. */
+typedef struct EtdPhysics
+{
+    RkPhysics fields;
+    ETD_PERTURBATION *perturbation;
+    void *ctx;
+}EtdPhysics;
+
+void etd_step (const EtdPhysics *physics, const RkState *in, double Dt,
+               RkState *out);
+
+#endif
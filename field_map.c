@@ -0,0 +1,250 @@
+#include "field_map.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIELD_MAP_MAGIC "NFMAP01"
+#define WRITE_BINARY_MODE "wb"
+#define WIEN_MAP_N_X 16
+#define WIEN_MAP_N_Y 16
+#define WIEN_MAP_N_Z 256
+#define WIEN_MAP_MARGIN 0.5
+#define FRINGE_WIDTH (4 * R)
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void init_bricks (FieldMap *field_map);
+size_t get_node_offset (const FieldMap *field_map, uint32_t i, uint32_t j,
+                        uint32_t k);
+size_t get_num_of_nodes (const FieldMap *field_map);
+void get_cell (const FieldMap *field_map, int axis, double pos, uint32_t *cell,
+               double *frac);
+void wien_fringe_profile (const Vec3 *r, Field3 *field);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+FieldMap *load_field_map (char *path)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+  { return NULL; }
+  struct stat st;
+  if (fstat (fd, &st) || (size_t) st.st_size < sizeof (FieldMapHeader))
+  {
+    close (fd);
+    return NULL;
+  }
+  void *mapping = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (mapping == MAP_FAILED)
+  { return NULL; }
+
+  FieldMap *field_map = calloc (1, sizeof (FieldMap));
+  if (!field_map)
+  {
+    munmap (mapping, st.st_size);
+    return NULL;
+  }
+  memcpy (&field_map->header, mapping, sizeof (FieldMapHeader));
+  field_map->mapping = mapping;
+  field_map->mapping_size = st.st_size;
+  field_map->nodes = (const double *) ((char *) mapping
+                                       + sizeof (FieldMapHeader));
+  init_bricks (field_map);
+
+  FieldMapHeader *header = &field_map->header;
+  size_t expected = sizeof (FieldMapHeader) + get_num_of_nodes (field_map)
+                    * FIELD_MAP_COMPONENTS * sizeof (double);
+  if (memcmp (header->magic, FIELD_MAP_MAGIC, sizeof (FIELD_MAP_MAGIC))
+      || header->brick != FIELD_MAP_BRICK || header->n_x < 2
+      || header->n_y < 2 || header->n_z < 2 || expected != field_map->mapping_size)
+  {
+    free_field_map (&field_map);
+    return NULL;
+  }
+  madvise (mapping, st.st_size, MADV_WILLNEED);
+  return field_map;
+}
+
+void free_field_map (FieldMap **p_field_map)
+{
+  FieldMap *field_map = *p_field_map;
+  if (!field_map)
+  { return; }
+  munmap (field_map->mapping, field_map->mapping_size);
+  free (field_map);
+  *p_field_map = NULL;
+}
+
+bool write_field_map (char *path, uint32_t n_x, uint32_t n_y, uint32_t n_z,
+                      const Vec3 *origin, const Vec3 *spacing, FIELD_PROFILE
+                      *profile)
+{
+  FieldMap field_map = {{FIELD_MAP_MAGIC, n_x, n_y, n_z, FIELD_MAP_BRICK,
+                         {origin->_x, origin->_y, origin->_z},
+                         {spacing->_x, spacing->_y, spacing->_z}, 0}};
+  init_bricks (&field_map);
+  size_t size = get_num_of_nodes (&field_map) * FIELD_MAP_COMPONENTS;
+  double *nodes = calloc (size, sizeof (double));
+  if (!nodes)
+  { return false; }
+
+  for (uint32_t k = 0; k < n_z; ++k)
+  {
+    for (uint32_t j = 0; j < n_y; ++j)
+    {
+      for (uint32_t i = 0; i < n_x; ++i)
+      {
+        Vec3 r = vec3 (origin->_x + i * spacing->_x,
+                       origin->_y + j * spacing->_y,
+                       origin->_z + k * spacing->_z);
+        Field3 field;
+        profile (&r, &field);
+        double *node = nodes + get_node_offset (&field_map, i, j, k);
+        node[0] = field.e._x;
+        node[1] = field.e._y;
+        node[2] = field.e._z;
+        node[3] = field.b._x;
+        node[4] = field.b._y;
+        node[5] = field.b._z;
+      }
+    }
+  }
+
+  FILE *f = fopen (path, WRITE_BINARY_MODE);
+  bool ret = f
+             && fwrite (&field_map.header, sizeof (FieldMapHeader), 1, f) == 1
+             && fwrite (nodes, sizeof (double), size, f) == size;
+  if (f)
+  { ret = !fclose (f) && ret; }
+  free (nodes);
+  return ret;
+}
+
+bool write_wien_field_map (char *path)
+{
+  Vec3 origin = vec3 (-R, -R, -WIEN_MAP_MARGIN);
+  Vec3 spacing = vec3 (2 * R / (WIEN_MAP_N_X - 1), 2 * R / (WIEN_MAP_N_Y - 1),
+                       (LENGTH + 2 * WIEN_MAP_MARGIN) / (WIEN_MAP_N_Z - 1));
+  return write_field_map (path, WIEN_MAP_N_X, WIEN_MAP_N_Y, WIEN_MAP_N_Z,
+                          &origin, &spacing, wien_fringe_profile);
+}
+
+void sample_field_map (const FieldMap *field_map, const Vec3 *r, Field3
+*field)
+{
+  double pos[3] = {r->_x, r->_y, r->_z};
+  uint32_t cell[3];
+  double frac[3];
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    get_cell (field_map, axis, pos[axis], &cell[axis], &frac[axis]);
+  }
+
+  double sum[FIELD_MAP_COMPONENTS] = {0};
+  for (int corner = 0; corner < 8; ++corner)
+  {
+    int d_x = corner & 1, d_y = (corner >> 1) & 1, d_z = corner >> 2;
+    double weight = (d_x ? frac[0] : 1 - frac[0])
+                    * (d_y ? frac[1] : 1 - frac[1])
+                    * (d_z ? frac[2] : 1 - frac[2]);
+    const double *node = field_map->nodes
+                         + get_node_offset (field_map, cell[0] + d_x,
+                                            cell[1] + d_y, cell[2] + d_z);
+    for (int c = 0; c < FIELD_MAP_COMPONENTS; ++c)
+    {
+      sum[c] += weight * node[c];
+    }
+  }
+  field->e = vec3 (sum[0], sum[1], sum[2]);
+  field->b = vec3 (sum[3], sum[4], sum[5]);
+  field->map = NULL;
+}
+
+void sample_field_map_batch (const FieldMap *field_map, size_t n,
+                             double *const r[3], double *e[3], double *b[3])
+{
+  for (size_t i = 0; i < n; ++i)
+  {
+    Vec3 pos = vec3 (r[0][i], r[1][i], r[2][i]);
+    Field3 field;
+    sample_field_map (field_map, &pos, &field);
+    e[0][i] = field.e._x;
+    e[1][i] = field.e._y;
+    e[2][i] = field.e._z;
+    b[0][i] = field.b._x;
+    b[1][i] = field.b._y;
+    b[2][i] = field.b._z;
+  }
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+void init_bricks (FieldMap *field_map)
+{
+  FieldMapHeader *header = &field_map->header;
+  field_map->bricks_x = (header->n_x + FIELD_MAP_BRICK - 1) / FIELD_MAP_BRICK;
+  field_map->bricks_y = (header->n_y + FIELD_MAP_BRICK - 1) / FIELD_MAP_BRICK;
+  field_map->bricks_z = (header->n_z + FIELD_MAP_BRICK - 1) / FIELD_MAP_BRICK;
+}
+
+size_t get_num_of_nodes (const FieldMap *field_map)
+{
+  return (size_t) field_map->bricks_x * field_map->bricks_y
+         * field_map->bricks_z * FIELD_MAP_BRICK * FIELD_MAP_BRICK
+         * FIELD_MAP_BRICK;
+}
+
+size_t get_node_offset (const FieldMap *field_map, uint32_t i, uint32_t j,
+                        uint32_t k)
+{
+  size_t brick = ((size_t) (k / FIELD_MAP_BRICK) * field_map->bricks_y
+                  + j / FIELD_MAP_BRICK) * field_map->bricks_x
+                 + i / FIELD_MAP_BRICK;
+  size_t local = ((k % FIELD_MAP_BRICK) * FIELD_MAP_BRICK
+                  + j % FIELD_MAP_BRICK) * FIELD_MAP_BRICK
+                 + i % FIELD_MAP_BRICK;
+  return (brick * FIELD_MAP_BRICK * FIELD_MAP_BRICK * FIELD_MAP_BRICK + local)
+         * FIELD_MAP_COMPONENTS;
+}
+
+/* Positions outside the grid are clamped onto its boundary, so the map keeps
+ * its edge values beyond the sampled region. */
+void get_cell (const FieldMap *field_map, int axis, double pos, uint32_t *cell,
+               double *frac)
+{
+  const FieldMapHeader *header = &field_map->header;
+  uint32_t n = axis == 0 ? header->n_x : axis == 1 ? header->n_y : header->n_z;
+  double u = (pos - header->origin[axis]) / header->spacing[axis];
+  if (!(u > 0))
+  { u = 0; }
+  if (u > n - 1)
+  { u = n - 1; }
+  uint32_t i = (uint32_t) u;
+  if (i > n - 2)
+  { i = n - 2; }
+  *cell = i;
+  *frac = u - i;
+}
+
+/* Uniform Wien filter field switched on and off by a tanh profile at the
+ * entrance (z = 0) and exit (z = LENGTH). The longitudinal components are
+ * the first order terms that keep both fields curl free. */
+void wien_fringe_profile (const Vec3 *r, Field3 *field)
+{
+  double entrance = tanh (r->_z / FRINGE_WIDTH);
+  double exit = tanh ((r->_z - LENGTH) / FRINGE_WIDTH);
+  double profile = 0.5 * (entrance - exit);
+  double d_profile = 0.5 * ((1 - entrance * entrance)
+                            - (1 - exit * exit)) / FRINGE_WIDTH;
+  field->e = vec3 (0, E * profile, E * r->_y * d_profile);
+  field->b = vec3 (-B * profile, 0, -B * r->_x * d_profile);
+  field->map = NULL;
+}
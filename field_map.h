@@ -0,0 +1,43 @@
+#ifndef FIELD_MAP_H
+#define FIELD_MAP_H
+
+#include "vec3.h"
+#include <stdint.h>
+
+#define FIELD_MAP_BRICK 4
+#define FIELD_MAP_COMPONENTS 6
+
+/* On-disk header of a field map. It is followed by the E and B samples,
+ * grouped in FIELD_MAP_BRICK^3 node bricks so the eight corners of a cell
+ * nearly always share one brick, i.e. a handful of cache lines. */
+typedef struct FieldMapHeader
+{
+    char magic[8];
+    uint32_t n_x, n_y, n_z, brick;
+    double origin[3], spacing[3];
+    uint64_t reserved;
+}FieldMapHeader;
+
+typedef struct FieldMap
+{
+    FieldMapHeader header;
+    uint32_t bricks_x, bricks_y, bricks_z;
+    const double *nodes;
+    void *mapping;
+    size_t mapping_size;
+}FieldMap;
+
+typedef void (FIELD_PROFILE)(const Vec3 *r, Field3 *field);
+
+FieldMap *load_field_map (char *path);
+void free_field_map (FieldMap **p_field_map);
+bool write_field_map (char *path, uint32_t n_x, uint32_t n_y, uint32_t n_z,
+                      const Vec3 *origin, const Vec3 *spacing, FIELD_PROFILE
+                      *profile);
+bool write_wien_field_map (char *path);
+void sample_field_map (const FieldMap *field_map, const Vec3 *r, Field3
+*field);
+void sample_field_map_batch (const FieldMap *field_map, size_t n,
+                             double *const r[3], double *e[3], double *b[3]);
+
+#endif
@@ -0,0 +1,304 @@
+#include "guiding_centre.h"
+
+#define GC_INIT_PASSES 2
+
+/* One step of the guiding centre, with the full orbit reconstructed over
+ * it for the crossing search. */
+typedef struct GcSpan
+{
+    const EtdPhysics *physics;
+    const GuidingCentre *in, *out;
+    double length, radius, curvature;
+}GcSpan;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+Vec get_gc_drift (const EtdPhysics *physics, double t, Vec centre, double
+gyro_speed, double phase);
+Vec get_gc_rotation (double gyro_speed, double phase);
+void get_gc_at (const GcSpan *span, double t, GuidingCentre *gc);
+double get_gc_offset (const GcSpan *span, double t);
+bool find_first_crossing (const GcSpan *span, double a, double b, double
+f_a, double *t);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* The drift depends on the ring, which depends on the drift, so with a
+ * perturbation the split is refined once more from the first guess. The
+ * uniform fields alone split exactly at once. */
+void get_guiding_centre (const EtdPhysics *physics, const RkState *particle,
+                         GuidingCentre *gc)
+{
+  double omega = physics->fields.qm * physics->fields.b;
+  EtdPhysics uniform = {physics->fields, NULL, NULL};
+  Vec drift = get_gc_drift (&uniform, particle->time, particle->r, 0, 0);
+  int passes = physics->perturbation ? GC_INIT_PASSES : 1;
+  for (int i = 0; i < passes; ++i)
+  {
+    Vec u = {particle->v._y - drift._y, particle->v._z - drift._z};
+    *gc = (GuidingCentre) {particle->time,
+                           {particle->r._y - u._z / omega,
+                            particle->r._z + u._y / omega},
+                           drift, sqrt (u._y * u._y + u._z * u._z),
+                           atan2 (u._z, u._y)};
+    drift = get_gc_drift (physics, gc->time, gc->centre, gc->gyro_speed,
+                          gc->phase);
+  }
+  gc->drift = drift;
+}
+
+void get_full_orbit (const EtdPhysics *physics, const GuidingCentre *gc,
+                     RkState *particle)
+{
+  double omega = physics->fields.qm * physics->fields.b;
+  Vec u = get_gc_rotation (gc->gyro_speed, gc->phase);
+  particle->time = gc->time;
+  particle->r = (Vec) {gc->centre._y + u._z / omega,
+                       gc->centre._z - u._y / omega};
+  particle->v = (Vec) {gc->drift._y + u._y, gc->drift._z + u._z};
+  particle->a = get_rk_a (&physics->fields, particle->v);
+  if (physics->perturbation)
+  {
+    Vec extra = physics->perturbation (particle->time, particle->r,
+                                       particle->v, physics->ctx);
+    particle->a._y += extra._y;
+    particle->a._z += extra._z;
+  }
+}
+
+/* RK4 on the centre, which moves with the slow drift only. The phase
+ * turns at omega and the gyro speed, the magnetic moment of a uniform B,
+ * stays as it is, so neither limits Dt. */
+void gc_step (const EtdPhysics *physics, const GuidingCentre *in, double Dt,
+              GuidingCentre *out)
+{
+  double omega = physics->fields.qm * physics->fields.b;
+  double t = in->time, s = in->gyro_speed;
+  double half_phase = in->phase + omega * Dt / 2;
+  double full_phase = in->phase + omega * Dt;
+  Vec c = in->centre;
+  Vec k_1 = in->drift;
+  Vec k_2 = get_gc_drift (physics, t + Dt / 2,
+                          (Vec) {c._y + Dt / 2 * k_1._y, c._z + Dt / 2
+                                 * k_1._z}, s, half_phase);
+  Vec k_3 = get_gc_drift (physics, t + Dt / 2,
+                          (Vec) {c._y + Dt / 2 * k_2._y, c._z + Dt / 2
+                                 * k_2._z}, s, half_phase);
+  Vec k_4 = get_gc_drift (physics, t + Dt,
+                          (Vec) {c._y + Dt * k_3._y, c._z + Dt * k_3._z}, s,
+                          full_phase);
+  out->time = t + Dt;
+  out->centre = (Vec) {c._y + Dt / 6 * (k_1._y + 2 * k_2._y + 2 * k_3._y
+                                        + k_4._y),
+                       c._z + Dt / 6 * (k_1._z + 2 * k_2._z + 2 * k_3._z
+                                        + k_4._z)};
+  out->gyro_speed = s;
+  out->phase = remainder (full_phase, 2 * M_PI);
+  out->drift = get_gc_drift (physics, out->time, out->centre, s, out->phase);
+}
+
+/* One guiding centre step from and to the full orbit. */
+void gc_orbit_step (const EtdPhysics *physics, const RkState *in, double Dt,
+                    RkState *out)
+{
+  GuidingCentre gc, next;
+  get_guiding_centre (physics, in, &gc);
+  gc_step (physics, &gc, Dt, &next);
+  get_full_orbit (physics, &next, out);
+}
+
+/* Whether the full orbit crosses r_z = length or r_y = radius between in
+ * and out. The orbit stays within larmor_radius of the centre, so a step
+ * whose ring keeps clear of both is settled without reconstructing
+ * anything. Otherwise the orbit is rebuilt on demand and searched for its
+ * first crossing, which crossing receives. */
+bool gc_cross (const EtdPhysics *physics, const GuidingCentre *in, const
+GuidingCentre *out, double length, double radius, RkState *crossing, bool
+*did_exit)
+{
+  double omega = physics->fields.qm * physics->fields.b;
+  double larmor_radius = in->gyro_speed / fabs (omega);
+  if (fmax (in->centre._y, out->centre._y) + larmor_radius <= radius
+      && fmax (in->centre._z, out->centre._z) + larmor_radius <= length)
+  { return false; }
+  GcSpan span = {physics, in, out, length, radius,
+                 in->gyro_speed * fabs (omega)};
+  double t;
+  if (!find_first_crossing (&span, in->time, out->time,
+                            get_gc_offset (&span, in->time), &t))
+  { return false; }
+  GuidingCentre gc;
+  get_gc_at (&span, t, &gc);
+  get_full_orbit (physics, &gc, crossing);
+  *did_exit = crossing->r._z > length;
+  return true;
+}
+
+/* The full orbit at t inside the step from in to out, rebuilt from the
+ * guiding centre there as the crossing search does. */
+void get_gc_state (const EtdPhysics *physics, const GuidingCentre *in, const
+GuidingCentre *out, double t, RkState *particle)
+{
+  GcSpan span = {physics, in, out, 0, 0, 0};
+  GuidingCentre gc;
+  get_gc_at (&span, t, &gc);
+  get_full_orbit (physics, &gc, particle);
+}
+
+/* A step set by the slow dynamics: GC_STEPS_PER_LENGTH steps for the
+ * drift to cover length, or a gyration per step without a drift. */
+double get_gc_Dt (const EtdPhysics *physics, double length)
+{
+  double drift = fabs (hypot (physics->fields.e, physics->fields.e_z)
+                       / physics->fields.b);
+  if (drift == 0)
+  { return 2 * M_PI / fabs (physics->fields.qm * physics->fields.b); }
+  return length / (GC_STEPS_PER_LENGTH * drift);
+}
+
+/* state starts as start itself, which is not checked for a crossing. */
+void init_gc_iterator (GcIterator *iterator, const EtdPhysics *physics, const
+RkState *start, double Dt, double length, double radius, uint64_t
+max_steps)
+{
+  *iterator = (GcIterator) {physics, Dt, length, radius, {0}, *start, 0,
+                            max_steps, false, false, false};
+  get_guiding_centre (physics, start, &iterator->gc);
+}
+
+/* Takes one step and leaves its full orbit state in state; false once the
+ * orbit has crossed or the budget is spent, with state left as it was. */
+bool next_gc_state (GcIterator *iterator)
+{
+  if (iterator->done || iterator->steps == iterator->max_steps)
+  {
+    iterator->done = true;
+    return false;
+  }
+  GuidingCentre next;
+  gc_step (iterator->physics, &iterator->gc, iterator->Dt, &next);
+  iterator->steps++;
+  if (gc_cross (iterator->physics, &iterator->gc, &next, iterator->length,
+                iterator->radius, &iterator->state, &iterator->did_exit))
+  {
+    iterator->crossed = true;
+    iterator->done = true;
+    return true;
+  }
+  iterator->gc = next;
+  get_full_orbit (iterator->physics, &next, &iterator->state);
+  return true;
+}
+
+/* Follows the guiding centre from start until the full orbit crosses the
+ * exit or the plate, or for max_steps steps. end receives the full orbit
+ * state at the crossing, or after the last step; false means the budget
+ * ran out first, as it does for a centre that does not drift. */
+bool run_guiding_centre (const EtdPhysics *physics, const RkState *start,
+                         double Dt, double length, double radius, uint64_t
+                         max_steps, RkState *end, bool *did_exit)
+{
+  GcIterator iterator;
+  init_gc_iterator (&iterator, physics, start, Dt, length, radius,
+                    max_steps);
+  while (next_gc_state (&iterator))
+  {}
+  *end = iterator.state;
+  if (iterator.crossed)
+  { *did_exit = iterator.did_exit; }
+  return iterator.crossed;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+/* d = i <a> / omega. Without a perturbation <a> is q E / m wherever the
+ * ring is; with one, it is averaged over GC_RING_POINTS points of the
+ * ring, each moving with the uniform drift plus its gyration. */
+Vec get_gc_drift (const EtdPhysics *physics, double t, Vec centre, double
+gyro_speed, double phase)
+{
+  double omega = physics->fields.qm * physics->fields.b;
+  Vec a = {physics->fields.qm * physics->fields.e,
+           physics->fields.qm * physics->fields.e_z};
+  if (physics->perturbation)
+  {
+    Vec uniform = {-a._z / omega, a._y / omega};
+    for (int k = 0; k < GC_RING_POINTS; ++k)
+    {
+      Vec u = get_gc_rotation (gyro_speed,
+                               phase + (2 * M_PI * k) / GC_RING_POINTS);
+      Vec r = {centre._y + u._z / omega, centre._z - u._y / omega};
+      Vec v = {uniform._y + u._y, uniform._z + u._z};
+      Vec extra = physics->perturbation (t, r, v, physics->ctx);
+      a._y += extra._y / GC_RING_POINTS;
+      a._z += extra._z / GC_RING_POINTS;
+    }
+  }
+  return (Vec) {-a._z / omega, a._y / omega};
+}
+
+Vec get_gc_rotation (double gyro_speed, double phase)
+{
+  return (Vec) {gyro_speed * cos (phase), gyro_speed * sin (phase)};
+}
+
+/* The guiding centre at t inside the span: the phase turns at omega and
+ * the centre moves on the chord of the step. */
+void get_gc_at (const GcSpan *span, double t, GuidingCentre *gc)
+{
+  const GuidingCentre *in = span->in, *out = span->out;
+  double omega = span->physics->fields.qm * span->physics->fields.b;
+  double theta = (t - in->time) / (out->time - in->time);
+  *gc = (GuidingCentre) {t,
+                         {in->centre._y + theta * (out->centre._y
+                                                   - in->centre._y),
+                          in->centre._z + theta * (out->centre._z
+                                                   - in->centre._z)},
+                         {in->drift._y + theta * (out->drift._y
+                                                  - in->drift._y),
+                          in->drift._z + theta * (out->drift._z
+                                                  - in->drift._z)},
+                         in->gyro_speed, in->phase + omega * (t - in->time)};
+}
+
+/* Positive once the full orbit is beyond either boundary. */
+double get_gc_offset (const GcSpan *span, double t)
+{
+  GuidingCentre gc;
+  get_gc_at (span, t, &gc);
+  RkState particle;
+  get_full_orbit (span->physics, &gc, &particle);
+  return fmax (particle.r._z - span->length, particle.r._y - span->radius);
+}
+
+/* Earliest t in (a, b] with a positive offset, f_a <= 0 the offset at a.
+ * The centre moves on a chord, so the orbit only bends by the gyration,
+ * at most curvature = gyro_speed omega, and over an interval of length h
+ * the offset rises at most curvature h^2 / 8 above the larger of its ends.
+ * Intervals that leave no room to reach 0 are dropped, the others are
+ * split, the earlier half first, down to GC_TIME_RESOLUTION of the step.
+ * A graze that stays below the boundary at that resolution is not a
+ * crossing. */
+bool find_first_crossing (const GcSpan *span, double a, double b, double
+f_a, double *t)
+{
+  double f_b = get_gc_offset (span, b);
+  if (fmax (f_a, f_b) + span->curvature * (b - a) * (b - a) / 8 <= 0)
+  { return false; }
+  double step = span->out->time - span->in->time;
+  if (b - a <= GC_TIME_RESOLUTION * step)
+  {
+    *t = b;
+    return f_b > 0;
+  }
+  double mid = (a + b) / 2;
+  if (find_first_crossing (span, a, mid, f_a, t))
+  { return true; }
+  return find_first_crossing (span, mid, b, get_gc_offset (span, mid), t);
+}
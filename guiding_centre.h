@@ -0,0 +1,60 @@
+#ifndef GUIDING_CENTRE_H
+#define GUIDING_CENTRE_H
+
+#include "methods.h"
+
+#define GC_RING_POINTS 8
+#define GC_STEPS_PER_LENGTH 16
+#define GC_MAX_STEPS (64 * GC_STEPS_PER_LENGTH)
+#define GC_TIME_RESOLUTION 0x1p-40
+
+/* A particle as the centre of its gyration and the gyration around it.
+ * With w = v_y + i v_z and omega = qB/m, the velocity splits into the
+ * drift d = i <a> / omega, <a> the force per mass averaged over the gyro
+ * ring, and a part u that only rotates, u = gyro_speed e^(i phase). The
+ * particle is then at centre - i u / omega, i.e. larmor_radius =
+ * gyro_speed / omega away from the centre. */
+typedef struct GuidingCentre
+{
+    double time;
+    Vec centre, drift;
+    double gyro_speed, phase;
+}GuidingCentre;
+
+/* Hands out the full orbit one guiding centre step at a time, and the
+ * state at the crossing instead of the step end once the orbit crosses
+ * the exit or the plate. Like StateIterator it ends on the crossing or
+ * after max_steps steps. */
+typedef struct GcIterator
+{
+    const EtdPhysics *physics;
+    double Dt, length, radius;
+    GuidingCentre gc;
+    RkState state;
+    uint64_t steps, max_steps;
+    bool done, crossed, did_exit;
+}GcIterator;
+
+void get_guiding_centre (const EtdPhysics *physics, const RkState *particle,
+                         GuidingCentre *gc);
+void get_full_orbit (const EtdPhysics *physics, const GuidingCentre *gc,
+                     RkState *particle);
+void gc_step (const EtdPhysics *physics, const GuidingCentre *in, double Dt,
+              GuidingCentre *out);
+void gc_orbit_step (const EtdPhysics *physics, const RkState *in, double Dt,
+                    RkState *out);
+bool gc_cross (const EtdPhysics *physics, const GuidingCentre *in, const
+GuidingCentre *out, double length, double radius, RkState *crossing, bool
+*did_exit);
+void get_gc_state (const EtdPhysics *physics, const GuidingCentre *in, const
+GuidingCentre *out, double t, RkState *particle);
+double get_gc_Dt (const EtdPhysics *physics, double length);
+void init_gc_iterator (GcIterator *iterator, const EtdPhysics *physics, const
+RkState *start, double Dt, double length, double radius, uint64_t
+max_steps);
+bool next_gc_state (GcIterator *iterator);
+bool run_guiding_centre (const EtdPhysics *physics, const RkState *start,
+                         double Dt, double length, double radius, uint64_t
+                         max_steps, RkState *end, bool *did_exit);
+
+#endif
@@ -2,36 +2,269 @@
 #include <math.h>
 
 #define ERRORS_HEADERS "Dt,err_r,err_v\n"
-#define EULER_ERRORS_CSV "../csv_files/euler_errors.csv"
-#define MIDPOINT_ERRORS_CSV "../csv_files/midpoint_errors.csv"
-#define RUNGE_KUTTA_ERRORS_CSV "../csv_files/runge_kutta_errors.csv"
+#define ERRORS_CSV "../csv_files/%s_errors.csv"
 #define WRITE_MODE "w"
 #define ERROR_CELL "%lf,"
 #define NEW_LINE "\n"
+#define CONVERGENCE_CSV "../csv_files/%s_convergence.csv"
+#define CONVERGENCE_HEADERS "Dt,err_r,err_v,order_r,order_v\n"
+#define CONVERGENCE_ROW "%lf,%lf,%lf,%lf,%lf\n"
+#define SWEEP_SUMMARY_HEADERS "order_r,std_err_r,order_v,std_err_v,points,"\
+"stop\n"
+#define SWEEP_SUMMARY_ROW "%lf,%lf,%lf,%lf,%d,%s\n"
+#define PROFILE_CSV "../csv_files/%s_error_profile.csv"
+#define PROFILE_HEADERS "time,err_r,err_v\n"
+#define PROFILE_ROW "%lf,%e,%e\n"
+#define PROFILE_SUMMARY_HEADERS "l2_r,l2_v,max_r,max_v,t_max_r,t_max_v\n"
+#define PROFILE_SUMMARY_ROW "%e,%e,%e,%e,%lf,%lf\n"
+#define PERTURBED_CSV "../csv_files/%s_perturbed.csv"
+#define PERTURBED_HEADERS "steps,Dt,diff_r,diff_v,order_r,order_v\n"
+#define PERTURBED_ROW "%" PRIu64 ",%e,%e,%e,%lf,%lf\n"
+#define PERTURBED_SUMMARY_HEADERS "order_r,order_v\n"
+#define PERTURBED_SUMMARY_ROW "%lf,%lf\n"
+#define PERTURBED_B 200.0
+#define PERTURBED_T 10.0
+#define PERTURBED_SIZE 0.1
+#define PERTURBED_MIN_STEPS 64
+#define PERTURBED_LEVELS 7
+#define SWEEP_TOLERANCE 0.05
+#define SWEEP_DRIFT 0.05
+#define SWEEP_STABLE_POINTS 2
+#define SWEEP_ROUNDOFF_POINTS 2
 
 /******************************************/
 /*        FUNCTIONS DECLARATIONS          */
 /******************************************/
 
-TimeState *get_analytic_T (double T);
-bool get_err (TimeState *analytic_T, int dev_factor, Method method, double
-T, double *err_r, double *err_v);
+bool get_err (TimeState *analytic_T, uint64_t dev_factor, Method method,
+              double T, double *err_r, double *err_v);
 void print_err_arr (double *err_arr, char *path, int num_of_errors);
-TimeState *get_numeric_T (int dev_factor, double T, Method method);
-double get_dist (Vec *first, Vec *sec);
+TimeState *get_numeric_T (uint64_t dev_factor, double T, Method method);
 char *get_error_path (Method method);
+bool fill_err_arr (double *err_arr, Method method, double T, uint64_t
+max_dev_factor, int num_of_errors);
+bool get_cached_err_arr (double *err_arr, Method method, double T, uint64_t
+max_dev_factor, int num_of_errors);
+bool read_err_arr (double *err_arr, char *path, int num_of_errors);
+bool write_err_arr (double *err_arr, char *path, int num_of_errors);
+void init_order_tracker (OrderTracker *tracker);
+void update_order_tracker (OrderTracker *tracker, double Dt, double err);
+void fit_order (OrderTracker *tracker);
+char *get_convergence_path (Method method);
+char *get_sweep_stop_str (SweepStop stop);
+Vec get_test_perturbation (double t, Vec r, Vec v, void *ctx);
+RkState get_perturbed_T (const EtdPhysics *physics, uint64_t steps);
+char *get_profile_path (Method method);
 
 /***********************************************/
 /*        H FUNCTIONS IMPLEMENTATIONS          */
 /***********************************************/
 
-bool export_log_log_error (Method method, double T, int max_dev_factor, int
-num_of_errors)
+bool export_log_log_error (Method method, double T, uint64_t max_dev_factor,
+                           int num_of_errors, bool cached)
 {
   double err_arr[num_of_errors * 3];
+  bool ret = cached
+             ? get_cached_err_arr (err_arr, method, T, max_dev_factor,
+                                   num_of_errors)
+             : fill_err_arr (err_arr, method, T, max_dev_factor,
+                             num_of_errors);
+  if (!ret)
+  { return false; }
+  char *path = get_error_path (method);
+  if (!path)
+  { return false; }
+  print_err_arr (err_arr, path, num_of_errors);
+  free (path);
+  return true;
+}
+
+/* Walks the same Dt grid as export_log_log_error from coarse to fine, but
+ * stops as soon as both the position and the velocity order are settled.
+ * The points taken go to the method's convergence CSV together with the
+ * running fits, and the final fit is printed to stdout. */
+bool export_convergence_sweep (Method method, double T, uint64_t
+                               max_dev_factor, int num_of_errors)
+{
+  char *path = get_convergence_path (method);
+  TimeState *analytic_T = get_analytic_T (T);
+  FILE *f = path ? fopen (path, WRITE_MODE) : NULL;
+  free (path);
+  if (!f || !analytic_T)
+  {
+    if (f)
+    { fclose (f); }
+    free_time_state (&analytic_T);
+    return false;
+  }
+
+  OrderTracker tracker_r, tracker_v;
+  init_order_tracker (&tracker_r);
+  init_order_tracker (&tracker_v);
+  fprintf (f, CONVERGENCE_HEADERS);
+  uint64_t dev_factor = max_dev_factor / num_of_errors;
+  int points = 0;
+  bool ret = true;
+  for (uint64_t i = dev_factor; i <= max_dev_factor && ret;
+       i += dev_factor)
+  {
+    double err_r = 0;
+    double err_v = 0;
+    ret = get_err (analytic_T, i, method, T, &err_r, &err_v);
+    if (!ret)
+    { break; }
+    update_order_tracker (&tracker_r, T / i, err_r);
+    update_order_tracker (&tracker_v, T / i, err_v);
+    fprintf (f, CONVERGENCE_ROW, log (T / i), log (err_r), log (err_v),
+             tracker_r.order, tracker_v.order);
+    points++;
+    if (tracker_r.settled && tracker_v.settled)
+    { break; }
+  }
+  fclose (f);
+  free_time_state (&analytic_T);
+  if (!ret)
+  { return false; }
+
+  SweepStop stop = SWEEP_EXHAUSTED;
+  if (tracker_r.settled && tracker_v.settled)
+  {
+    stop = tracker_r.floored || tracker_v.floored ? SWEEP_ROUNDOFF
+                                                  : SWEEP_STABLE;
+  }
+  fprintf (stdout, SWEEP_SUMMARY_HEADERS);
+  fprintf (stdout, SWEEP_SUMMARY_ROW, tracker_r.order, tracker_r.std_err,
+           tracker_v.order, tracker_v.std_err, points,
+           get_sweep_stop_str (stop));
+  return true;
+}
+
+/* The order check for the exponential integrator. Without a perturbation
+ * it is exact, so the sweeps above only see roundoff; here it runs with a
+ * t and r dependent extra acceleration in a field PERTURBED_B / B times
+ * stiffer than the default, omega T = 300, from PERTURBED_MIN_STEPS steps
+ * (omega Dt = 4.7, past the RK4 stability limit) doubling PERTURBED_LEVELS
+ * times, which stops short of roundoff. There is no closed form, so each
+ * row holds the distance between the end states at steps and 2 steps, and
+ * the order log2 of the ratio of successive distances. The last order is
+ * printed to stdout. */
+bool export_perturbed_convergence (Method method)
+{
+  if (method != ETD_RUNGE_KUTTA)
+  { return false; }
+  char *path = get_method_path (method, PERTURBED_CSV);
+  FILE *f = path ? fopen (path, WRITE_MODE) : NULL;
+  free (path);
+  if (!f)
+  { return false; }
+  EtdPhysics physics = {{q / m, E, PERTURBED_B, 0}, get_test_perturbation,
+                        NULL};
+  fprintf (f, PERTURBED_HEADERS);
+  uint64_t steps = PERTURBED_MIN_STEPS;
+  RkState coarse = get_perturbed_T (&physics, steps);
+  double prev_r = NAN, prev_v = NAN, order_r = NAN, order_v = NAN;
+  for (int i = 0; i < PERTURBED_LEVELS; ++i, steps *= 2)
+  {
+    RkState fine = get_perturbed_T (&physics, 2 * steps);
+    double diff_r = get_dist (&coarse.r, &fine.r);
+    double diff_v = get_dist (&coarse.v, &fine.v);
+    order_r = log2 (prev_r / diff_r);
+    order_v = log2 (prev_v / diff_v);
+    fprintf (f, PERTURBED_ROW, steps, PERTURBED_T / steps, diff_r, diff_v,
+             order_r, order_v);
+    prev_r = diff_r;
+    prev_v = diff_v;
+    coarse = fine;
+  }
+  fprintf (stdout, PERTURBED_SUMMARY_HEADERS);
+  fprintf (stdout, PERTURBED_SUMMARY_ROW, order_r, order_v);
+  return !fclose (f);
+}
+
+/* One pass: the analytic state is evaluated next to every numeric step
+ * as it is pulled from the iterator, so neither trajectory is stored.
+ * Every decimation-th sample is also written to f when f is not NULL. */
+bool get_error_profile (Method method, double T, uint64_t dev_factor,
+                        unsigned int decimation, FILE *f, ErrorProfile
+                        *profile)
+{
+  *profile = (ErrorProfile) {0};
+  double Dt = T / dev_factor;
+  StateIterator iterator;
+  init_state_iterator (&iterator, get_starting_conditions (),
+                       get_method (method), Dt, dev_factor);
+  if (f)
+  { fprintf (f, PROFILE_HEADERS); }
+  TimeState *state;
+  while ((state = next_state (&iterator)))
+  {
+    Vec r, v;
+    fill_analytic_state (state->time, &r, &v);
+    double err_r = get_dist (&r, state->r);
+    double err_v = get_dist (&v, state->v);
+    profile->sum_sq_r += err_r * err_r;
+    profile->sum_sq_v += err_v * err_v;
+    if (err_r > profile->max_r)
+    {
+      profile->max_r = err_r;
+      profile->t_max_r = state->time;
+    }
+    if (err_v > profile->max_v)
+    {
+      profile->max_v = err_v;
+      profile->t_max_v = state->time;
+    }
+    if (f && decimation && !(iterator.steps % decimation))
+    { fprintf (f, PROFILE_ROW, state->time, err_r, err_v); }
+    profile->samples++;
+  }
+  bool ret = !iterator.failed;
+  free_state_iterator (&iterator);
+  profile->l2_r = sqrt (profile->sum_sq_r * Dt);
+  profile->l2_v = sqrt (profile->sum_sq_v * Dt);
+  return ret;
+}
+
+/* Prints the summary to stdout and, unless decimation is 0, the decimated
+ * profile to the method's error profile CSV. */
+bool export_error_profile (Method method, double T, uint64_t dev_factor,
+                           unsigned int decimation)
+{
+  FILE *f = NULL;
+  if (decimation)
+  {
+    char *path = get_profile_path (method);
+    f = path ? fopen (path, WRITE_MODE) : NULL;
+    free (path);
+    if (!f)
+    { return false; }
+  }
+  ErrorProfile profile;
+  bool ret = get_error_profile (method, T, dev_factor, decimation, f,
+                                &profile);
+  if (f)
+  { fclose (f); }
+  if (!ret)
+  { return false; }
+  fprintf (stdout, PROFILE_SUMMARY_HEADERS);
+  fprintf (stdout, PROFILE_SUMMARY_ROW, profile.l2_r, profile.l2_v,
+           profile.max_r, profile.max_v, profile.t_max_r, profile.t_max_v);
+  return true;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+
+bool fill_err_arr (double *err_arr, Method method, double T, uint64_t
+max_dev_factor, int num_of_errors)
+{
   TimeState *analytic_T = get_analytic_T (T);
-  int dev_factor = max_dev_factor / num_of_errors;
-  for (int i = dev_factor; i < max_dev_factor; i += dev_factor)
+  if (!analytic_T)
+  { return false; }
+  uint64_t dev_factor = max_dev_factor / num_of_errors;
+  for (uint64_t i = dev_factor; i <= max_dev_factor; i += dev_factor)
   {
     double err_r = 0;
     double err_v = 0;
@@ -45,17 +278,59 @@ num_of_errors)
     err_arr[j + 1] = log (err_r);
     err_arr[j + 2] = log (err_v);
   }
-  char *path = get_error_path (method);
-  print_err_arr (err_arr, path, num_of_errors);
-  free (path);
   free_time_state (&analytic_T);
   return true;
 }
 
-/***************************/
-/*        HELPERS          */
-/***************************/
+/* The sweep is stored as rows of (Dt, err_r, err_v) in the compressed
+ * trajectory format under a key of the whole sweep. */
+bool get_cached_err_arr (double *err_arr, Method method, double T, uint64_t
+max_dev_factor, int num_of_errors)
+{
+  CacheKey key = {ERRORS_RESULT, method, max_dev_factor, num_of_errors,
+                  T / max_dev_factor};
+  char cache_path[CACHE_PATH_SIZE], tmp_path[CACHE_PATH_SIZE];
+  if (!get_starting_key (&key)
+      || !get_cache_path (&key, cache_path, sizeof (cache_path)))
+  { return false; }
+  if (lookup_cache (cache_path)
+      && read_err_arr (err_arr, cache_path, num_of_errors))
+  { return true; }
+  if (!fill_err_arr (err_arr, method, T, max_dev_factor, num_of_errors))
+  { return false; }
+  if (get_cache_tmp_path (cache_path, tmp_path, sizeof (tmp_path)))
+  {
+    if (write_err_arr (err_arr, tmp_path, num_of_errors))
+    { commit_cache_entry (tmp_path, cache_path); }
+    else
+    { remove (tmp_path); }
+  }
+  return true;
+}
+
+bool read_err_arr (double *err_arr, char *path, int num_of_errors)
+{
+  TrajectoryDecoder *decoder = open_trajectory_decoder (path);
+  bool ret = decoder && decoder->columns == 3
+             && decoder->rows == (uint64_t) num_of_errors;
+  for (int i = 0; i < num_of_errors && ret; ++i)
+  {
+    ret = decode_row (decoder, &err_arr[3 * i]);
+  }
+  close_trajectory_decoder (&decoder);
+  return ret;
+}
 
+bool write_err_arr (double *err_arr, char *path, int num_of_errors)
+{
+  TrajectoryEncoder *encoder = open_trajectory_encoder (path, 3);
+  bool ret = encoder != NULL;
+  for (int i = 0; i < num_of_errors && ret; ++i)
+  {
+    ret = encode_row (encoder, &err_arr[3 * i]);
+  }
+  return close_trajectory_encoder (&encoder) && ret;
+}
 
 TimeState *get_analytic_T (double T)
 {
@@ -66,8 +341,8 @@ TimeState *get_analytic_T (double T)
   return ret;
 }
 
-bool get_err (TimeState *analytic_T, int dev_factor, Method method, double
-T, double *err_r, double *err_v)
+bool get_err (TimeState *analytic_T, uint64_t dev_factor, Method method,
+              double T, double *err_r, double *err_v)
 {
   TimeState *numeric_T = get_numeric_T (dev_factor, T, method);
   if (!numeric_T)
@@ -78,21 +353,19 @@ T, double *err_r, double *err_v)
   return true;
 }
 
-TimeState *get_numeric_T (int dev_factor, double T, Method method)
+TimeState *get_numeric_T (uint64_t dev_factor, double T, Method method)
 {
-  Timeline *timeline = create_time_line (dev_factor, T, get_method (method));
-  if (!timeline)
-  { return NULL; }
-  TimeState *numeric_T = clone_time_state (timeline->last);
-//  printf ("Numeric, Dt = %lf:\ntime: %lf\nr= %lf, %lf\nv = %lf, %lf\n\n",
-//          T/dev_factor,
-//          numeric_T->time,
-//          numeric_T->r->_y,
-//          numeric_T->r->_z,
-//          numeric_T->v->_y,
-//          numeric_T->r->_z);
-  free_time_line (&timeline);
-  return numeric_T;
+  StateIterator iterator;
+  init_state_iterator (&iterator, get_starting_conditions (),
+                       get_method (method), T / dev_factor, dev_factor);
+  while (next_state (&iterator))
+  {}
+  if (iterator.failed)
+  {
+    free_state_iterator (&iterator);
+    return NULL;
+  }
+  return take_last_state (&iterator);
 }
 
 double get_dist (Vec *first, Vec *sec)
@@ -102,24 +375,7 @@ double get_dist (Vec *first, Vec *sec)
 
 char *get_error_path (Method method)
 {
-  char *path = "";
-  switch (method)
-  {
-    case EULER:
-      path = EULER_ERRORS_CSV;
-      break;
-
-    case MIDPOINT:
-      path = MIDPOINT_ERRORS_CSV;
-      break;
-
-    case RUNGE_KUTTA:
-      path = RUNGE_KUTTA_ERRORS_CSV;
-      break;
-  }
-  char *ret = malloc (strlen (path) + 1);
-  strcpy (ret, path);
-  return ret;
+  return get_method_path (method, ERRORS_CSV);
 }
 
 void print_err_arr (double *err_arr, char *path, int num_of_errors)
@@ -135,4 +391,135 @@ void print_err_arr (double *err_arr, char *path, int num_of_errors)
     }
   }
   fclose (f);
-}
\ No newline at end of file
+}
+
+void init_order_tracker (OrderTracker *tracker)
+{
+  *tracker = (OrderTracker) {{0}, {0}, 0, 0, NAN, NAN, NAN, INFINITY, 0, 0,
+                             false, false};
+}
+
+/* A point whose error did not drop below the previous one only counts
+ * towards the roundoff floor once a full window has been fitted; before
+ * that the coarse end of the sweep is allowed to be non-monotonic. */
+void update_order_tracker (OrderTracker *tracker, double Dt, double err)
+{
+  if (tracker->settled)
+  { return; }
+  if (err <= 0)
+  {
+    tracker->settled = true;
+    tracker->floored = true;
+    return;
+  }
+  bool rising = tracker->size && err >= tracker->prev_err;
+  tracker->prev_err = err;
+  if (rising && tracker->size >= SWEEP_WINDOW)
+  {
+    if (++tracker->rising >= SWEEP_ROUNDOFF_POINTS)
+    {
+      tracker->settled = true;
+      tracker->floored = true;
+      tracker->order = tracker->best_order;
+      tracker->std_err = tracker->best_std_err;
+    }
+    return;
+  }
+  tracker->rising = 0;
+  size_t slot = tracker->size++ % SWEEP_WINDOW;
+  tracker->log_Dt[slot] = log (Dt);
+  tracker->log_err[slot] = log (err);
+  if (tracker->size < SWEEP_WINDOW)
+  { return; }
+
+  /* The fitted order of a low order method creeps towards its asymptote
+   * over the whole sweep, so stability is judged by how fast it moves per
+   * unit of log(Dt), not by the change between neighbouring points, which
+   * shrinks with the grid spacing. */
+  double prev_order = tracker->order;
+  double prev_log_Dt = tracker->log_Dt[(slot + SWEEP_WINDOW - 1)
+                                       % SWEEP_WINDOW];
+  fit_order (tracker);
+  double drift = fabs (tracker->order - prev_order)
+                 / fabs (tracker->log_Dt[slot] - prev_log_Dt);
+  bool stable = drift < SWEEP_DRIFT && tracker->std_err < SWEEP_TOLERANCE;
+  if (tracker->std_err < tracker->best_std_err)
+  {
+    tracker->best_order = tracker->order;
+    tracker->best_std_err = tracker->std_err;
+  }
+  tracker->stable = stable ? tracker->stable + 1 : 0;
+  tracker->settled = tracker->stable >= SWEEP_STABLE_POINTS;
+}
+
+void fit_order (OrderTracker *tracker)
+{
+  double mean_x = 0, mean_y = 0;
+  for (int i = 0; i < SWEEP_WINDOW; ++i)
+  {
+    mean_x += tracker->log_Dt[i] / SWEEP_WINDOW;
+    mean_y += tracker->log_err[i] / SWEEP_WINDOW;
+  }
+  double s_xx = 0, s_xy = 0;
+  for (int i = 0; i < SWEEP_WINDOW; ++i)
+  {
+    s_xx += pow (tracker->log_Dt[i] - mean_x, 2);
+    s_xy += (tracker->log_Dt[i] - mean_x) * (tracker->log_err[i] - mean_y);
+  }
+  tracker->order = s_xy / s_xx;
+  double residuals = 0;
+  for (int i = 0; i < SWEEP_WINDOW; ++i)
+  {
+    double fitted = mean_y + tracker->order * (tracker->log_Dt[i] - mean_x);
+    residuals += pow (tracker->log_err[i] - fitted, 2);
+  }
+  tracker->std_err = sqrt (residuals / (SWEEP_WINDOW - 2) / s_xx);
+}
+
+char *get_convergence_path (Method method)
+{
+  return get_method_path (method, CONVERGENCE_CSV);
+}
+
+/* Smooth in t and r and small next to the stiff fields. */
+Vec get_test_perturbation (double t, Vec r, Vec v, void *ctx)
+{
+  (void) v;
+  (void) ctx;
+  return (Vec) {PERTURBED_SIZE * cos (r._z - t),
+                PERTURBED_SIZE * sin (r._y + t / 2)};
+}
+
+RkState get_perturbed_T (const EtdPhysics *physics, uint64_t steps)
+{
+  double Dt = PERTURBED_T / steps;
+  RkState state = {0, {0, 0}, {0, 3 * E / PERTURBED_B}};
+  state.a = get_rk_a (&physics->fields, state.v);
+  for (uint64_t i = 0; i < steps; ++i)
+  {
+    RkState next;
+    etd_step (physics, &state, Dt, &next);
+    state = next;
+  }
+  return state;
+}
+
+char *get_sweep_stop_str (SweepStop stop)
+{
+  switch (stop)
+  {
+    case SWEEP_STABLE:
+      return "stable";
+
+    case SWEEP_ROUNDOFF:
+      return "roundoff";
+
+    default:
+      return "exhausted";
+  }
+}
+
+char *get_profile_path (Method method)
+{
+  return get_method_path (method, PROFILE_CSV);
+}
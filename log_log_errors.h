@@ -4,8 +4,55 @@
 #include "timeline.h"
 #include <math.h>
 
-bool export_log_log_error (Method method, double T, int max_dev_factor,
-                           int num_of_errors);
+#define SWEEP_WINDOW 4
+
+typedef enum SweepStop
+{
+    SWEEP_EXHAUSTED,
+    SWEEP_STABLE,
+    SWEEP_ROUNDOFF
+}SweepStop;
+
+/* Online least squares fit of log(err) against log(Dt) over the last
+ * SWEEP_WINDOW points of a sweep. std_err is the standard error of the
+ * fitted order. A tracker is settled once the order has stopped drifting or
+ * the error has started to grow again as Dt shrinks (roundoff floor). On
+ * the floor it falls back to its most confident fit, since the windows
+ * running into the floor bend away from the true order. */
+typedef struct OrderTracker
+{
+    double log_Dt[SWEEP_WINDOW], log_err[SWEEP_WINDOW];
+    size_t size;
+    double prev_err;
+    double order, std_err;
+    double best_order, best_std_err;
+    unsigned int stable, rising;
+    bool settled, floored;
+}OrderTracker;
+
+/* Errors of a whole numeric trajectory against the analytic one. l2 is
+ * the time integrated norm sqrt(sum err^2 Dt), max the peak and t_max the
+ * time it was reached. */
+typedef struct ErrorProfile
+{
+    double sum_sq_r, sum_sq_v;
+    double max_r, max_v, t_max_r, t_max_v;
+    double l2_r, l2_v;
+    size_t samples;
+}ErrorProfile;
+
+bool export_log_log_error (Method method, double T, uint64_t max_dev_factor,
+                           int num_of_errors, bool cached);
+bool get_error_profile (Method method, double T, uint64_t dev_factor,
+                        unsigned int decimation, FILE *f, ErrorProfile
+                        *profile);
+bool export_error_profile (Method method, double T, uint64_t dev_factor,
+                           unsigned int decimation);
+bool export_convergence_sweep (Method method, double T, uint64_t
+                               max_dev_factor, int num_of_errors);
+bool export_perturbed_convergence (Method method);
+TimeState *get_analytic_T (double T);
+double get_dist (Vec *first, Vec *sec);
 
 
 #endif
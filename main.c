@@ -1,5 +1,10 @@
 #include "log_log_errors.h"
-#include "wien_filter.h"
+#include "space_charge.h"
+#include "worker.h"
+#include "wien_shard.h"
+#include "wien_importance.h"
+#include "wien_boundary.h"
+#include "trajectory_analysis.h"
 
 typedef enum Action
 {
@@ -7,24 +12,132 @@ typedef enum Action
     TIMELINE,
     ERRORS,
     WIEN_TIMELINE,
-    WIEN_FILTER
+    WIEN_FILTER,
+    WIEN_BATCH,
+    FIELD_MAP,
+    SPACE_CHARGE,
+    DECOMPRESS,
+    WORKER,
+    ANALYZE,
+    MERGE
 }Action;
 
+typedef struct Options
+{
+    Precision precision;
+    bool validate;
+    bool three_d;
+    double e_tilt, b_tilt;
+    char *field_map_path;
+    size_t particles;
+    double beam_charge;
+    bool compressed;
+    bool cached;
+    bool adaptive;
+    double tol;
+    bool profile;
+    bool perturbed;
+    unsigned int every;
+    bool seeded;
+    uint64_t seed;
+    uint32_t shard, num_of_shards;
+    bool importance;
+    bool boundary;
+    double resolution;
+    size_t samples;
+    uint64_t steps;
+    bool chunked;
+    bool raw;
+    char *grid_path;
+    char *input_path, *csv_path;
+    char *socket_path;
+    unsigned int threads;
+    TopologyPolicy topology;
+    Species species[MAX_SPECIES];
+    unsigned int num_of_species;
+}Options;
+
 /**********************************/
 /*        STRING DEFINES          */
 /**********************************/
 
 #define ALLOC_ERR "Error: failed to allocate memory."
-#define ARGS_ERR "Usage: <timeline|errors|wien_timeline|wien_filter> "\
-"<analytic|euler|midpoint|runge_kutta>.\n"
-#define ANALYTIC_STR "analytic"
-#define EULER_STR "euler"
-#define MIDPOINT_STR "midpoint"
-#define RUNGE_KUTTA_STR "runge_kutta"
+#define WORKER_IO_ERR "Error: failed to read or write the job stream or to "\
+"listen on or accept from the worker socket."
+#define SHARD_ERR "Error: failed to read or merge the shards."
+#define ANALYSIS_ERR "Error: failed to map the trajectory, its times are not "\
+"ascending or a time is outside of them."
+#define GRID_ERR "Error: failed to read the time grid or it is not ascending."
+#define FIELD_MAP_ERR "Error: failed to load or write the field map."
+#define ARGS_ERR "Usage: <timeline|errors|wien_timeline|wien_filter|"\
+"wien_batch> <analytic|euler|midpoint|runge_kutta|heun|bogacki_shampine|"\
+"dormand_prince|etd_runge_kutta|guiding_centre> [compressed] [cache] "\
+"[samples=<n>] "\
+"[grid=<path>] [steps=<n>] [chunked] [raw] "\
+"[adaptive] [tol=<x>] [profile] [every=<n>] [perturbed] "\
+"[double|single|mixed] [validate] [3d] [e_tilt=<deg>] [b_tilt=<deg>] "\
+"[field_map=<path>] [particles=<n>] [seed=<n>] [shard=<i>/<n>] "\
+"[importance] [boundary] [resolution=<x>] "\
+"[species=<charge>:<mass>[:<share>]]...\n"\
+"       field_map <path>.\n"\
+"       space_charge <euler|midpoint|runge_kutta|heun|bogacki_shampine|"\
+"dormand_prince|etd_runge_kutta> [particles=<n>] [charge=<beam charge>].\n"\
+"       decompress <path> <csv path>.\n"\
+"       worker <stdin|socket=<path>> [threads=<n>].\n"\
+"       merge <shard path>...\n"\
+"       analyze <raw path> [at=<time>]...\n"\
+"       Any action also takes [numa=<none|compact|scatter>].\n"
 #define TIMELINE_STR "timeline"
 #define WIEN_TIMELINE_STR "wien_timeline"
 #define WIEN_FILTER_STR "wien_filter"
 #define ERRORS_STR "errors"
+#define WIEN_BATCH_STR "wien_batch"
+#define DOUBLE_STR "double"
+#define SINGLE_STR "single"
+#define MIXED_STR "mixed"
+#define VALIDATE_STR "validate"
+#define THREE_D_STR "3d"
+#define E_TILT_FORMAT "e_tilt=%lf"
+#define B_TILT_FORMAT "b_tilt=%lf"
+#define FIELD_MAP_STR "field_map"
+#define FIELD_MAP_PREFIX "field_map="
+#define SPACE_CHARGE_STR "space_charge"
+#define PARTICLES_FORMAT "particles=%zu"
+#define CHARGE_FORMAT "charge=%lf"
+#define COMPRESSED_STR "compressed"
+#define CACHE_STR "cache"
+#define ADAPTIVE_STR "adaptive"
+#define PROFILE_STR "profile"
+#define PERTURBED_STR "perturbed"
+#define EVERY_FORMAT "every=%u"
+#define SAMPLES_FORMAT "samples=%zu"
+#define STEPS_FORMAT "steps=%" SCNu64
+#define TOL_FORMAT "tol=%lf"
+#define CHUNKED_STR "chunked"
+#define RAW_STR "raw"
+#define ANALYZE_STR "analyze"
+#define AT_FORMAT "at=%lf"
+#define GRID_PREFIX "grid="
+#define DEFAULT_EVERY 10
+#define DEFAULT_TOL 1e-8
+#define DECOMPRESS_STR "decompress"
+#define WORKER_STR "worker"
+#define MERGE_STR "merge"
+#define SEED_FORMAT "seed=%" SCNu64
+#define SHARD_FORMAT "shard=%" SCNu32 "/%" SCNu32
+#define IMPORTANCE_STR "importance"
+#define BOUNDARY_STR "boundary"
+#define RESOLUTION_FORMAT "resolution=%lf"
+#define STDIN_STR "stdin"
+#define SOCKET_PREFIX "socket="
+#define THREADS_FORMAT "threads=%u"
+#define SPECIES_FORMAT "species=%lf:%lf:%lf"
+#define NUMA_PREFIX "numa="
+#define NONE_STR "none"
+#define COMPACT_STR "compact"
+#define SCATTER_STR "scatter"
+#define DEFAULT_PARTICLES 100000
+#define DEFAULT_BEAM_CHARGE 1e-3
 
 /******************************************/
 /*        FUNCTIONS DECLARATIONS          */
@@ -32,13 +145,30 @@ typedef enum Action
 
 double get_T ();
 int exit_err (char *msg);
-Action process_args(int argc, char **argv, Method* method);
+Action process_args(int argc, char **argv, Method* method, Options *options);
 bool check_argc(int argc);
-bool check_for_timeline (char **argv, Method *method);
-bool check_for_errors (char **argv, Method *method);
+bool check_for_timeline (int argc, char **argv, Method *method, Options
+*options);
+bool check_for_errors (int argc, char **argv, Method *method, Options
+*options);
 bool check_for_wien_timeline (char **argv, Method *method);
-bool check_for_wien_filter (char **argv, Method *method);
+bool check_for_wien_filter (int argc, char **argv, Method *method, Options
+*options);
+bool check_for_wien_batch (int argc, char **argv, Method *method, Options
+*options);
+bool check_for_field_map (char **argv, Options *options);
+bool check_for_decompress (int argc, char **argv, Options *options);
+bool check_for_worker (int argc, char **argv, Options *options);
+bool check_for_space_charge (int argc, char **argv, Method *method, Options
+*options);
+bool check_for_analyze (int argc, char **argv, Options *options);
+int run_wien_batch (Method method, double T, Options *options);
+int run_dense_timeline (Method method, double T, Options *options);
+int run_analysis (int argc, char **argv, Options *options);
+bool take_topology_arg (int *argc, char **argv, Options *options);
+bool convert_str_species (char *str_species, Options *options);
 Method convert_str_method(char *str_method);
+bool convert_str_precision (char *str_precision, Precision *precision);
 
 /************************/
 /*        MAIN          */
@@ -48,20 +178,73 @@ int main (int argc, char **argv)
 {
   double T = get_T ();
   Method method = 0;
-  Action action = process_args(argc, argv, &method);
+  Options options = {DOUBLE_PRECISION, false, false, 0, 0, NULL,
+                     DEFAULT_PARTICLES, DEFAULT_BEAM_CHARGE, false, false,
+                     false, DEFAULT_TOL, false, false, DEFAULT_EVERY, false, 0,
+                     0, 1, false, false, DEFAULT_RESOLUTION, 0,
+                     DIVISION_CONST, false, false, NULL, NULL, NULL, NULL, 0,
+                     TOPOLOGY_NONE, {{0}}, 0};
+  if (!take_topology_arg (&argc, argv, &options))
+  {
+    return exit_err (ARGS_ERR);
+  }
+  set_topology_policy (options.topology);
+  Action action = process_args(argc, argv, &method, &options);
   switch (action)
   {
     case FAILED:
       return exit_err (ARGS_ERR);
       break;
     case TIMELINE:
-      if (!export_one_timeline (method, T))
+      if (options.samples || options.grid_path)
+      {
+        return run_dense_timeline (method, T, &options);
+      }
+      if (options.raw)
+      {
+        if (!export_raw_timeline (method, T, options.steps))
+        {
+          return exit_err (ALLOC_ERR);
+        }
+        break;
+      }
+      if (options.chunked)
+      {
+        if (!export_chunked_timeline (method, T, options.steps))
+        {
+          return exit_err (ALLOC_ERR);
+        }
+        break;
+      }
+      if (!export_one_timeline (method, T, options.compressed,
+                                options.cached))
       {
         return exit_err (ALLOC_ERR);
       }
       break;
     case ERRORS:
-      if (!export_log_log_error (method, T, 1000, 100))
+      if (options.profile)
+      {
+        if (!export_error_profile (method, T, DIVISION_CONST, options.every))
+        {
+          return exit_err (ALLOC_ERR);
+        }
+      }
+      else if (options.perturbed)
+      {
+        if (!export_perturbed_convergence (method))
+        {
+          return exit_err (ALLOC_ERR);
+        }
+      }
+      else if (options.adaptive)
+      {
+        if (!export_convergence_sweep (method, T, 1000, 100))
+        {
+          return exit_err (ALLOC_ERR);
+        }
+      }
+      else if (!export_log_log_error (method, T, 1000, 100, options.cached))
       {
         return exit_err (ALLOC_ERR);
       }
@@ -77,11 +260,75 @@ int main (int argc, char **argv)
       break;
     }
       case WIEN_FILTER:
-        if (!export_wien_filter (method, T))
+        if (options.boundary)
+        {
+          if (!export_wien_boundary (method, T, options.resolution))
+          {
+            return exit_err (ALLOC_ERR);
+          }
+        }
+        else if (options.importance)
+        {
+          uint64_t seed = options.seeded ? options.seed
+                                         : (uint64_t) time (NULL);
+          if (!export_wien_importance (method, T, options.particles, seed))
+          {
+            return exit_err (ALLOC_ERR);
+          }
+        }
+        else if (options.seeded
+            ? !export_wien_shard (method, T, options.particles, options.seed,
+                                  options.shard, options.num_of_shards)
+            : !export_wien_filter (method, T, options.particles))
         {
           return exit_err (ALLOC_ERR);
         }
       break;
+    case WIEN_BATCH:
+      return run_wien_batch (method, T, &options);
+    case MERGE:
+      if (!merge_wien_shards (argv + 2, argc - 2))
+      {
+        return exit_err (SHARD_ERR);
+      }
+      break;
+    case FIELD_MAP:
+      if (!write_wien_field_map (options.field_map_path))
+      {
+        return exit_err (FIELD_MAP_ERR);
+      }
+      break;
+    case DECOMPRESS:
+      if (!decompress_trajectory (options.input_path, options.csv_path))
+      {
+        return exit_err (ALLOC_ERR);
+      }
+      break;
+    case WORKER:
+    {
+      WorkerStatus status = options.socket_path
+                            ? run_socket_worker (options.socket_path,
+                                                 options.threads)
+                            : run_worker (stdin, stdout, options.threads);
+      if (status == WORKER_ALLOC_FAILED)
+      {
+        return exit_err (ALLOC_ERR);
+      }
+      if (status == WORKER_IO_FAILED)
+      {
+        return exit_err (WORKER_IO_ERR);
+      }
+      break;
+    }
+    case ANALYZE:
+      return run_analysis (argc, argv, &options);
+    case SPACE_CHARGE:
+      if (!export_space_charge (method, T, options.particles,
+                                options.beam_charge))
+      {
+        return exit_err (ALLOC_ERR);
+      }
+      break;
   }
   return EXIT_SUCCESS;
 }
@@ -96,13 +343,83 @@ int exit_err (char *msg)
   return EXIT_FAILURE;
 }
 
+int run_wien_batch (Method method, double T, Options *options)
+{
+  Field3 field = get_tilted_field (options->e_tilt * M_PI / 180,
+                                   options->b_tilt * M_PI / 180);
+  FieldMap *field_map = NULL;
+  if (options->field_map_path)
+  {
+    field_map = load_field_map (options->field_map_path);
+    if (!field_map)
+    {
+      return exit_err (FIELD_MAP_ERR);
+    }
+    field.map = field_map;
+  }
+  bool ret = export_wien_batch (method, T, options->precision,
+                                options->validate,
+                                options->three_d ? &field : NULL,
+                                options->species, options->num_of_species);
+  free_field_map (&field_map);
+  if (!ret)
+  {
+    return exit_err (ALLOC_ERR);
+  }
+  return EXIT_SUCCESS;
+}
+
+int run_dense_timeline (Method method, double T, Options *options)
+{
+  size_t num_of_times = options->samples + 1;
+  double *times = options->grid_path
+                  ? read_time_grid (options->grid_path, &num_of_times)
+                  : get_uniform_grid (T, options->samples);
+  if (!times)
+  {
+    return exit_err (options->grid_path ? GRID_ERR : ALLOC_ERR);
+  }
+  bool ret = export_dense_timeline (method, T, options->steps,
+                                    options->adaptive ? options->tol : 0,
+                                    times, num_of_times);
+  free (times);
+  if (!ret)
+  {
+    return exit_err (options->grid_path ? GRID_ERR : ALLOC_ERR);
+  }
+  return EXIT_SUCCESS;
+}
+
+/* The at= times were validated by check_for_analyze. */
+int run_analysis (int argc, char **argv, Options *options)
+{
+  size_t num_of_times = argc - 3;
+  double *times = malloc ((num_of_times + 1) * sizeof (double));
+  if (!times)
+  {
+    return exit_err (ALLOC_ERR);
+  }
+  for (size_t i = 0; i < num_of_times; ++i)
+  {
+    sscanf (argv[i + 3], AT_FORMAT, &times[i]);
+  }
+  bool ret = export_trajectory_analysis (options->input_path, times,
+                                         num_of_times);
+  free (times);
+  if (!ret)
+  {
+    return exit_err (ANALYSIS_ERR);
+  }
+  return EXIT_SUCCESS;
+}
+
 double get_T ()
 {
   double w = (q * B) / m;
   return (2 * M_PI) / w;
 }
 
-Action process_args(int argc, char **argv, Method* method)
+Action process_args(int argc, char **argv, Method* method, Options *options)
 {
 
   if (!check_argc (argc))
@@ -110,12 +427,12 @@ Action process_args(int argc, char **argv, Method* method)
     return FAILED;
   }
 
-  if (check_for_timeline (argv, method))
+  if (check_for_timeline (argc, argv, method, options))
   {
     return TIMELINE;
   }
 
-  if (check_for_errors (argv, method))
+  if (check_for_errors (argc, argv, method, options))
   {
     return ERRORS;
   }
@@ -125,11 +442,46 @@ Action process_args(int argc, char **argv, Method* method)
     return WIEN_TIMELINE;
   }
 
-  if (check_for_wien_filter (argv, method))
+  if (check_for_wien_filter (argc, argv, method, options))
   {
       return WIEN_FILTER;
   }
 
+  if (check_for_wien_batch (argc, argv, method, options))
+  {
+    return WIEN_BATCH;
+  }
+
+  if (check_for_field_map (argv, options))
+  {
+    return FIELD_MAP;
+  }
+
+  if (check_for_space_charge (argc, argv, method, options))
+  {
+    return SPACE_CHARGE;
+  }
+
+  if (check_for_decompress (argc, argv, options))
+  {
+    return DECOMPRESS;
+  }
+
+  if (check_for_worker (argc, argv, options))
+  {
+    return WORKER;
+  }
+
+  if (check_for_analyze (argc, argv, options))
+  {
+    return ANALYZE;
+  }
+
+  if (!strcmp (argv[1], MERGE_STR))
+  {
+    return MERGE;
+  }
+
   return FAILED;
 }
 
@@ -139,10 +491,11 @@ Action process_args(int argc, char **argv, Method* method)
 
 bool check_argc(int argc)
 {
-  return argc == 3 || argc == 5;
+  return argc >= 3;
 }
 
-bool check_for_timeline (char **argv, Method *method)
+bool check_for_timeline (int argc, char **argv, Method *method, Options
+*options)
 {
   if (strcmp (argv[1], TIMELINE_STR) != 0)
   {
@@ -155,10 +508,57 @@ bool check_for_timeline (char **argv, Method *method)
     return false;
   }
 
-  return true;
+  bool tol = false;
+  for (int i = 3; i < argc; ++i)
+  {
+    if (!strcmp (argv[i], COMPRESSED_STR))
+    {
+      options->compressed = true;
+    }
+    else if (!strcmp (argv[i], ADAPTIVE_STR))
+    {
+      options->adaptive = true;
+    }
+    else if (sscanf (argv[i], TOL_FORMAT, &options->tol) == 1)
+    {
+      tol = true;
+    }
+    else if (!strcmp (argv[i], CACHE_STR))
+    {
+      options->cached = true;
+    }
+    else if (!strcmp (argv[i], CHUNKED_STR))
+    {
+      options->chunked = true;
+    }
+    else if (!strcmp (argv[i], RAW_STR))
+    {
+      options->raw = true;
+    }
+    else if (!strncmp (argv[i], GRID_PREFIX, strlen (GRID_PREFIX)))
+    {
+      options->grid_path = argv[i] + strlen (GRID_PREFIX);
+    }
+    else if (sscanf (argv[i], SAMPLES_FORMAT, &options->samples) != 1
+             && sscanf (argv[i], STEPS_FORMAT, &options->steps) != 1)
+    {
+      return false;
+    }
+  }
+  bool dense = options->samples || options->grid_path;
+  bool stepped = dense || options->chunked || options->raw;
+  /* Step size control needs an error estimate and dense output to sample
+   * the uneven steps at the requested times. */
+  return options->steps > 0
+         && (stepped || options->steps == DIVISION_CONST)
+         && dense + options->chunked + options->raw <= 1
+         && !(stepped && (options->compressed || options->cached))
+         && (!options->adaptive || (dense && is_embedded_method (*method)))
+         && (!tol || (options->adaptive && options->tol > 0));
 }
 
-bool check_for_errors (char **argv, Method *method)
+bool check_for_errors (int argc, char **argv, Method *method, Options
+*options)
 {
   if (strcmp (argv[1], ERRORS_STR) != 0)
   {
@@ -170,7 +570,42 @@ bool check_for_errors (char **argv, Method *method)
   {
     return false;
   }
-  return true;
+
+  bool every = false;
+  for (int i = 3; i < argc; ++i)
+  {
+    if (!strcmp (argv[i], CACHE_STR))
+    {
+      options->cached = true;
+    }
+    else if (!strcmp (argv[i], ADAPTIVE_STR))
+    {
+      options->adaptive = true;
+    }
+    else if (!strcmp (argv[i], PROFILE_STR))
+    {
+      options->profile = true;
+    }
+    else if (!strcmp (argv[i], PERTURBED_STR))
+    {
+      options->perturbed = true;
+    }
+    else if (sscanf (argv[i], EVERY_FORMAT, &options->every) == 1)
+    {
+      every = true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  /* every= only decimates the profile, and only the exponential
+   * integrator takes a perturbation. */
+  return ((!options->adaptive && !options->profile) || *method != ANALYTIC)
+         && (!every || options->profile)
+         && (!options->perturbed
+             || (*method == ETD_RUNGE_KUTTA && !options->adaptive
+                 && !options->profile && !options->cached));
 }
 
 bool check_for_wien_timeline (char **argv, Method *method)
@@ -188,7 +623,8 @@ bool check_for_wien_timeline (char **argv, Method *method)
   return true;
 }
 
-bool check_for_wien_filter (char **argv, Method *method)
+bool check_for_wien_filter (int argc, char **argv, Method *method, Options
+*options)
 {
   if (strcmp (argv[1], WIEN_FILTER_STR) != 0)
   {
@@ -200,29 +636,241 @@ bool check_for_wien_filter (char **argv, Method *method)
   {
     return false;
   }
+
+  options->particles = WIEN_FILTER_PARTICLES;
+  for (int i = 3; i < argc; ++i)
+  {
+    if (sscanf (argv[i], SEED_FORMAT, &options->seed) == 1
+        || sscanf (argv[i], SHARD_FORMAT, &options->shard,
+                   &options->num_of_shards) == 2)
+    {
+      options->seeded = true;
+    }
+    else if (!strcmp (argv[i], IMPORTANCE_STR))
+    {
+      options->importance = true;
+    }
+    else if (!strcmp (argv[i], BOUNDARY_STR))
+    {
+      options->boundary = true;
+    }
+    else if (sscanf (argv[i], PARTICLES_FORMAT, &options->particles) != 1
+             && sscanf (argv[i], RESOLUTION_FORMAT,
+                        &options->resolution) != 1)
+    {
+      return false;
+    }
+  }
+  return options->num_of_shards && options->shard < options->num_of_shards
+         && options->particles > 0
+         && !(options->importance && options->num_of_shards > 1)
+         && !(options->boundary
+              && (options->importance || options->seeded));
+}
+
+bool check_for_wien_batch (int argc, char **argv, Method *method, Options
+*options)
+{
+  if (strcmp (argv[1], WIEN_BATCH_STR) != 0)
+  {
+    return false;
+  }
+
+  *method = convert_str_method (argv[2]);
+  if (!is_batch_method (*method))
+  {
+    return false;
+  }
+
+  for (int i = 3; i < argc; ++i)
+  {
+    if (!strcmp (argv[i], VALIDATE_STR))
+    {
+      options->validate = true;
+    }
+    else if (!strcmp (argv[i], THREE_D_STR))
+    {
+      options->three_d = true;
+    }
+    else if (sscanf (argv[i], E_TILT_FORMAT, &options->e_tilt) == 1
+             || sscanf (argv[i], B_TILT_FORMAT, &options->b_tilt) == 1)
+    {
+      options->three_d = true;
+    }
+    else if (!strncmp (argv[i], FIELD_MAP_PREFIX, strlen (FIELD_MAP_PREFIX)))
+    {
+      options->field_map_path = argv[i] + strlen (FIELD_MAP_PREFIX);
+      options->three_d = true;
+    }
+    else if (!convert_str_species (argv[i], options)
+             && !convert_str_precision (argv[i], &options->precision))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool check_for_field_map (char **argv, Options *options)
+{
+  if (strcmp (argv[1], FIELD_MAP_STR) != 0)
+  {
+    return false;
+  }
+
+  options->field_map_path = argv[2];
+  return true;
+}
+
+bool check_for_space_charge (int argc, char **argv, Method *method, Options
+*options)
+{
+  if (strcmp (argv[1], SPACE_CHARGE_STR) != 0)
+  {
+    return false;
+  }
+
+  *method = convert_str_method (argv[2]);
+  if (!is_rk_method (*method) && *method != ETD_RUNGE_KUTTA)
+  {
+    return false;
+  }
+
+  for (int i = 3; i < argc; ++i)
+  {
+    if (sscanf (argv[i], PARTICLES_FORMAT, &options->particles) != 1
+        && sscanf (argv[i], CHARGE_FORMAT, &options->beam_charge) != 1)
+    {
+      return false;
+    }
+  }
+  return options->particles > 0;
+}
+
+bool check_for_decompress (int argc, char **argv, Options *options)
+{
+  if (strcmp (argv[1], DECOMPRESS_STR) != 0 || argc != 4)
+  {
+    return false;
+  }
+
+  options->input_path = argv[2];
+  options->csv_path = argv[3];
+  return true;
+}
+
+bool check_for_worker (int argc, char **argv, Options *options)
+{
+  if (strcmp (argv[1], WORKER_STR) != 0)
+  {
+    return false;
+  }
+
+  if (!strncmp (argv[2], SOCKET_PREFIX, strlen (SOCKET_PREFIX)))
+  {
+    options->socket_path = argv[2] + strlen (SOCKET_PREFIX);
+  }
+  else if (strcmp (argv[2], STDIN_STR) != 0)
+  {
+    return false;
+  }
+
+  options->threads = get_num_threads ();
+  for (int i = 3; i < argc; ++i)
+  {
+    if (sscanf (argv[i], THREADS_FORMAT, &options->threads) != 1)
+    {
+      return false;
+    }
+  }
+  return options->threads > 0 && *argv[2] != '\0';
+}
+
+/* numa=<policy> is accepted anywhere after the action and taken out of
+ * argv, so the per action parsers never see it. */
+bool take_topology_arg (int *argc, char **argv, Options *options)
+{
+  int kept = 1;
+  for (int i = 1; i < *argc; ++i)
+  {
+    if (strncmp (argv[i], NUMA_PREFIX, strlen (NUMA_PREFIX)))
+    {
+      argv[kept++] = argv[i];
+      continue;
+    }
+    char *policy = argv[i] + strlen (NUMA_PREFIX);
+    if (!strcmp (policy, NONE_STR))
+    { options->topology = TOPOLOGY_NONE; }
+    else if (!strcmp (policy, COMPACT_STR))
+    { options->topology = TOPOLOGY_COMPACT; }
+    else if (!strcmp (policy, SCATTER_STR))
+    { options->topology = TOPOLOGY_SCATTER; }
+    else
+    { return false; }
+  }
+  *argc = kept;
+  argv[kept] = NULL;
+  return true;
+}
+
+bool check_for_analyze (int argc, char **argv, Options *options)
+{
+  if (strcmp (argv[1], ANALYZE_STR) != 0)
+  {
+    return false;
+  }
+
+  double t;
+  for (int i = 3; i < argc; ++i)
+  {
+    if (sscanf (argv[i], AT_FORMAT, &t) != 1)
+    {
+      return false;
+    }
+  }
+  options->input_path = argv[2];
   return true;
 }
 
 Method convert_str_method(char *str_method)
 {
-  if (!strcmp (str_method, ANALYTIC_STR))
+  return get_method_by_name (str_method);
+}
+
+bool convert_str_precision (char *str_precision, Precision *precision)
+{
+  if (!strcmp (str_precision, DOUBLE_STR))
   {
-    return ANALYTIC;
+    *precision = DOUBLE_PRECISION;
+    return true;
   }
 
-  if (!strcmp (str_method, EULER_STR))
+  if (!strcmp (str_precision, SINGLE_STR))
   {
-    return EULER;
+    *precision = SINGLE_PRECISION;
+    return true;
   }
 
-  if (!strcmp (str_method, MIDPOINT_STR))
+  if (!strcmp (str_precision, MIXED_STR))
   {
-    return MIDPOINT;
+    *precision = MIXED_PRECISION;
+    return true;
   }
+  return false;
+}
 
-  if (!strcmp (str_method, RUNGE_KUTTA_STR))
+/* species=<charge>:<mass>[:<share>], the share 1 when left out. */
+bool convert_str_species (char *str_species, Options *options)
+{
+  Species species = {0, 0, 1};
+  int read = sscanf (str_species, SPECIES_FORMAT, &species.charge,
+                     &species.mass, &species.share);
+  if (read < 2 || options->num_of_species >= MAX_SPECIES
+      || species.charge == 0 || !(species.mass > 0)
+      || !(species.share > 0))
   {
-    return RUNGE_KUTTA;
+    return false;
   }
-  return NON_METHOD;
+  options->species[options->num_of_species++] = species;
+  return true;
 }
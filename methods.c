@@ -1,31 +1,134 @@
 #include "methods.h"
+#include "guiding_centre.h"
 #include <math.h>
 
+/**************************************/
+/*        BUTCHER TABLEAUS            */
+/**************************************/
+
+const Tableau EULER_TABLEAU = {
+    1, 1, false, false,
+    {0},
+    {{0}},
+    {1},
+    {0}
+};
+
+const Tableau MIDPOINT_TABLEAU = {
+    2, 2, false, false,
+    {0, 1. / 2},
+    {{0}, {1. / 2}},
+    {0, 1},
+    {0}
+};
+
+const Tableau RUNGE_KUTTA_TABLEAU = {
+    4, 4, false, false,
+    {0, 1. / 2, 1. / 2, 1},
+    {{0}, {1. / 2}, {0, 1. / 2}, {0, 0, 1}},
+    {1. / 6, 1. / 3, 1. / 3, 1. / 6},
+    {0}
+};
+
+/* Heun's method with Euler embedded, order 2(1). */
+const Tableau HEUN_TABLEAU = {
+    2, 2, true, false,
+    {0, 1},
+    {{0}, {1}},
+    {1. / 2, 1. / 2},
+    {1, 0}
+};
+
+/* Bogacki-Shampine 3(2), FSAL, with its cubic continuous extension. */
+const Tableau BOGACKI_SHAMPINE_TABLEAU = {
+    4, 3, true, true,
+    {0, 1. / 2, 3. / 4, 1},
+    {{0}, {1. / 2}, {0, 3. / 4}, {2. / 9, 1. / 3, 4. / 9}},
+    {2. / 9, 1. / 3, 4. / 9, 0},
+    {7. / 24, 1. / 4, 1. / 3, 1. / 8},
+    3,
+    {{1, -4. / 3, 5. / 9},
+     {0, 1, -2. / 3},
+     {0, 4. / 3, -8. / 9},
+     {0, -1, 1}}
+};
+
+/* Dormand-Prince 5(4), FSAL, with Shampine's fourth order continuous
+ * extension. */
+const Tableau DORMAND_PRINCE_TABLEAU = {
+    7, 5, true, true,
+    {0, 1. / 5, 3. / 10, 4. / 5, 8. / 9, 1, 1},
+    {{0},
+     {1. / 5},
+     {3. / 40, 9. / 40},
+     {44. / 45, -56. / 15, 32. / 9},
+     {19372. / 6561, -25360. / 2187, 64448. / 6561, -212. / 729},
+     {9017. / 3168, -355. / 33, 46732. / 5247, 49. / 176, -5103. / 18656},
+     {35. / 384, 0, 500. / 1113, 125. / 192, -2187. / 6784, 11. / 84}},
+    {35. / 384, 0, 500. / 1113, 125. / 192, -2187. / 6784, 11. / 84, 0},
+    {5179. / 57600, 0, 7571. / 16695, 393. / 640, -92097. / 339200,
+     187. / 2100, 1. / 40},
+    4,
+    {{1, -8048581381. / 2820520608, 8663915743. / 2820520608,
+      -12715105075. / 11282082432},
+     {0},
+     {0, 131558114200. / 32700410799, -68118460800. / 10900136933,
+      87487479700. / 32700410799},
+     {0, -1754552775. / 470086768, 14199869525. / 1410260304,
+      -10690763975. / 1880347072},
+     {0, 127303824393. / 49829197408, -318862633887. / 49829197408,
+      701980252875. / 199316789632},
+     {0, -282668133. / 205662961, 2019193451. / 616988883,
+      -1453857185. / 822651844},
+     {0, 40617522. / 29380423, -110615467. / 29380423,
+      69997945. / 29380423}}
+};
+
+const RkPhysics DEFAULT_PHYSICS = {q / m, E, B, 0};
+const EtdPhysics DEFAULT_ETD_PHYSICS = {{q / m, E, B, 0}, NULL, NULL};
+
+/**********************************/
+/*        METHOD TABLE            */
+/**********************************/
+
+/* One row per scheme, indexed by Method: its name on the command line and
+ * in output files, its step, its tableau if it is a Runge-Kutta scheme,
+ * and whether batch_kernels.h has SoA kernels for it. A new scheme is a
+ * new row here; the lookups and output paths below read only this. */
+typedef struct MethodInfo
+{
+    char *name;
+    NEXT_STEP_METHOD *next_step;
+    const Tableau *tableau;
+    bool batched;
+}MethodInfo;
+
+static const MethodInfo METHOD_TABLE[] = {
+    [ANALYTIC] = {"analytic", analytic_method, NULL, false},
+    [EULER] = {"euler", euler_method, &EULER_TABLEAU, true},
+    [MIDPOINT] = {"midpoint", midpoint_method, &MIDPOINT_TABLEAU, true},
+    [RUNGE_KUTTA] = {"runge_kutta", runge_kutta_method, &RUNGE_KUTTA_TABLEAU,
+                     true},
+    [HEUN] = {"heun", heun_method, &HEUN_TABLEAU, false},
+    [BOGACKI_SHAMPINE] = {"bogacki_shampine", bogacki_shampine_method,
+                          &BOGACKI_SHAMPINE_TABLEAU, false},
+    [DORMAND_PRINCE] = {"dormand_prince", dormand_prince_method,
+                        &DORMAND_PRINCE_TABLEAU, false},
+    [ETD_RUNGE_KUTTA] = {"etd_runge_kutta", etd_runge_kutta_method, NULL,
+                         false},
+    [GUIDING_CENTRE] = {"guiding_centre", guiding_centre_method, NULL, false}
+};
+
+#define NUM_OF_METHODS (sizeof (METHOD_TABLE) / sizeof (*METHOD_TABLE))
+
 /******************************************/
 /*        FUNCTIONS DECLARATIONS          */
 /******************************************/
 
-void free_and_NULLify(Vec **vec);
 Vec *get_analytic_r (double t);
 Vec *get_analytic_v (double t);
 Vec *get_analytic_a (Vec *v);
-Vec *euler_method_helper (Vec *val, Vec *der, double Dt);
-Vec *get_a (Vec *v);
-Vec *get_k_1_v (Vec *_v, double Dt);
-Vec *get_k_2_v (Vec *_v, Vec *k_1, double Dt);
-Vec *get_k_1_r (Vec *_v, double Dt);
-Vec *get_k_2_r (Vec *_v, Vec *k_1, double Dt);
-Vec *get_midpoint_vec (Vec *vec, Vec *k_2);
-void free_midpoint (Vec **a, Vec **v, Vec **r, Vec **k_1_v, Vec **k_2_v, Vec
-**k_1_r, Vec **k_2_r);
-Vec *get_k_3_v (Vec *_v, Vec *k_2, double Dt);
-Vec *get_k_4_v (Vec *_v, Vec *k_3, double Dt);
-Vec *get_k_3_r (Vec *_v, Vec *k_2, double Dt);
-Vec *get_k_4_r (Vec *_v, Vec *k_3, double Dt);
-Vec *get_runge_kutta_vec (Vec *vec, Vec *k_1, Vec *k_2, Vec *k_3, Vec *k_4);
-void free_runge_kutta (Vec **a, Vec **v, Vec **r, Vec **k_1_v, Vec **k_2_v,
-                       Vec **k_3_v, Vec **k_4_v, Vec **k_1_r, Vec **k_2_r,
-                       Vec **k_3_r, Vec **k_4_r);
+const MethodInfo *get_method_info (Method method);
 
 /***********************************************/
 /*        H FUNCTIONS IMPLEMENTATIONS          */
@@ -52,291 +155,203 @@ TimeState *analytic_method(TimeState *curr_time_state, double Dt)
   return next_time_state;
 }
 
-TimeState *euler_method (TimeState *curr_time_state, double Dt)
+/* Every numeric method is rk_step on its tableau. The wrappers pass the
+ * tableau as a constant so each one gets its own unrolled copy of the
+ * step; the only allocation left is the TimeState handed back. */
+static inline TimeState *tableau_method (const Tableau *tableau, TimeState
+*curr_time_state, double Dt)
 {
-  Vec *_r = curr_time_state->r;
-  Vec *_v = curr_time_state->v;
-  Vec *_a = curr_time_state->a;
-
-  Vec *a = get_a (_v);
-  Vec *v = euler_method_helper (_v, _a, Dt);
-  Vec *r = euler_method_helper (_r, _v, Dt);
+  RkState in = {curr_time_state->time, *curr_time_state->r,
+                *curr_time_state->v, *curr_time_state->a};
+  RkState out;
+  rk_step (tableau, &DEFAULT_PHYSICS, &in, Dt, &out, NULL, NULL, NULL);
+  return alloc_rk_time_state (&out);
+}
 
-  TimeState *next_time_state = alloc_time_state (curr_time_state->time + Dt,
-                                                 r, v, a);
-  if (!next_time_state || !a || !v || !r)
-  {
-    free (a);
-    free (v);
-    free (r);
-    free (next_time_state);
-    return NULL;
-  }
-  return next_time_state;
+TimeState *euler_method (TimeState *curr_time_state, double Dt)
+{
+  return tableau_method (&EULER_TABLEAU, curr_time_state, Dt);
 }
 
 TimeState *midpoint_method (TimeState *curr_time_state, double Dt)
 {
-  double _time = curr_time_state->time;
-  Vec *_v = curr_time_state->v;
-  Vec *_r = curr_time_state->r;
-
-  Vec *a = get_a (_v);
-
-  Vec *k_1_v = get_k_1_v (_v, Dt);
-  Vec *k_2_v = get_k_2_v (_v, k_1_v, Dt);
-  Vec *v = get_midpoint_vec (_v, k_2_v);
-
-  Vec *k_1_r = get_k_1_r (_v, Dt);
-  Vec *k_2_r = get_k_2_r (_v, k_1_v, Dt);
-  Vec *r = get_midpoint_vec (_r, k_2_r);
-
-  if (!r || !v || !a)
-  {
-    free_midpoint (&a, &v, &r, &k_1_v, &k_2_v, &k_1_r, &k_2_r);
-    return NULL;
-  }
-  TimeState *next_time_state = alloc_time_state (_time + Dt, r, v, a);
-  free_midpoint (NULL, NULL, NULL, &k_1_v, &k_2_v, &k_1_r, &k_2_r);
-  return next_time_state;
+  return tableau_method (&MIDPOINT_TABLEAU, curr_time_state, Dt);
 }
 
 TimeState *runge_kutta_method (TimeState *curr_time_state, double Dt)
 {
-  double _time = curr_time_state->time;
-  Vec *_r = curr_time_state->r;
-  Vec *_v = curr_time_state->v;
-
-  Vec *a = get_a (_v);
-
-  Vec *k_1_v = get_k_1_v (_v, Dt);
-  Vec *k_2_v = get_k_2_v (_v, k_1_v, Dt);
-  Vec *k_3_v = get_k_3_v (_v, k_2_v, Dt);
-  Vec *k_4_v = get_k_4_v (_v, k_3_v, Dt);
-  Vec *v = get_runge_kutta_vec (_v, k_1_v, k_2_v, k_3_v, k_4_v);
-
-  Vec *k_1_r = get_k_1_r(_v, Dt);
-  Vec *k_2_r = get_k_2_r (_v, k_1_v, Dt);
-  Vec *k_3_r = get_k_3_r (_v, k_2_v, Dt);
-  Vec *k_4_r = get_k_4_r (_v, k_3_v, Dt);
-  Vec *r = get_runge_kutta_vec (_r, k_1_r, k_2_r,k_3_r, k_4_r);
-
-  if (!a || !v || !r)
-  {
-    free_runge_kutta (&a, &v, &r, &k_1_v, &k_2_v, &k_3_v, &k_4_v, &k_1_r,
-                      &k_2_r, &k_3_r, &k_4_r);
-    return NULL;
-  }
-  TimeState *next_time_state = alloc_time_state (_time + Dt, r, v, a);
-  free_runge_kutta (NULL, NULL, NULL, &k_1_v, &k_2_v, &k_3_v, &k_4_v, &k_1_r,
-                    &k_2_r, &k_3_r, &k_4_r);
-  return next_time_state;
+  return tableau_method (&RUNGE_KUTTA_TABLEAU, curr_time_state, Dt);
 }
 
-NEXT_STEP_METHOD *get_method (Method method)
+TimeState *heun_method (TimeState *curr_time_state, double Dt)
 {
-  switch (method)
-  {
-    case ANALYTIC:
-      return analytic_method;
-
-    case EULER:
-      return euler_method;
-
-    case MIDPOINT:
-      return midpoint_method;
-
-    case RUNGE_KUTTA:
-      return runge_kutta_method;
-  }
-  return NULL;
+  return tableau_method (&HEUN_TABLEAU, curr_time_state, Dt);
 }
 
-/***********************************/
-/*        GENERAL HELPERS          */
-/***********************************/
-
-void free_and_NULLify(Vec **vec)
+TimeState *bogacki_shampine_method (TimeState *curr_time_state, double Dt)
 {
-  if (!vec)
-  {
-    return;
-  }
-  free (*vec);
-  *vec = NULL;
+  return tableau_method (&BOGACKI_SHAMPINE_TABLEAU, curr_time_state, Dt);
 }
 
-Vec *get_a (Vec *v)
+TimeState *dormand_prince_method (TimeState *curr_time_state, double Dt)
 {
-  if (!v)
-  { return NULL; }
-  return alloc_vec ((q / m) * (E - B * v->_z), (q / m) * (B * v->_y));
+  return tableau_method (&DORMAND_PRINCE_TABLEAU, curr_time_state, Dt);
 }
 
-/************************************/
-/*        ANALYTIC HELPERS          */
-/************************************/
-
-Vec *get_analytic_r (double t)
+/* Not a tableau scheme: the rotation is taken exactly, so Dt is free of
+ * the cyclotron period. */
+TimeState *etd_runge_kutta_method (TimeState *curr_time_state, double Dt)
 {
-  double w = (q/m) * B;
-  double y = (E / B) * ((2 / w) * cos (w * t) - ((2 * m) / (q * E)));
-  double z = (E / B) * ((2 / w) * sin (w * t) + t);
-  return alloc_vec (y, z);
+  RkState in = {curr_time_state->time, *curr_time_state->r,
+                *curr_time_state->v, *curr_time_state->a};
+  RkState out;
+  etd_step (&DEFAULT_ETD_PHYSICS, &in, Dt, &out);
+  return alloc_rk_time_state (&out);
 }
 
-Vec *get_analytic_v (double t)
+/* One guiding centre step, handed back as the full orbit at its end. */
+TimeState *guiding_centre_method (TimeState *curr_time_state, double Dt)
 {
-  double w = (q/m) * B;
-  double y = (E / B) * (-2 * sin (w * t));
-  double z = (E / B) * (2 * cos (w * t) + 1);
-  return alloc_vec (y, z);
+  RkState in = {curr_time_state->time, *curr_time_state->r,
+                *curr_time_state->v, *curr_time_state->a};
+  RkState out;
+  gc_orbit_step (&DEFAULT_ETD_PHYSICS, &in, Dt, &out);
+  return alloc_rk_time_state (&out);
 }
 
-Vec *get_analytic_a (Vec *v)
+NEXT_STEP_METHOD *get_method (Method method)
 {
-  double y = (q / m) * (E - B * v->_z);
-  double z = (q / m) * (B * v->_y);
-  return alloc_vec (y, z);
+  const MethodInfo *info = get_method_info (method);
+  return info ? info->next_step : NULL;
 }
 
-/*********************************/
-/*        EULER HELPERS          */
-/*********************************/
-
-Vec *euler_method_helper (Vec *val, Vec *der, double Dt)
+const Tableau *get_tableau (Method method)
 {
-  double y = val->_y + der->_y * Dt;
-  double z = val->_z + der->_z * Dt;
-  return alloc_vec (y, z);
+  const MethodInfo *info = get_method_info (method);
+  return info ? info->tableau : NULL;
 }
 
-/************************************/
-/*        MIDPOINT HELPERS          */
-/************************************/
+Method get_method_by_name (const char *name)
+{
+  for (size_t i = 0; i < NUM_OF_METHODS; ++i)
+  {
+    if (METHOD_TABLE[i].name && !strcmp (METHOD_TABLE[i].name, name))
+    { return (Method) i; }
+  }
+  return NON_METHOD;
+}
 
-Vec *get_k_1_v (Vec *_v, double Dt)
+char *get_method_name (Method method)
 {
-  if (!_v)
-  { return NULL; }
-  Vec *k_1 = get_a (_v);
-  mult_vec_scalar (k_1, Dt);
-  return k_1;
+  const MethodInfo *info = get_method_info (method);
+  return info ? info->name : NULL;
 }
 
-Vec *get_k_2_v (Vec *_v, Vec *k_1, double Dt)
+/* format holds one %s for the method's name. */
+char *get_method_path (Method method, const char *format)
 {
-  if (!_v || !k_1)
+  char *name = get_method_name (method);
+  if (!name)
   { return NULL; }
-  Vec *tmp = alloc_vec (k_1->_y, k_1->_z);
-  mult_vec_scalar (tmp, 0.5);
-  add_to_vec_vec (tmp, _v);
-  Vec *k_2 = get_a (tmp);
-  if (!k_2)
-  { return NULL; }
-  mult_vec_scalar (k_2, Dt);
-  free (tmp);
-  return k_2;
+  int length = snprintf (NULL, 0, format, name);
+  char *path = length > 0 ? malloc (length + 1) : NULL;
+  if (path)
+  { snprintf (path, length + 1, format, name); }
+  return path;
 }
 
-Vec *get_k_1_r (Vec *_v, double Dt)
+bool is_rk_method (Method method)
 {
-  if (!_v)
-  { return NULL; }
-  double r_y = _v->_y * Dt;
-  double r_z = _v->_z * Dt;
-  return alloc_vec (r_y, r_z);
+  return get_tableau (method) != NULL;
 }
 
-Vec *get_k_2_r (Vec *_v, Vec *k_1, double Dt)
+/* Runge-Kutta schemes whose tableau carries an error estimate. */
+bool is_embedded_method (Method method)
 {
-  if (!_v || !k_1)
-  { return NULL; }
-  double r_y = (_v->_y + (k_1->_y * 0.5)) * Dt;
-  double r_z = (_v->_z + (k_1->_z * 0.5)) * Dt;
-  return alloc_vec (r_y, r_z);
+  const Tableau *tableau = get_tableau (method);
+  return tableau && tableau->embedded;
 }
 
-Vec *get_midpoint_vec (Vec *vec, Vec *k_2)
+bool is_batch_method (Method method)
 {
-  if (!vec || !k_2)
-  { return NULL; }
-  double y = vec->_y + k_2->_y;
-  double z = vec->_z + k_2->_z;
-  return alloc_vec (y, z);
+  const MethodInfo *info = get_method_info (method);
+  return info && info->batched;
 }
 
-void free_midpoint (Vec **a, Vec **v, Vec **r, Vec **k_1_v, Vec **k_2_v, Vec
-**k_1_r, Vec **k_2_r)
+/***********************************/
+/*        GENERAL HELPERS          */
+/***********************************/
+
+TimeState *alloc_rk_time_state (const RkState *state)
 {
-  free_and_NULLify (a);
-  free_and_NULLify (v);
-  free_and_NULLify (r);
-  free_and_NULLify (k_1_v);
-  free_and_NULLify (k_2_v);
-  free_and_NULLify (k_1_r);
-  free_and_NULLify (k_2_r);
+  Vec *r = alloc_vec (state->r._y, state->r._z);
+  Vec *v = alloc_vec (state->v._y, state->v._z);
+  Vec *a = alloc_vec (state->a._y, state->a._z);
+  TimeState *time_state = (r && v && a)
+                          ? alloc_time_state (state->time, r, v, a) : NULL;
+  if (!time_state)
+  {
+    free (r);
+    free (v);
+    free (a);
+  }
+  return time_state;
 }
 
-/***************************************/
-/*        RUNGE KUTTA HELPERS          */
-/***************************************/
+/************************************/
+/*        ANALYTIC HELPERS          */
+/************************************/
 
-Vec *get_k_3_v (Vec *_v, Vec *k_2, double Dt)
+/* The analytic solution at t without allocating, for consumers that
+ * evaluate it alongside every numeric step. */
+void fill_analytic_state (double t, Vec *r, Vec *v)
 {
-  return get_k_2_v (_v, k_2, Dt);
+  double w = (q/m) * B;
+  r->_y = (E / B) * (2 / w) * (cos (w * t) - 1);
+  r->_z = (E / B) * ((2 / w) * sin (w * t) + t);
+  v->_y = (E / B) * (-2 * sin (w * t));
+  v->_z = (E / B) * (2 * cos (w * t) + 1);
 }
 
-Vec *get_k_4_v (Vec *_v, Vec *k_3, double Dt)
+/* The same solution from any start r_0, v_0 at t = 0. v rotates at omega
+ * about the drift (-e_z, e) / b, and r follows from integrating that. */
+void fill_analytic_state_from (const RkPhysics *physics, const Vec *r_0,
+                               const Vec *v_0, double t, Vec *r, Vec *v)
 {
-  Vec *tmp = alloc_vec (k_3->_y, k_3->_z);
-  add_to_vec_vec (tmp, _v);
-  Vec *k_4 = get_a (tmp);
-  if (!k_4)
-  { return NULL; }
-  mult_vec_scalar (k_4, Dt);
-  free (tmp);
-  return k_4;
+  double w = physics->qm * physics->b;
+  Vec drift = {-physics->e_z / physics->b, physics->e / physics->b};
+  Vec u = {v_0->_y - drift._y, v_0->_z - drift._z};
+  double s = sin (w * t), c = cos (w * t);
+  v->_y = drift._y + u._y * c - u._z * s;
+  v->_z = drift._z + u._y * s + u._z * c;
+  r->_y = r_0->_y + drift._y * t + (u._y * s - u._z * (1 - c)) / w;
+  r->_z = r_0->_z + drift._z * t + (u._y * (1 - c) + u._z * s) / w;
 }
 
-Vec *get_k_3_r (Vec *_v, Vec *k_2, double Dt)
+Vec *get_analytic_r (double t)
 {
-  return get_k_2_r (_v, k_2, Dt);
+  Vec r, v;
+  fill_analytic_state (t, &r, &v);
+  return alloc_vec (r._y, r._z);
 }
 
-Vec *get_k_4_r (Vec *_v, Vec *k_3, double Dt)
+Vec *get_analytic_v (double t)
 {
-  if (!_v || !k_3)
-  { return NULL; }
-  double r_y = (_v->_y + k_3->_y) * Dt;
-  double r_z = (_v->_z + k_3->_z) * Dt;
-  return alloc_vec (r_y, r_z);
+  Vec r, v;
+  fill_analytic_state (t, &r, &v);
+  return alloc_vec (v._y, v._z);
 }
 
-Vec *get_runge_kutta_vec (Vec *vec, Vec *k_1, Vec *k_2, Vec *k_3, Vec *k_4)
+Vec *get_analytic_a (Vec *v)
 {
-  if (!vec || !k_1 || !k_2 || !k_3 || !k_4)
-  { return NULL; }
-  double y = vec->_y + (1.f/6) * (k_1->_y + 2 * k_2->_y + 2 * k_3->_y +
-                                  k_4->_y);
-  double z = vec->_z + (1.f/6) * (k_1->_z + 2 * k_2->_z + 2 * k_3->_z +
-                                  k_4->_z);
+  double y = (q / m) * (E - B * v->_z);
+  double z = (q / m) * (B * v->_y);
   return alloc_vec (y, z);
 }
 
-void free_runge_kutta (Vec **a, Vec **v, Vec **r, Vec **k_1_v, Vec **k_2_v,
-                       Vec **k_3_v, Vec **k_4_v, Vec **k_1_r, Vec **k_2_r,
-                       Vec **k_3_r, Vec **k_4_r)
+const MethodInfo *get_method_info (Method method)
 {
-  free_and_NULLify (a);
-  free_and_NULLify (v);
-  free_and_NULLify (r);
-  free_and_NULLify (k_1_v);
-  free_and_NULLify (k_2_v);
-  free_and_NULLify (k_3_v);
-  free_and_NULLify (k_4_v);
-  free_and_NULLify (k_1_r);
-  free_and_NULLify (k_2_r);
-  free_and_NULLify (k_3_r);
-  free_and_NULLify (k_4_r);
-}
\ No newline at end of file
+  if ((size_t) method >= NUM_OF_METHODS || !METHOD_TABLE[method].name)
+  { return NULL; }
+  return &METHOD_TABLE[method];
+}
@@ -2,6 +2,8 @@
 #define METHODS_H
 
 #include "structs.h"
+#include "rk_engine.h"
+#include "etd_engine.h"
 #include <math.h>
 
 typedef enum Method
@@ -10,13 +12,39 @@ typedef enum Method
     ANALYTIC,
     EULER,
     MIDPOINT,
-    RUNGE_KUTTA
+    RUNGE_KUTTA,
+    HEUN,
+    BOGACKI_SHAMPINE,
+    DORMAND_PRINCE,
+    ETD_RUNGE_KUTTA,
+    GUIDING_CENTRE
 }Method;
 
+extern const Tableau EULER_TABLEAU, MIDPOINT_TABLEAU, RUNGE_KUTTA_TABLEAU,
+    HEUN_TABLEAU, BOGACKI_SHAMPINE_TABLEAU, DORMAND_PRINCE_TABLEAU;
+extern const RkPhysics DEFAULT_PHYSICS;
+extern const EtdPhysics DEFAULT_ETD_PHYSICS;
+
 TimeState *analytic_method(TimeState *curr_time_state, double Dt);
+void fill_analytic_state (double t, Vec *r, Vec *v);
+void fill_analytic_state_from (const RkPhysics *physics, const Vec *r_0,
+                               const Vec *v_0, double t, Vec *r, Vec *v);
 TimeState *euler_method (TimeState *curr_time_state, double Dt);
 TimeState *midpoint_method (TimeState *curr_time_state, double Dt);
 TimeState *runge_kutta_method (TimeState *curr_time_state, double Dt);
+TimeState *heun_method (TimeState *curr_time_state, double Dt);
+TimeState *bogacki_shampine_method (TimeState *curr_time_state, double Dt);
+TimeState *dormand_prince_method (TimeState *curr_time_state, double Dt);
+TimeState *etd_runge_kutta_method (TimeState *curr_time_state, double Dt);
+TimeState *guiding_centre_method (TimeState *curr_time_state, double Dt);
+TimeState *alloc_rk_time_state (const RkState *state);
 NEXT_STEP_METHOD *get_method (Method method);
+const Tableau *get_tableau (Method method);
+Method get_method_by_name (const char *name);
+char *get_method_name (Method method);
+char *get_method_path (Method method, const char *format);
+bool is_rk_method (Method method);
+bool is_embedded_method (Method method);
+bool is_batch_method (Method method);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,680 @@
+#include "parallel.h"
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+
+/* Index of the calling thread in the team loop it runs, 0 outside one. */
+static _Thread_local unsigned int team_worker;
+
+typedef struct ParallelJob
+{
+    size_t size, chunk;
+    atomic_size_t next;
+    PARALLEL_BODY *body;
+    void *ctx;
+}ParallelJob;
+
+typedef struct ParallelWorker
+{
+    ParallelJob *job;
+    int cpu;
+}ParallelWorker;
+
+/* Slice id of [0, size) cut into num_of_workers, the one steal_for starts
+ * worker id with. */
+typedef struct StaticWorker
+{
+    size_t size;
+    unsigned int id, num_of_workers;
+    PARALLEL_BODY *body;
+    void *ctx;
+}StaticWorker;
+
+/* The caller is worker 0 of every loop and the threads are workers 1 up
+ * to num_of_workers - 1. A loop is started by bumping generation, and
+ * busy counts the threads still inside it. */
+struct WorkTeam
+{
+    pthread_t *threads;
+    unsigned int num_of_workers;
+    ParallelJob *job;
+    uint64_t generation;
+    unsigned int busy;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t start, finished;
+};
+
+typedef struct TeamWorker
+{
+    WorkTeam *team;
+    unsigned int id;
+}TeamWorker;
+
+typedef struct TouchBuffer
+{
+    char *data;
+    size_t size;
+}TouchBuffer;
+
+typedef struct StealJob
+{
+    size_t grain;
+    PARALLEL_BODY *body;
+    void *ctx;
+    StealDeque *deques;
+    unsigned int num_of_workers;
+    atomic_size_t remaining, queued;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+}StealJob;
+
+typedef struct StealWorker
+{
+    StealJob *job;
+    unsigned int id;
+    uint64_t seed;
+    int cpu;
+}StealWorker;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void *parallel_worker (void *arg);
+void *parallel_thread (void *arg);
+void *static_worker (void *arg);
+void touch_slice (size_t begin, size_t end, void *ctx);
+void *pool_worker (void *arg);
+void *team_thread (void *arg);
+void *steal_worker (void *arg);
+void *steal_thread (void *arg);
+bool push_range (StealDeque *deque, Range range);
+bool pop_range (StealDeque *deque, Range *range);
+bool steal_range (StealJob *job, StealWorker *worker, Range *range);
+void wait_for_work (StealJob *job);
+void signal_work (StealJob *job);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+unsigned int get_num_threads ()
+{
+  long online = sysconf (_SC_NPROCESSORS_ONLN);
+  if (online < 1)
+  { return 1; }
+  return online > MAX_THREADS ? MAX_THREADS : (unsigned int) online;
+}
+
+bool parallel_for (size_t size, size_t chunk, PARALLEL_BODY *body, void *ctx)
+{
+  if (!chunk)
+  { chunk = 1; }
+  size_t num_of_chunks = (size + chunk - 1) / chunk;
+  unsigned int threads = get_num_threads ();
+  if (threads > num_of_chunks)
+  { threads = (unsigned int) num_of_chunks; }
+
+  ParallelJob job = {size, chunk, 0, body, ctx};
+  if (threads <= 1)
+  {
+    parallel_worker (&job);
+    return true;
+  }
+
+  pthread_t handles[MAX_THREADS];
+  ParallelWorker workers[MAX_THREADS];
+  unsigned int started = 1;
+  for (; started < threads; ++started)
+  {
+    workers[started] = (ParallelWorker) {&job, get_worker_cpu (started)};
+    if (pthread_create (&handles[started], NULL, parallel_thread,
+                        &workers[started]))
+    { break; }
+  }
+  pin_thread (get_worker_cpu (0));
+  parallel_worker (&job);
+  unpin_thread ();
+  for (unsigned int i = 1; i < started; ++i)
+  {
+    pthread_join (handles[i], NULL);
+  }
+  return true;
+}
+
+/* Like parallel_for, but for bodies whose cost per index varies by orders
+ * of magnitude. Every worker starts with an equal slice in its own deque
+ * and halves whatever it takes down to grain, leaving the upper halves
+ * behind; an idle worker steals the largest range left in a random
+ * victim's deque. Chunks are thus large while work is plentiful and only
+ * shrink to grain near the end. A worker that finds every deque empty
+ * sleeps until a range is left behind or the loop is done, so the tail of
+ * a loop costs no CPU. grain 0 picks one that gives every thread
+ * STEAL_CHUNKS_PER_THREAD chunks. */
+bool steal_for (size_t size, size_t grain, PARALLEL_BODY *body, void *ctx)
+{
+  unsigned int threads = get_num_threads ();
+  if (!grain)
+  { grain = size / ((size_t) threads * STEAL_CHUNKS_PER_THREAD); }
+  if (!grain)
+  { grain = 1; }
+  size_t num_of_chunks = (size + grain - 1) / grain;
+  if (threads > num_of_chunks)
+  { threads = (unsigned int) num_of_chunks; }
+  if (threads <= 1)
+  {
+    if (size)
+    { body (0, size, ctx); }
+    return true;
+  }
+
+  StealDeque *deques = calloc (threads, sizeof (StealDeque));
+  StealWorker *workers = calloc (threads, sizeof (StealWorker));
+  pthread_t *handles = calloc (threads, sizeof (pthread_t));
+  if (!deques || !workers || !handles)
+  {
+    free (deques);
+    free (workers);
+    free (handles);
+    return false;
+  }
+  StealJob job = {grain, body, ctx, deques, threads, size, threads};
+  pthread_mutex_init (&job.lock, NULL);
+  pthread_cond_init (&job.work, NULL);
+  for (unsigned int i = 0; i < threads; ++i)
+  {
+    pthread_mutex_init (&deques[i].lock, NULL);
+    push_range (&deques[i], (Range) {size * i / threads,
+                                     size * (i + 1) / threads});
+    workers[i] = (StealWorker) {&job, i, 0x9E3779B97F4A7C15ULL * (i + 1),
+                                get_worker_cpu (i)};
+  }
+
+  unsigned int started = 1;
+  for (; started < threads; ++started)
+  {
+    if (pthread_create (&handles[started], NULL, steal_thread,
+                        &workers[started]))
+    { break; }
+  }
+  /* Slices of workers that failed to start are stolen by the others. */
+  pin_thread (workers[0].cpu);
+  steal_worker (&workers[0]);
+  unpin_thread ();
+  for (unsigned int i = 1; i < started; ++i)
+  {
+    pthread_join (handles[i], NULL);
+  }
+  for (unsigned int i = 0; i < threads; ++i)
+  {
+    pthread_mutex_destroy (&deques[i].lock);
+  }
+  pthread_mutex_destroy (&job.lock);
+  pthread_cond_destroy (&job.work);
+  free (deques);
+  free (workers);
+  free (handles);
+  return true;
+}
+
+/* Runs body once over each slice steal_for would start its workers with,
+ * every slice on the worker, and so the CPU, that steal_for gives it.
+ * Memory first written here lands on the NUMA node of the worker that
+ * will mostly use it later. */
+bool static_for (size_t size, PARALLEL_BODY *body, void *ctx)
+{
+  unsigned int threads = get_num_threads ();
+  if (threads > size)
+  { threads = size ? (unsigned int) size : 1; }
+  StaticWorker workers[MAX_THREADS];
+  pthread_t handles[MAX_THREADS];
+  for (unsigned int i = 0; i < threads; ++i)
+  {
+    workers[i] = (StaticWorker) {size, i, threads, body, ctx};
+  }
+  /* A slice whose thread fails to start is run by the caller instead. */
+  bool started[MAX_THREADS] = {false};
+  for (unsigned int i = 1; i < threads; ++i)
+  {
+    started[i] = !pthread_create (&handles[i], NULL, static_worker,
+                                  &workers[i]);
+  }
+  for (unsigned int i = 0; i < threads; ++i)
+  {
+    if (!i || !started[i])
+    {
+      pin_thread (get_worker_cpu (i));
+      body (size * i / threads, size * (i + 1) / threads, ctx);
+    }
+  }
+  unpin_thread ();
+  for (unsigned int i = 1; i < threads; ++i)
+  {
+    if (started[i])
+    { pthread_join (handles[i], NULL); }
+  }
+  return true;
+}
+
+/* Zeroed memory like calloc. With a topology policy set, the pages are
+ * first written by the pinned workers through static_for, so each slice
+ * lives on the node of the worker that starts on it. */
+void *alloc_first_touch (size_t count, size_t size)
+{
+  if (get_topology_policy () == TOPOLOGY_NONE || !count || !size
+      || count > SIZE_MAX / size)
+  { return calloc (count, size); }
+  TouchBuffer buffer = {malloc (count * size), size};
+  if (!buffer.data)
+  { return NULL; }
+  static_for (count, touch_slice, &buffer);
+  return buffer.data;
+}
+
+WorkTeam *create_work_team (unsigned int num_of_workers)
+{
+  WorkTeam *team = calloc (1, sizeof (WorkTeam));
+  TeamWorker *workers = calloc (num_of_workers, sizeof (TeamWorker));
+  if (!team || !workers || !num_of_workers)
+  {
+    free (team);
+    free (workers);
+    return NULL;
+  }
+  team->threads = calloc (num_of_workers, sizeof (pthread_t));
+  if (!team->threads)
+  {
+    free (team);
+    free (workers);
+    return NULL;
+  }
+  pthread_mutex_init (&team->lock, NULL);
+  pthread_cond_init (&team->start, NULL);
+  pthread_cond_init (&team->finished, NULL);
+  /* Each thread copies its TeamWorker out before the first loop starts. */
+  team->num_of_workers = 1;
+  for (; team->num_of_workers < num_of_workers; ++team->num_of_workers)
+  {
+    unsigned int id = team->num_of_workers;
+    workers[id] = (TeamWorker) {team, id};
+    if (pthread_create (&team->threads[id], NULL, team_thread,
+                        &workers[id]))
+    { break; }
+  }
+  team_for (team, 0, 1, NULL, NULL);
+  free (workers);
+  return team;
+}
+
+unsigned int get_team_size (const WorkTeam *team)
+{
+  return team->num_of_workers;
+}
+
+/* parallel_for on the threads of the team. */
+bool team_for (WorkTeam *team, size_t size, size_t chunk, PARALLEL_BODY
+*body, void *ctx)
+{
+  ParallelJob job = {size, chunk ? chunk : 1, 0, body, ctx};
+  pthread_mutex_lock (&team->lock);
+  team->job = &job;
+  team->busy = team->num_of_workers - 1;
+  team->generation++;
+  pthread_cond_broadcast (&team->start);
+  pthread_mutex_unlock (&team->lock);
+  if (body)
+  {
+    pin_thread (get_worker_cpu (0));
+    parallel_worker (&job);
+    unpin_thread ();
+  }
+  pthread_mutex_lock (&team->lock);
+  while (team->busy)
+  {
+    pthread_cond_wait (&team->finished, &team->lock);
+  }
+  pthread_mutex_unlock (&team->lock);
+  return true;
+}
+
+/* Lets a loop body pick the per-worker scratch of its thread. */
+unsigned int get_team_worker ()
+{
+  return team_worker;
+}
+
+void destroy_work_team (WorkTeam **p_team)
+{
+  WorkTeam *team = *p_team;
+  if (!team)
+  { return; }
+  pthread_mutex_lock (&team->lock);
+  team->stop = true;
+  pthread_cond_broadcast (&team->start);
+  pthread_mutex_unlock (&team->lock);
+  for (unsigned int i = 1; i < team->num_of_workers; ++i)
+  {
+    pthread_join (team->threads[i], NULL);
+  }
+  pthread_mutex_destroy (&team->lock);
+  pthread_cond_destroy (&team->start);
+  pthread_cond_destroy (&team->finished);
+  free (team->threads);
+  free (team);
+  *p_team = NULL;
+}
+
+ThreadPool *create_thread_pool (unsigned int num_of_threads)
+{
+  ThreadPool *pool = calloc (1, sizeof (ThreadPool));
+  if (!pool)
+  { return NULL; }
+  pool->threads = calloc (num_of_threads, sizeof (pthread_t));
+  if (!pool->threads)
+  {
+    free (pool);
+    return NULL;
+  }
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->not_empty, NULL);
+  pthread_cond_init (&pool->not_full, NULL);
+  pthread_cond_init (&pool->idle, NULL);
+  for (; pool->num_of_threads < num_of_threads; ++pool->num_of_threads)
+  {
+    if (pthread_create (&pool->threads[pool->num_of_threads], NULL,
+                        pool_worker, pool))
+    { break; }
+  }
+  if (!pool->num_of_threads)
+  {
+    destroy_thread_pool (&pool);
+    return NULL;
+  }
+  return pool;
+}
+
+bool submit_task (ThreadPool *pool, POOL_TASK *task, void *arg)
+{
+  pthread_mutex_lock (&pool->lock);
+  while (pool->count == POOL_QUEUE && !pool->stop)
+  {
+    pthread_cond_wait (&pool->not_full, &pool->lock);
+  }
+  if (pool->stop)
+  {
+    pthread_mutex_unlock (&pool->lock);
+    return false;
+  }
+  PoolTask *slot = &pool->queue[(pool->head + pool->count) % POOL_QUEUE];
+  slot->task = task;
+  slot->arg = arg;
+  pool->count++;
+  pthread_cond_signal (&pool->not_empty);
+  pthread_mutex_unlock (&pool->lock);
+  return true;
+}
+
+void wait_thread_pool (ThreadPool *pool)
+{
+  pthread_mutex_lock (&pool->lock);
+  while (pool->count || pool->running)
+  {
+    pthread_cond_wait (&pool->idle, &pool->lock);
+  }
+  pthread_mutex_unlock (&pool->lock);
+}
+
+void destroy_thread_pool (ThreadPool **p_pool)
+{
+  ThreadPool *pool = *p_pool;
+  if (!pool)
+  { return; }
+  wait_thread_pool (pool);
+  pthread_mutex_lock (&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast (&pool->not_empty);
+  pthread_cond_broadcast (&pool->not_full);
+  pthread_mutex_unlock (&pool->lock);
+  for (unsigned int i = 0; i < pool->num_of_threads; ++i)
+  {
+    pthread_join (pool->threads[i], NULL);
+  }
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->not_empty);
+  pthread_cond_destroy (&pool->not_full);
+  pthread_cond_destroy (&pool->idle);
+  free (pool->threads);
+  free (pool);
+  *p_pool = NULL;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+void *parallel_worker (void *arg)
+{
+  ParallelJob *job = arg;
+  while (true)
+  {
+    size_t begin = atomic_fetch_add (&job->next, job->chunk);
+    if (begin >= job->size)
+    { return NULL; }
+    size_t end = begin + job->chunk;
+    if (end > job->size)
+    { end = job->size; }
+    job->body (begin, end, job->ctx);
+  }
+}
+
+void *parallel_thread (void *arg)
+{
+  ParallelWorker *worker = arg;
+  pin_thread (worker->cpu);
+  parallel_worker (worker->job);
+  release_allocation_pools ();
+  return NULL;
+}
+
+void *static_worker (void *arg)
+{
+  StaticWorker *worker = arg;
+  pin_thread (get_worker_cpu (worker->id));
+  worker->body (worker->size * worker->id / worker->num_of_workers,
+                worker->size * (worker->id + 1) / worker->num_of_workers,
+                worker->ctx);
+  return NULL;
+}
+
+void touch_slice (size_t begin, size_t end, void *ctx)
+{
+  TouchBuffer *buffer = ctx;
+  memset (buffer->data + begin * buffer->size, 0,
+          (end - begin) * buffer->size);
+}
+
+void *pool_worker (void *arg)
+{
+  ThreadPool *pool = arg;
+  pthread_mutex_lock (&pool->lock);
+  unsigned int id = pool->started++;
+  pthread_mutex_unlock (&pool->lock);
+  pin_thread (get_worker_cpu (id));
+  pthread_mutex_lock (&pool->lock);
+  while (true)
+  {
+    while (!pool->count && !pool->stop)
+    {
+      pthread_cond_wait (&pool->not_empty, &pool->lock);
+    }
+    if (!pool->count)
+    {
+      pthread_mutex_unlock (&pool->lock);
+      release_allocation_pools ();
+      return NULL;
+    }
+    PoolTask task = pool->queue[pool->head];
+    pool->head = (pool->head + 1) % POOL_QUEUE;
+    pool->count--;
+    pool->running++;
+    pthread_cond_signal (&pool->not_full);
+    pthread_mutex_unlock (&pool->lock);
+
+    task.task (task.arg);
+
+    pthread_mutex_lock (&pool->lock);
+    pool->running--;
+    if (!pool->count && !pool->running)
+    {
+      pthread_cond_broadcast (&pool->idle);
+    }
+  }
+}
+
+void *team_thread (void *arg)
+{
+  TeamWorker worker = *(TeamWorker *) arg;
+  WorkTeam *team = worker.team;
+  team_worker = worker.id;
+  pin_thread (get_worker_cpu (worker.id));
+  uint64_t seen = 0;
+  pthread_mutex_lock (&team->lock);
+  while (true)
+  {
+    while (team->generation == seen && !team->stop)
+    {
+      pthread_cond_wait (&team->start, &team->lock);
+    }
+    if (team->stop)
+    { break; }
+    seen = team->generation;
+    ParallelJob *job = team->job;
+    pthread_mutex_unlock (&team->lock);
+
+    if (job->body)
+    { parallel_worker (job); }
+
+    pthread_mutex_lock (&team->lock);
+    if (!--team->busy)
+    { pthread_cond_signal (&team->finished); }
+  }
+  pthread_mutex_unlock (&team->lock);
+  release_allocation_pools ();
+  return NULL;
+}
+
+void *steal_worker (void *arg)
+{
+  StealWorker *worker = arg;
+  StealJob *job = worker->job;
+  StealDeque *own = &job->deques[worker->id];
+  while (atomic_load (&job->remaining))
+  {
+    Range range;
+    if (!pop_range (own, &range) && !steal_range (job, worker, &range))
+    {
+      wait_for_work (job);
+      continue;
+    }
+    atomic_fetch_sub (&job->queued, 1);
+    bool pushed = false;
+    while (range.end - range.begin > job->grain)
+    {
+      size_t mid = range.begin + (range.end - range.begin) / 2;
+      if (!push_range (own, (Range) {mid, range.end}))
+      { break; }
+      atomic_fetch_add (&job->queued, 1);
+      pushed = true;
+      range.end = mid;
+    }
+    if (pushed)
+    { signal_work (job); }
+    job->body (range.begin, range.end, job->ctx);
+    size_t size = range.end - range.begin;
+    if (atomic_fetch_sub (&job->remaining, size) == size)
+    { signal_work (job); }
+  }
+  return NULL;
+}
+
+void *steal_thread (void *arg)
+{
+  StealWorker *worker = arg;
+  pin_thread (worker->cpu);
+  steal_worker (worker);
+  release_allocation_pools ();
+  return NULL;
+}
+
+bool push_range (StealDeque *deque, Range range)
+{
+  pthread_mutex_lock (&deque->lock);
+  bool ret = deque->bottom < STEAL_DEQUE;
+  if (ret)
+  { deque->ranges[deque->bottom++] = range; }
+  pthread_mutex_unlock (&deque->lock);
+  return ret;
+}
+
+bool pop_range (StealDeque *deque, Range *range)
+{
+  pthread_mutex_lock (&deque->lock);
+  bool ret = deque->bottom > deque->top;
+  if (ret)
+  { *range = deque->ranges[--deque->bottom]; }
+  if (deque->bottom == deque->top)
+  { deque->top = deque->bottom = 0; }
+  pthread_mutex_unlock (&deque->lock);
+  return ret;
+}
+
+/* Starts at a random victim but then tries every other worker once, so a
+ * miss means no range was queued anywhere at the time. */
+bool steal_range (StealJob *job, StealWorker *worker, Range *range)
+{
+  worker->seed ^= worker->seed << 13;
+  worker->seed ^= worker->seed >> 7;
+  worker->seed ^= worker->seed << 17;
+  unsigned int first = worker->seed % job->num_of_workers;
+  for (unsigned int attempt = 0; attempt < job->num_of_workers; ++attempt)
+  {
+    unsigned int id = (first + attempt) % job->num_of_workers;
+    if (id == worker->id)
+    { continue; }
+    StealDeque *victim = &job->deques[id];
+    pthread_mutex_lock (&victim->lock);
+    bool ret = victim->bottom > victim->top;
+    if (ret)
+    { *range = victim->ranges[victim->top++]; }
+    if (victim->bottom == victim->top)
+    { victim->top = victim->bottom = 0; }
+    pthread_mutex_unlock (&victim->lock);
+    if (ret)
+    { return true; }
+  }
+  return false;
+}
+
+/* Sleeps while the loop is unfinished but no range is queued. The counts
+ * are changed before signal_work takes the lock, so checking them under
+ * it cannot miss a wakeup. */
+void wait_for_work (StealJob *job)
+{
+  pthread_mutex_lock (&job->lock);
+  while (atomic_load (&job->remaining) && !atomic_load (&job->queued))
+  {
+    pthread_cond_wait (&job->work, &job->lock);
+  }
+  pthread_mutex_unlock (&job->lock);
+}
+
+void signal_work (StealJob *job)
+{
+  pthread_mutex_lock (&job->lock);
+  pthread_cond_broadcast (&job->work);
+  pthread_mutex_unlock (&job->lock);
+}
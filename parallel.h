@@ -0,0 +1,70 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "structs.h"
+#include "topology.h"
+#include <pthread.h>
+
+#define POOL_QUEUE 256
+#define STEAL_DEQUE 64
+#define STEAL_CHUNKS_PER_THREAD 64
+
+typedef void (PARALLEL_BODY)(size_t begin, size_t end, void *ctx);
+typedef void (POOL_TASK)(void *arg);
+
+typedef struct Range
+{
+    size_t begin, end;
+}Range;
+
+/* Ranges owned by one worker of steal_for. The owner pushes and pops at
+ * bottom, thieves take the oldest and largest range at top. */
+typedef struct StealDeque
+{
+    Range ranges[STEAL_DEQUE];
+    size_t top, bottom;
+    pthread_mutex_t lock;
+}StealDeque;
+
+/* A fork-join team whose threads outlive its loops, for callers that run
+ * many short loops in a row. The threads sleep between loops. */
+typedef struct WorkTeam WorkTeam;
+
+typedef struct PoolTask
+{
+    POOL_TASK *task;
+    void *arg;
+}PoolTask;
+
+/* Long-lived workers fed through a bounded queue. submit_task blocks while
+ * the queue is full, so a producer reading jobs can never run ahead of the
+ * workers by more than POOL_QUEUE tasks. */
+typedef struct ThreadPool
+{
+    pthread_t *threads;
+    unsigned int num_of_threads;
+    PoolTask queue[POOL_QUEUE];
+    size_t head, count, running;
+    unsigned int started;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full, idle;
+}ThreadPool;
+
+unsigned int get_num_threads ();
+bool parallel_for (size_t size, size_t chunk, PARALLEL_BODY *body, void *ctx);
+bool steal_for (size_t size, size_t grain, PARALLEL_BODY *body, void *ctx);
+bool static_for (size_t size, PARALLEL_BODY *body, void *ctx);
+void *alloc_first_touch (size_t count, size_t size);
+WorkTeam *create_work_team (unsigned int num_of_workers);
+unsigned int get_team_size (const WorkTeam *team);
+bool team_for (WorkTeam *team, size_t size, size_t chunk, PARALLEL_BODY
+*body, void *ctx);
+unsigned int get_team_worker ();
+void destroy_work_team (WorkTeam **p_team);
+ThreadPool *create_thread_pool (unsigned int num_of_threads);
+bool submit_task (ThreadPool *pool, POOL_TASK *task, void *arg);
+void wait_thread_pool (ThreadPool *pool);
+void destroy_thread_pool (ThreadPool **p_pool);
+
+#endif
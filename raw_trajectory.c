@@ -0,0 +1,186 @@
+#include "raw_trajectory.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RAW_MAGIC "NTRR001"
+#define MAGIC_SIZE 8
+#define WRITE_BINARY_MODE "wb"
+#define ROWS_OFFSET 16
+#define WRITE_BUFFER_SIZE (1 << 20)
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool check_mapped_header (MappedTrajectory *trajectory);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+RawTrajectoryWriter *open_raw_writer (char *path, uint32_t columns)
+{
+  if (!columns)
+  { return NULL; }
+  RawTrajectoryWriter *writer = calloc (1, sizeof (RawTrajectoryWriter));
+  if (!writer)
+  { return NULL; }
+  writer->f = fopen (path, WRITE_BINARY_MODE);
+  uint32_t padding = 0;
+  uint64_t rows = 0;
+  if (!writer->f
+      || setvbuf (writer->f, NULL, _IOFBF, WRITE_BUFFER_SIZE)
+      || fwrite (RAW_MAGIC, MAGIC_SIZE, 1, writer->f) != 1
+      || fwrite (&columns, sizeof (uint32_t), 1, writer->f) != 1
+      || fwrite (&padding, sizeof (uint32_t), 1, writer->f) != 1
+      || fwrite (&rows, sizeof (uint64_t), 1, writer->f) != 1)
+  {
+    if (writer->f)
+    { fclose (writer->f); }
+    free (writer);
+    return NULL;
+  }
+  writer->columns = columns;
+  return writer;
+}
+
+bool write_raw_row (RawTrajectoryWriter *writer, const double *values)
+{
+  if (fwrite (values, sizeof (double), writer->columns, writer->f)
+      != writer->columns)
+  { return false; }
+  writer->rows++;
+  return true;
+}
+
+bool close_raw_writer (RawTrajectoryWriter **p_writer)
+{
+  RawTrajectoryWriter *writer = *p_writer;
+  if (!writer)
+  { return false; }
+  bool ret = !fseek (writer->f, ROWS_OFFSET, SEEK_SET)
+             && fwrite (&writer->rows, sizeof (uint64_t), 1, writer->f) == 1;
+  ret = !fclose (writer->f) && ret;
+  free (writer);
+  *p_writer = NULL;
+  return ret;
+}
+
+MappedTrajectory *map_trajectory (char *path)
+{
+  MappedTrajectory *trajectory = calloc (1, sizeof (MappedTrajectory));
+  if (!trajectory)
+  { return NULL; }
+  int fd = open (path, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat (fd, &info) || info.st_size < RAW_HEADER_SIZE)
+  {
+    if (fd >= 0)
+    { close (fd); }
+    free (trajectory);
+    return NULL;
+  }
+  trajectory->length = (size_t) info.st_size;
+  trajectory->base = mmap (NULL, trajectory->length, PROT_READ, MAP_PRIVATE,
+                           fd, 0);
+  /* The mapping keeps the file alive on its own. */
+  close (fd);
+  if (trajectory->base == MAP_FAILED || !check_mapped_header (trajectory))
+  {
+    if (trajectory->base != MAP_FAILED)
+    { munmap (trajectory->base, trajectory->length); }
+    free (trajectory);
+    return NULL;
+  }
+  trajectory->rows = (const double *) ((const char *) trajectory->base
+                                       + RAW_HEADER_SIZE);
+  return trajectory;
+}
+
+void unmap_trajectory (MappedTrajectory **p_trajectory)
+{
+  MappedTrajectory *trajectory = *p_trajectory;
+  if (!trajectory)
+  { return; }
+  munmap (trajectory->base, trajectory->length);
+  free (trajectory);
+  *p_trajectory = NULL;
+}
+
+const double *get_mapped_row (const MappedTrajectory *trajectory, uint64_t
+row)
+{
+  return trajectory->rows + row * trajectory->columns;
+}
+
+/* Binary search of the time column: the last row at or before t, 0 when t
+ * is before the first row. */
+uint64_t find_time_row (const MappedTrajectory *trajectory, double t)
+{
+  uint64_t low = 0, high = trajectory->size;
+  while (high - low > 1)
+  {
+    uint64_t mid = low + (high - low) / 2;
+    if (*get_mapped_row (trajectory, mid) <= t)
+    { low = mid; }
+    else
+    { high = mid; }
+  }
+  return low;
+}
+
+/* The state at any t inside the stored time range, from the two rows
+ * around it by the same cubic Hermite the dense output falls back on, so
+ * a comes from the stored rows rather than from any physics. Needs the
+ * full TRAJECTORY_COLUMNS layout. */
+bool get_mapped_state (const MappedTrajectory *trajectory, double t,
+                       RkState *state)
+{
+  if (trajectory->columns != TRAJECTORY_COLUMNS || !trajectory->size)
+  { return false; }
+  double first = *get_mapped_row (trajectory, 0);
+  double last = *get_mapped_row (trajectory, trajectory->size - 1);
+  if (!(t >= first && t <= last))
+  { return false; }
+  uint64_t row = find_time_row (trajectory, t);
+  RkState in, out;
+  get_row_state (get_mapped_row (trajectory, row), &in);
+  if (row + 1 == trajectory->size || in.time == t)
+  {
+    *state = in;
+    return true;
+  }
+  get_row_state (get_mapped_row (trajectory, row + 1), &out);
+  hermite_state (&in, &out, (t - in.time) / (out.time - in.time), state);
+  return true;
+}
+
+/* A row of the TRAJECTORY_COLUMNS layout as a state. */
+void get_row_state (const double *row, RkState *state)
+{
+  *state = (RkState) {row[0], {row[1], row[2]}, {row[3], row[4]},
+                      {row[5], row[6]}};
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+bool check_mapped_header (MappedTrajectory *trajectory)
+{
+  const char *base = trajectory->base;
+  uint32_t columns;
+  uint64_t rows;
+  memcpy (&columns, base + MAGIC_SIZE, sizeof (uint32_t));
+  memcpy (&rows, base + ROWS_OFFSET, sizeof (uint64_t));
+  size_t row_size = columns * sizeof (double);
+  if (memcmp (base, RAW_MAGIC, MAGIC_SIZE) || !columns
+      || rows > (trajectory->length - RAW_HEADER_SIZE) / row_size
+      || RAW_HEADER_SIZE + rows * row_size != trajectory->length)
+  { return false; }
+  trajectory->columns = columns;
+  trajectory->size = rows;
+  return true;
+}
@@ -0,0 +1,46 @@
+#ifndef RAW_TRAJECTORY_H
+#define RAW_TRAJECTORY_H
+
+#include "methods.h"
+#include "trajectory.h"
+#include <stdint.h>
+
+#define RAW_HEADER_SIZE 24
+
+/* Uncompressed trajectories laid out to be mapped and read in place: an
+ * 8 byte magic, the column count, 4 bytes of padding and the row count,
+ * then the rows of native doubles back to back, so every value is 8 byte
+ * aligned in the mapping. Column 0 is the time and must be ascending; it
+ * is the index a time is looked up in. The row count is patched in on
+ * close, so a file that was never closed does not map. */
+typedef struct RawTrajectoryWriter
+{
+    FILE *f;
+    uint32_t columns;
+    uint64_t rows;
+}RawTrajectoryWriter;
+
+/* A read only mapping of a raw trajectory. rows points into the mapping,
+ * row i at rows + i * columns. */
+typedef struct MappedTrajectory
+{
+    void *base;
+    size_t length;
+    uint32_t columns;
+    uint64_t size;
+    const double *rows;
+}MappedTrajectory;
+
+RawTrajectoryWriter *open_raw_writer (char *path, uint32_t columns);
+bool write_raw_row (RawTrajectoryWriter *writer, const double *values);
+bool close_raw_writer (RawTrajectoryWriter **p_writer);
+MappedTrajectory *map_trajectory (char *path);
+void unmap_trajectory (MappedTrajectory **p_trajectory);
+const double *get_mapped_row (const MappedTrajectory *trajectory, uint64_t
+row);
+uint64_t find_time_row (const MappedTrajectory *trajectory, double t);
+bool get_mapped_state (const MappedTrajectory *trajectory, double t,
+                       RkState *state);
+void get_row_state (const double *row, RkState *state);
+
+#endif
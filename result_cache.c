@@ -0,0 +1,193 @@
+#include "result_cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define CACHE_ENTRY_FORMAT "%s/%016llx.ntc"
+#define CACHE_TMP_FORMAT "%s.%ld.%lu.tmp"
+#define CACHE_EXTENSION ".ntc"
+#define READ_MODE "rb"
+#define WRITE_MODE "wb"
+#define COPY_BUFFER_SIZE 65536
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef struct CacheEntry
+{
+    char path[CACHE_PATH_SIZE];
+    off_t size;
+    time_t mtime;
+}CacheEntry;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+uint64_t hash_bytes (uint64_t hash, const void *data, size_t size);
+uint64_t hash_double (uint64_t hash, double value);
+int compare_cache_entries (const void *first, const void *sec);
+bool is_cache_entry (const char *name);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* FNV-1a over the key field by field, so struct padding never leaks into
+ * the hash. */
+uint64_t hash_cache_key (const CacheKey *key)
+{
+  uint64_t hash = FNV_OFFSET;
+  uint32_t header[3] = {RESULT_CACHE_VERSION, key->kind, key->method};
+  hash = hash_bytes (hash, header, sizeof (header));
+  hash = hash_bytes (hash, &key->steps, sizeof (key->steps));
+  hash = hash_bytes (hash, &key->variants, sizeof (key->variants));
+  double values[] = {key->Dt, key->r_0._y, key->r_0._z, key->v_0._y,
+                     key->v_0._z, E, B, q, m, LENGTH, R};
+  for (size_t i = 0; i < sizeof (values) / sizeof (*values); ++i)
+  {
+    hash = hash_double (hash, values[i]);
+  }
+  return hash;
+}
+
+bool get_cache_path (const CacheKey *key, char *path, size_t size)
+{
+  if (mkdir (RESULT_CACHE_DIR, 0755) && errno != EEXIST)
+  { return false; }
+  int length = snprintf (path, size, CACHE_ENTRY_FORMAT, RESULT_CACHE_DIR,
+                         (unsigned long long) hash_cache_key (key));
+  return length > 0 && (size_t) length < size;
+}
+
+/* Entries are written under a name unique to the writing thread and then
+ * renamed over the final path, so readers only ever see whole files. */
+bool get_cache_tmp_path (char *path, char *tmp_path, size_t size)
+{
+  int length = snprintf (tmp_path, size, CACHE_TMP_FORMAT, path,
+                         (long) getpid (), (unsigned long) pthread_self ());
+  return length > 0 && (size_t) length < size;
+}
+
+/* Reports a hit and marks the entry as recently used. */
+bool lookup_cache (char *path)
+{
+  if (access (path, R_OK))
+  { return false; }
+  utime (path, NULL);
+  return true;
+}
+
+bool commit_cache_entry (char *tmp_path, char *path)
+{
+  if (rename (tmp_path, path))
+  {
+    remove (tmp_path);
+    return false;
+  }
+  evict_cache (RESULT_CACHE_MAX_BYTES);
+  return true;
+}
+
+bool copy_cache_entry (char *path, char *dest)
+{
+  FILE *in = fopen (path, READ_MODE);
+  FILE *out = in ? fopen (dest, WRITE_MODE) : NULL;
+  bool ret = in && out;
+  char buffer[COPY_BUFFER_SIZE];
+  size_t size;
+  while (ret && (size = fread (buffer, 1, sizeof (buffer), in)))
+  {
+    ret = fwrite (buffer, 1, size, out) == size;
+  }
+  ret = ret && !ferror (in);
+  if (in)
+  { fclose (in); }
+  if (out && fclose (out))
+  { ret = false; }
+  return ret;
+}
+
+/* Drops the least recently used entries until the cache fits in
+ * max_bytes. */
+void evict_cache (uint64_t max_bytes)
+{
+  DIR *dir = opendir (RESULT_CACHE_DIR);
+  if (!dir)
+  { return; }
+  CacheEntry *entries = NULL;
+  size_t num_of_entries = 0, capacity = 0;
+  uint64_t total = 0;
+  struct dirent *dirent;
+  while ((dirent = readdir (dir)))
+  {
+    if (!is_cache_entry (dirent->d_name))
+    { continue; }
+    if (num_of_entries == capacity)
+    {
+      capacity = capacity ? 2 * capacity : 64;
+      CacheEntry *grown = realloc (entries, capacity * sizeof (CacheEntry));
+      if (!grown)
+      { break; }
+      entries = grown;
+    }
+    CacheEntry *entry = &entries[num_of_entries];
+    struct stat st;
+    int length = snprintf (entry->path, CACHE_PATH_SIZE, "%s/%s",
+                           RESULT_CACHE_DIR, dirent->d_name);
+    if (length < 0 || length >= CACHE_PATH_SIZE || stat (entry->path, &st))
+    { continue; }
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    total += st.st_size;
+    num_of_entries++;
+  }
+  closedir (dir);
+
+  qsort (entries, num_of_entries, sizeof (CacheEntry), compare_cache_entries);
+  for (size_t i = 0; i < num_of_entries && total > max_bytes; ++i)
+  {
+    if (!remove (entries[i].path))
+    { total -= entries[i].size; }
+  }
+  free (entries);
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+uint64_t hash_bytes (uint64_t hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+/* -0 and 0 describe the same run. */
+uint64_t hash_double (uint64_t hash, double value)
+{
+  if (value == 0)
+  { value = 0; }
+  return hash_bytes (hash, &value, sizeof (value));
+}
+
+int compare_cache_entries (const void *first, const void *sec)
+{
+  const CacheEntry *a = first, *b = sec;
+  return (a->mtime > b->mtime) - (a->mtime < b->mtime);
+}
+
+bool is_cache_entry (const char *name)
+{
+  size_t length = strlen (name);
+  size_t extension = strlen (CACHE_EXTENSION);
+  return length > extension
+         && !strcmp (name + length - extension, CACHE_EXTENSION);
+}
@@ -0,0 +1,37 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "trajectory_codec.h"
+
+#define RESULT_CACHE_DIR "../cache"
+#define RESULT_CACHE_VERSION 3
+#define RESULT_CACHE_MAX_BYTES (256UL << 20)
+#define CACHE_PATH_SIZE 256
+
+typedef enum CacheKind
+{
+    TIMELINE_RESULT,
+    ERRORS_RESULT
+}CacheKind;
+
+/* Everything a cached result depends on besides the constants of structs.h
+ * and RESULT_CACHE_VERSION, which hash_cache_key mixes in itself. Bump the
+ * version whenever an integrator changes its output. */
+typedef struct CacheKey
+{
+    CacheKind kind;
+    int method;
+    uint64_t steps, variants;
+    double Dt;
+    Vec r_0, v_0;
+}CacheKey;
+
+uint64_t hash_cache_key (const CacheKey *key);
+bool get_cache_path (const CacheKey *key, char *path, size_t size);
+bool get_cache_tmp_path (char *path, char *tmp_path, size_t size);
+bool lookup_cache (char *path);
+bool commit_cache_entry (char *tmp_path, char *path);
+bool copy_cache_entry (char *path, char *dest);
+void evict_cache (uint64_t max_bytes);
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef RK_ENGINE_H
+#define RK_ENGINE_H
+
+#include "structs.h"
+#include <string.h>
+
+#define RK_MAX_STAGES 7
+#define RK_MAX_DENSE 4
+
+/* Butcher tableau of an explicit Runge-Kutta scheme. b_hat holds the
+ * weights of the embedded lower order solution when embedded is set, and
+ * fsal marks schemes whose last stage is evaluated at the new state, so
+ * it doubles as the first stage of the next step. Schemes with a native
+ * continuous extension set dense_degree and give its weights as
+ * b_i(theta) = sum_j p[i][j] theta^(j + 1); the others are interpolated
+ * with a cubic Hermite over the two ends of the step. */
+typedef struct Tableau
+{
+    int stages, order;
+    bool embedded, fsal;
+    double c[RK_MAX_STAGES];
+    double a[RK_MAX_STAGES][RK_MAX_STAGES];
+    double b[RK_MAX_STAGES], b_hat[RK_MAX_STAGES];
+    int dense_degree;
+    double p[RK_MAX_STAGES][RK_MAX_DENSE];
+}Tableau;
+
+/* a = qm (e - b v_z, e_z + b v_y), the force of a crossed E/B field. e_z,
+ * a field along the filter, is 0 but for the self-field of space charge. */
+typedef struct RkPhysics
+{
+    double qm, e, b, e_z;
+}RkPhysics;
+
+/* One state by value; a is always the acceleration at v, which is the
+ * first stage of the next step. */
+typedef struct RkState
+{
+    double time;
+    Vec r, v, a;
+}RkState;
+
+/* The stage derivatives of the last step, kept for dense output. */
+typedef struct RkStages
+{
+    Vec k_r[RK_MAX_STAGES], k_v[RK_MAX_STAGES];
+}RkStages;
+
+static inline Vec get_rk_a (const RkPhysics *physics, Vec v)
+{
+  return (Vec) {physics->qm * (physics->e - physics->b * v._z),
+                physics->qm * (physics->e_z + physics->b * v._y)};
+}
+
+/* The one explicit RK step every scheme runs through. The force only
+ * depends on v, so the position stages are the stage velocities. When
+ * the tableau is a constant visible to the caller the loops unroll into
+ * the straight line code of that scheme. stages receives the stage
+ * derivatives, and err_r and err_v the embedded error estimate when the
+ * tableau has one, each only when not NULL. */
+static inline void rk_step (const Tableau *tableau, const RkPhysics
+*physics, const RkState *in, double Dt, RkState *out, RkStages *stages,
+                            Vec *err_r, Vec *err_v)
+{
+  Vec k_r[RK_MAX_STAGES] = {{0}}, k_v[RK_MAX_STAGES] = {{0}};
+  k_r[0] = in->v;
+  k_v[0] = in->a;
+#pragma GCC unroll 7
+  for (int i = 1; i < tableau->stages; ++i)
+  {
+    Vec v = in->v;
+#pragma GCC unroll 7
+    for (int j = 0; j < i; ++j)
+    {
+      v._y += Dt * tableau->a[i][j] * k_v[j]._y;
+      v._z += Dt * tableau->a[i][j] * k_v[j]._z;
+    }
+    k_r[i] = v;
+    k_v[i] = get_rk_a (physics, v);
+  }
+
+  Vec dr = {0, 0}, dv = {0, 0}, e_r = {0, 0}, e_v = {0, 0};
+#pragma GCC unroll 7
+  for (int i = 0; i < tableau->stages; ++i)
+  {
+    dr._y += tableau->b[i] * k_r[i]._y;
+    dr._z += tableau->b[i] * k_r[i]._z;
+    dv._y += tableau->b[i] * k_v[i]._y;
+    dv._z += tableau->b[i] * k_v[i]._z;
+    double d = tableau->b[i] - tableau->b_hat[i];
+    e_r._y += d * k_r[i]._y;
+    e_r._z += d * k_r[i]._z;
+    e_v._y += d * k_v[i]._y;
+    e_v._z += d * k_v[i]._z;
+  }
+  out->time = in->time + Dt;
+  out->r = (Vec) {in->r._y + Dt * dr._y, in->r._z + Dt * dr._z};
+  out->v = (Vec) {in->v._y + Dt * dv._y, in->v._z + Dt * dv._z};
+  out->a = tableau->fsal ? k_v[tableau->stages - 1]
+                         : get_rk_a (physics, out->v);
+  if (tableau->embedded && err_r && err_v)
+  {
+    *err_r = (Vec) {Dt * e_r._y, Dt * e_r._z};
+    *err_v = (Vec) {Dt * e_v._y, Dt * e_v._z};
+  }
+  if (stages)
+  {
+    memcpy (stages->k_r, k_r, sizeof (k_r));
+    memcpy (stages->k_v, k_v, sizeof (k_v));
+  }
+}
+
+/* The state at in->time + theta Dt, 0 <= theta <= 1, between two stored
+ * states, with no scheme or physics involved: r and v are cubic Hermites
+ * on (r, v) and (v, a) at the two ends, and a is the derivative of the
+ * v Hermite. */
+static inline void hermite_state (const RkState *in, const RkState *out,
+                                  double theta, RkState *at)
+{
+  double Dt = out->time - in->time;
+  double theta_2 = theta * theta, theta_3 = theta_2 * theta;
+  double h_00 = 2 * theta_3 - 3 * theta_2 + 1;
+  double h_10 = (theta_3 - 2 * theta_2 + theta) * Dt;
+  double h_01 = 3 * theta_2 - 2 * theta_3;
+  double h_11 = (theta_3 - theta_2) * Dt;
+  double dh_00 = (6 * theta_2 - 6 * theta) / Dt;
+  double dh_10 = 3 * theta_2 - 4 * theta + 1;
+  double dh_11 = 3 * theta_2 - 2 * theta;
+  at->time = in->time + theta * Dt;
+  at->r = (Vec) {h_00 * in->r._y + h_10 * in->v._y + h_01 * out->r._y
+                 + h_11 * out->v._y,
+                 h_00 * in->r._z + h_10 * in->v._z + h_01 * out->r._z
+                 + h_11 * out->v._z};
+  at->v = (Vec) {h_00 * in->v._y + h_10 * in->a._y + h_01 * out->v._y
+                 + h_11 * out->a._y,
+                 h_00 * in->v._z + h_10 * in->a._z + h_01 * out->v._z
+                 + h_11 * out->a._z};
+  at->a = (Vec) {dh_00 * (in->v._y - out->v._y) + dh_10 * in->a._y
+                 + dh_11 * out->a._y,
+                 dh_00 * (in->v._z - out->v._z) + dh_10 * in->a._z
+                 + dh_11 * out->a._z};
+}
+
+/* The state at in->time + theta Dt, 0 <= theta <= 1, inside the step
+ * from in to out. The native extension needs the stages of that step;
+ * without them, or without a native extension, it is hermite_state,
+ * third order for any scheme. a is always the force at the new v. */
+static inline void rk_dense (const Tableau *tableau, const RkPhysics
+*physics, const RkState *in, const RkState *out, const RkStages *stages,
+                             double theta, RkState *at)
+{
+  double Dt = out->time - in->time;
+  at->time = in->time + theta * Dt;
+  if (tableau->dense_degree > 0 && stages)
+  {
+    Vec dr = {0, 0}, dv = {0, 0};
+    for (int i = 0; i < tableau->stages; ++i)
+    {
+      double weight = 0, power = 1;
+      for (int j = 0; j < tableau->dense_degree; ++j)
+      {
+        power *= theta;
+        weight += tableau->p[i][j] * power;
+      }
+      dr._y += weight * stages->k_r[i]._y;
+      dr._z += weight * stages->k_r[i]._z;
+      dv._y += weight * stages->k_v[i]._y;
+      dv._z += weight * stages->k_v[i]._z;
+    }
+    at->r = (Vec) {in->r._y + Dt * dr._y, in->r._z + Dt * dr._z};
+    at->v = (Vec) {in->v._y + Dt * dv._y, in->v._z + Dt * dv._z};
+  }
+  else
+  { hermite_state (in, out, theta, at); }
+  at->a = get_rk_a (physics, at->v);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#include "rng.h"
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+void seed_rng (Rng *rng, uint64_t seed)
+{
+  rng->state = seed;
+}
+
+uint64_t next_rng (Rng *rng)
+{
+  uint64_t z = (rng->state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* Same distribution as get_rand_double: max_val / k for a uniform integer
+ * k in [0, RNG_DIVISION), with k == 0 mapped to 0. */
+double get_rng_double (Rng *rng, double max_val)
+{
+  uint64_t rand_int = next_rng (rng) % RNG_DIVISION;
+  if (!rand_int)
+  {
+    return 0.f;
+  }
+  return max_val / (double) rand_int;
+}
+
+/* Uniform in [0, 1) from the top 53 bits. */
+double get_rng_uniform (Rng *rng)
+{
+  return (double) (next_rng (rng) >> 11) * 0x1p-53;
+}
@@ -0,0 +1,22 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RNG_DIVISION 1000
+
+/* Self-contained generator state (splitmix64). Every owner keeps its own
+ * copy, so independent simulations never share hidden state the way
+ * srand/rand do. */
+typedef struct Rng
+{
+    uint64_t state;
+}Rng;
+
+void seed_rng (Rng *rng, uint64_t seed);
+uint64_t next_rng (Rng *rng);
+double get_rng_double (Rng *rng, double max_val);
+double get_rng_uniform (Rng *rng);
+
+#endif
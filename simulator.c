@@ -0,0 +1,277 @@
+#include "simulator.h"
+
+#define WIEN_V_MAX V
+
+typedef void (SIMULATOR_INCREMENT)(const Simulator *, const Vec *, double,
+                                   Vec *, Vec *);
+
+/* increment, tableau and physics are derived from config once, when it is
+ * set, rather than on every step. */
+struct Simulator
+{
+    SimulatorConfig config;
+    SIMULATOR_INCREMENT *increment;
+    const Tableau *tableau;
+    RkPhysics physics;
+    Rng rng;
+    Vec r_0, v_0;
+    double time;
+    Vec r, v;
+    SimulatorExit exit;
+};
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool check_simulator_config (const SimulatorConfig *config);
+void get_simulator_a (const SimulatorConfig *config, const Vec *v, Vec *a);
+void tableau_simulator_increment (const Simulator *simulator, const Vec *v,
+                                  double Dt, Vec *dr, Vec *dv);
+void analytic_simulator_increment (const Simulator *simulator, const Vec *v,
+                                   double Dt, Vec *dr, Vec *dv);
+void etd_simulator_increment (const Simulator *simulator, const Vec *v,
+                              double Dt, Vec *dr, Vec *dv);
+void gc_simulator_increment (const Simulator *simulator, const Vec *v,
+                             double Dt, Vec *dr, Vec *dv);
+
+SIMULATOR_INCREMENT *get_simulator_increment (Method method);
+void store_simulator_row (Simulator *simulator, Trajectory *out, size_t row);
+void update_simulator_exit (Simulator *simulator);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+SimulatorConfig get_default_simulator_config ()
+{
+  SimulatorConfig config = {RUNGE_KUTTA, 0, E, B, q, m, LENGTH, R,
+                            {0, 0}, {0, (3 * E) / B}, false, 0};
+  config.Dt = ((2 * M_PI) / ((q * B) / m)) / DIVISION_CONST;
+  return config;
+}
+
+Simulator *create_simulator (const SimulatorConfig *config)
+{
+  SimulatorConfig default_config = get_default_simulator_config ();
+  if (!config)
+  { config = &default_config; }
+  if (!check_simulator_config (config))
+  { return NULL; }
+  Simulator *simulator = calloc (1, sizeof (Simulator));
+  if (!simulator)
+  { return NULL; }
+  set_simulator_config (simulator, config);
+  return simulator;
+}
+
+/* Replaces the configuration and rewinds to its initial conditions. The
+ * generator is reseeded, so a given config always replays the same
+ * sequence of sampled starts. */
+bool set_simulator_config (Simulator *simulator,
+                           const SimulatorConfig *config)
+{
+  if (!simulator || !check_simulator_config (config))
+  { return false; }
+  simulator->config = *config;
+  simulator->increment = get_simulator_increment (config->method);
+  simulator->tableau = get_tableau (config->method);
+  simulator->physics = (RkPhysics) {config->charge / config->mass, config->e,
+                                    config->b, 0};
+  simulator->r_0 = config->r_0;
+  simulator->v_0 = config->v_0;
+  seed_rng (&simulator->rng, config->seed);
+  reset_simulator (simulator);
+  return true;
+}
+
+void reset_simulator (Simulator *simulator)
+{
+  simulator->time = 0;
+  simulator->r = simulator->r_0;
+  simulator->v = simulator->v_0;
+  simulator->exit = (SimulatorExit) {false, false, 0, 0, simulator->r,
+                                     simulator->v};
+}
+
+/* Draws a new start the way the wien filter CLI does, deviations R/k in
+ * r_y and V/k in v_y around the undeflected trajectory, and rewinds to
+ * it. */
+void sample_simulator_start (Simulator *simulator)
+{
+  const SimulatorConfig *config = &simulator->config;
+  simulator->r_0 = (Vec) {get_rng_double (&simulator->rng, config->radius),
+                          0};
+  simulator->v_0 = (Vec) {get_rng_double (&simulator->rng, WIEN_V_MAX),
+                          config->e / config->b};
+  reset_simulator (simulator);
+}
+
+/* Advances up to steps steps, writing the state after every step into the
+ * caller's columns while rows remain (out may be NULL, as may any column).
+ * Stops early once the particle leaves the filter if the config asks for
+ * it. Returns the number of steps taken. */
+size_t integrate_simulator (Simulator *simulator, size_t steps,
+                            Trajectory *out)
+{
+  if (!simulator)
+  { return 0; }
+  const SimulatorConfig *config = &simulator->config;
+  size_t i = 0;
+  for (; i < steps; ++i)
+  {
+    if (config->stop_at_exit && simulator->exit.done)
+    { break; }
+    Vec dr, dv;
+    simulator->increment (simulator, &simulator->v, config->Dt, &dr, &dv);
+    simulator->r._y += dr._y;
+    simulator->r._z += dr._z;
+    simulator->v._y += dv._y;
+    simulator->v._z += dv._z;
+    simulator->time += config->Dt;
+    update_simulator_exit (simulator);
+    store_simulator_row (simulator, out, i);
+  }
+  return i;
+}
+
+SimulatorExit get_simulator_exit (const Simulator *simulator)
+{
+  return simulator->exit;
+}
+
+void destroy_simulator (Simulator **p_simulator)
+{
+  if (!p_simulator)
+  { return; }
+  free (*p_simulator);
+  *p_simulator = NULL;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+bool check_simulator_config (const SimulatorConfig *config)
+{
+  return config && get_simulator_increment (config->method) && config->Dt > 0
+         && config->b != 0 && config->mass > 0 && config->length > 0
+         && config->radius > 0;
+}
+
+void get_simulator_a (const SimulatorConfig *config, const Vec *v, Vec *a)
+{
+  double qm = config->charge / config->mass;
+  a->_y = qm * (config->e - config->b * v->_z);
+  a->_z = qm * (config->b * v->_y);
+}
+
+/* Every numeric method is one rk_step on its tableau, with the physics
+ * taken from the config rather than the compiled-in constants. */
+void tableau_simulator_increment (const Simulator *simulator, const Vec *v,
+                                  double Dt, Vec *dr, Vec *dv)
+{
+  RkState in = {0, {0, 0}, *v, get_rk_a (&simulator->physics, *v)};
+  RkState out;
+  rk_step (simulator->tableau, &simulator->physics, &in, Dt, &out, NULL, NULL,
+           NULL);
+  *dr = out.r;
+  *dv = (Vec) {out.v._y - v->_y, out.v._z - v->_z};
+}
+
+/* Exact step for any start: around the E/B drift the velocity only
+ * rotates with w = qB/m, and the position follows from integrating that
+ * rotation over Dt. */
+void analytic_simulator_increment (const Simulator *simulator, const Vec *v,
+                                   double Dt, Vec *dr, Vec *dv)
+{
+  const SimulatorConfig *config = &simulator->config;
+  double w = (config->charge / config->mass) * config->b;
+  double drift = config->e / config->b;
+  double u_y = v->_y;
+  double u_z = v->_z - drift;
+  double c = cos (w * Dt);
+  double s = sin (w * Dt);
+  *dv = (Vec) {u_y * (c - 1) - u_z * s, u_y * s + u_z * (c - 1)};
+  *dr = (Vec) {(u_y * s + u_z * (c - 1)) / w,
+               (u_y * (1 - c) + u_z * s) / w + drift * Dt};
+}
+
+void etd_simulator_increment (const Simulator *simulator, const Vec *v,
+                              double Dt, Vec *dr, Vec *dv)
+{
+  EtdPhysics physics = {simulator->physics, NULL, NULL};
+  RkState in = {0, {0, 0}, *v}, out;
+  etd_step (&physics, &in, Dt, &out);
+  *dr = out.r;
+  *dv = (Vec) {out.v._y - v->_y, out.v._z - v->_z};
+}
+
+void gc_simulator_increment (const Simulator *simulator, const Vec *v,
+                             double Dt, Vec *dr, Vec *dv)
+{
+  EtdPhysics physics = {simulator->physics, NULL, NULL};
+  RkState in = {0, {0, 0}, *v}, out;
+  gc_orbit_step (&physics, &in, Dt, &out);
+  *dr = out.r;
+  *dv = (Vec) {out.v._y - v->_y, out.v._z - v->_z};
+}
+
+SIMULATOR_INCREMENT *get_simulator_increment (Method method)
+{
+  switch (method)
+  {
+    case ANALYTIC:
+      return analytic_simulator_increment;
+
+    case ETD_RUNGE_KUTTA:
+      return etd_simulator_increment;
+
+    case GUIDING_CENTRE:
+      return gc_simulator_increment;
+
+    default:
+      return get_tableau (method) ? tableau_simulator_increment : NULL;
+  }
+}
+
+void store_simulator_row (Simulator *simulator, Trajectory *out, size_t row)
+{
+  if (!out || row >= out->size)
+  { return; }
+  Vec a;
+  get_simulator_a (&simulator->config, &simulator->v, &a);
+  double values[TRAJECTORY_COLUMNS] = {simulator->time, simulator->r._y,
+                                       simulator->r._z, simulator->v._y,
+                                       simulator->v._z, a._y, a._z};
+  double *columns[TRAJECTORY_COLUMNS] = {out->time, out->r_y, out->r_z,
+                                         out->v_y, out->v_z, out->a_y,
+                                         out->a_z};
+  for (int i = 0; i < TRAJECTORY_COLUMNS; ++i)
+  {
+    if (columns[i])
+    { columns[i][row] = values[i]; }
+  }
+}
+
+/* Same rule as check_for_exit, against the configured geometry. The first
+ * crossing is latched so later steps cannot overwrite it. */
+void update_simulator_exit (Simulator *simulator)
+{
+  SimulatorExit *exit = &simulator->exit;
+  if (exit->done)
+  { return; }
+  ++exit->steps;
+  exit->time = simulator->time;
+  exit->r = simulator->r;
+  exit->v = simulator->v;
+  if (simulator->r._z > simulator->config.length)
+  {
+    exit->done = true;
+    exit->did_exit = true;
+  }
+  else if (simulator->r._y > simulator->config.radius)
+  {
+    exit->done = true;
+  }
+}
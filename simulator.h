@@ -0,0 +1,47 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "methods.h"
+#include "guiding_centre.h"
+#include "trajectory.h"
+#include "rng.h"
+
+/* Everything a simulation depends on. Unlike the CLI, which reads the
+ * constants of structs.h, every simulator carries its own copy, so
+ * simulations with different physics can run side by side. */
+typedef struct SimulatorConfig
+{
+    Method method;
+    double Dt;
+    double e, b, charge, mass;
+    double length, radius;
+    Vec r_0, v_0;
+    bool stop_at_exit;
+    uint64_t seed;
+}SimulatorConfig;
+
+typedef struct SimulatorExit
+{
+    bool done, did_exit;
+    size_t steps;
+    double time;
+    Vec r, v;
+}SimulatorExit;
+
+/* Opaque handle. A simulator owns no globals, performs no file I/O and
+ * allocates nothing after create_simulator, so independent simulators are
+ * safe to drive from different threads without locking. */
+typedef struct Simulator Simulator;
+
+SimulatorConfig get_default_simulator_config ();
+Simulator *create_simulator (const SimulatorConfig *config);
+bool set_simulator_config (Simulator *simulator,
+                           const SimulatorConfig *config);
+void reset_simulator (Simulator *simulator);
+void sample_simulator_start (Simulator *simulator);
+size_t integrate_simulator (Simulator *simulator, size_t steps,
+                            Trajectory *out);
+SimulatorExit get_simulator_exit (const Simulator *simulator);
+void destroy_simulator (Simulator **p_simulator);
+
+#endif
@@ -0,0 +1,506 @@
+#include "space_charge.h"
+#include <complex.h>
+
+#define SPACE_CHARGE_CSV "../csv_files/space_charge.csv"
+#define SPACE_CHARGE_MARGIN 0.5
+#define PARTICLE_CHUNK 1024
+
+typedef struct PushJob
+{
+    SpaceCharge *space_charge;
+    Batch *batch;
+    bool *done;
+    Method method;
+    const Tableau *tableau;
+    double Dt;
+}PushJob;
+
+typedef struct DstJob
+{
+    SpaceCharge *space_charge;
+    double *grid;
+    bool along_z;
+}DstJob;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+double *alloc_twiddles (size_t size);
+void fft (double complex *data, size_t size, const double *twiddles);
+void dst (double *data, size_t count, size_t stride, double complex *buffer,
+          const double *twiddles);
+void dst_lines (size_t begin, size_t end, void *ctx);
+void deposit_slab (size_t begin, size_t end, void *ctx);
+void reduce_rho (size_t begin, size_t end, void *ctx);
+void solve_poisson (SpaceCharge *space_charge);
+void get_node_fields (SpaceCharge *space_charge);
+bool get_cic_weights (SpaceCharge *space_charge, double y, double z,
+                      size_t *node, double weights[4]);
+void push_particles (size_t begin, size_t end, void *ctx);
+void sample_space_charge (SpaceCharge *space_charge, double r_y, double r_z,
+                          double *e_y, double *e_z);
+Vec get_space_charge_a (double t, Vec r, Vec v, void *ctx);
+void push_etd_particles (PushJob *job, size_t begin, size_t end);
+size_t update_done (Batch *batch, bool *done);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+SpaceCharge *alloc_space_charge (size_t n_y, size_t n_z, double
+macro_charge)
+{
+  SpaceCharge *space_charge = calloc (1, sizeof (SpaceCharge));
+  if (!space_charge)
+  { return NULL; }
+  size_t nodes = (n_y + 1) * (n_z + 1);
+  space_charge->n_y = n_y;
+  space_charge->n_z = n_z;
+  space_charge->team = create_work_team (get_num_threads ());
+  if (!space_charge->team)
+  {
+    free (space_charge);
+    return NULL;
+  }
+  space_charge->slabs = get_team_size (space_charge->team);
+  /* One odd extension of the longer grid line, in complex doubles. */
+  space_charge->scratch_size = 2 * 2 * (n_y > n_z ? n_y : n_z);
+  space_charge->y_0 = -R;
+  space_charge->z_0 = -SPACE_CHARGE_MARGIN;
+  space_charge->h_y = 2 * R / n_y;
+  space_charge->h_z = (LENGTH + 2 * SPACE_CHARGE_MARGIN) / n_z;
+  space_charge->macro_charge = macro_charge;
+  space_charge->rho = calloc (nodes, sizeof (double));
+  space_charge->slab_rho = calloc (nodes * space_charge->slabs,
+                                   sizeof (double));
+  space_charge->phi = calloc (nodes, sizeof (double));
+  space_charge->e_y = calloc (nodes, sizeof (double));
+  space_charge->e_z = calloc (nodes, sizeof (double));
+  space_charge->twiddle_y = alloc_twiddles (2 * n_y);
+  space_charge->twiddle_z = alloc_twiddles (2 * n_z);
+  space_charge->scratch = malloc (space_charge->scratch_size
+                                  * space_charge->slabs * sizeof (double));
+  if (!space_charge->rho || !space_charge->slab_rho || !space_charge->phi
+      || !space_charge->e_y || !space_charge->e_z
+      || !space_charge->twiddle_y || !space_charge->twiddle_z
+      || !space_charge->scratch)
+  {
+    free_space_charge (&space_charge);
+    return NULL;
+  }
+  return space_charge;
+}
+
+void free_space_charge (SpaceCharge **p_space_charge)
+{
+  SpaceCharge *space_charge = *p_space_charge;
+  if (!space_charge)
+  { return; }
+  free (space_charge->rho);
+  free (space_charge->slab_rho);
+  free (space_charge->phi);
+  free (space_charge->e_y);
+  free (space_charge->e_z);
+  free (space_charge->twiddle_y);
+  free (space_charge->twiddle_z);
+  free (space_charge->scratch);
+  destroy_work_team (&space_charge->team);
+  free (space_charge);
+  *p_space_charge = NULL;
+}
+
+/* Deposits the live particles, solves for the potential and leaves the
+ * self-field on the grid nodes. Every thread deposits its own slab of
+ * particles into a private copy of the grid, so no atomics are needed. */
+bool solve_space_charge (SpaceCharge *space_charge, Batch *batch,
+                         const bool *done)
+{
+  PushJob job = {space_charge, batch, (bool *) done, NON_METHOD, NULL, 0};
+  size_t nodes = (space_charge->n_y + 1) * (space_charge->n_z + 1);
+  WorkTeam *team = space_charge->team;
+  if (!team_for (team, space_charge->slabs, 1, deposit_slab, &job)
+      || !team_for (team, nodes, PARTICLE_CHUNK, reduce_rho, space_charge))
+  { return false; }
+  solve_poisson (space_charge);
+  get_node_fields (space_charge);
+  return true;
+}
+
+/* Advances the whole ensemble together. The self-field is recomputed once
+ * per step and held fixed over the stages of that step. */
+bool run_space_charge (Batch *batch, Method method, double Dt, double
+beam_charge)
+{
+  const Tableau *tableau = get_tableau (method);
+  if (!tableau && method != ETD_RUNGE_KUTTA)
+  { return false; }
+  SpaceCharge *space_charge = alloc_space_charge (SPACE_CHARGE_N_Y,
+                                                  SPACE_CHARGE_N_Z,
+                                                  beam_charge / batch->size);
+  bool *done = calloc (batch->size, sizeof (bool));
+  if (!space_charge || !done)
+  {
+    free_space_charge (&space_charge);
+    free (done);
+    return false;
+  }
+  memset (batch->did_exit, 0, batch->size * sizeof (bool));
+  memset (batch->steps, 0, batch->size * sizeof (unsigned int));
+
+  PushJob job = {space_charge, batch, done, method, tableau, Dt};
+  bool ret = true;
+  size_t active = batch->size;
+  for (unsigned int s = 0; s < MAX_BATCH_STEPS && active && ret; ++s)
+  {
+    ret = solve_space_charge (space_charge, batch, done)
+          && team_for (space_charge->team, batch->size, PARTICLE_CHUNK,
+                       push_particles, &job);
+    active = update_done (batch, done);
+  }
+  free_space_charge (&space_charge);
+  free (done);
+  return ret;
+}
+
+bool export_space_charge (Method method, double T, size_t particles, double
+beam_charge)
+{
+  Batch *batch = alloc_batch (particles);
+  if (!batch)
+  { return false; }
+  init_wien_batch (batch, NULL, 0);
+  bool ret = run_space_charge (batch, method, T / DIVISION_CONST, beam_charge)
+             && print_wien_batch (batch, NULL, 0, SPACE_CHARGE_CSV);
+  free_batch (&batch);
+  return ret;
+}
+
+/*********************************/
+/*        POISSON HELPERS        */
+/*********************************/
+
+double *alloc_twiddles (size_t size)
+{
+  double *twiddles = malloc (size * sizeof (double));
+  if (!twiddles)
+  { return NULL; }
+  for (size_t i = 0; i < size / 2; ++i)
+  {
+    twiddles[2 * i] = cos (2 * M_PI * i / size);
+    twiddles[2 * i + 1] = -sin (2 * M_PI * i / size);
+  }
+  return twiddles;
+}
+
+/* In-place iterative radix-2 FFT; size must be a power of two. */
+void fft (double complex *data, size_t size, const double *twiddles)
+{
+  for (size_t i = 1, j = 0; i < size; ++i)
+  {
+    size_t bit = size >> 1;
+    for (; j & bit; bit >>= 1)
+    {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j)
+    {
+      double complex tmp = data[i];
+      data[i] = data[j];
+      data[j] = tmp;
+    }
+  }
+  for (size_t len = 2; len <= size; len <<= 1)
+  {
+    size_t step = size / len;
+    for (size_t i = 0; i < size; i += len)
+    {
+      for (size_t k = 0; k < len / 2; ++k)
+      {
+        double complex w = twiddles[2 * k * step]
+                           + I * twiddles[2 * k * step + 1];
+        double complex u = data[i + k];
+        double complex v = data[i + k + len / 2] * w;
+        data[i + k] = u + v;
+        data[i + k + len / 2] = u - v;
+      }
+    }
+  }
+}
+
+/* Type I sine transform of the count - 1 interior values of a grid line,
+ * computed from the FFT of their odd extension. */
+void dst (double *data, size_t count, size_t stride, double complex *buffer,
+          const double *twiddles)
+{
+  buffer[0] = 0;
+  buffer[count] = 0;
+  for (size_t j = 1; j < count; ++j)
+  {
+    buffer[j] = data[j * stride];
+    buffer[2 * count - j] = -data[j * stride];
+  }
+  fft (buffer, 2 * count, twiddles);
+  for (size_t j = 1; j < count; ++j)
+  {
+    data[j * stride] = -cimag (buffer[j]) / 2;
+  }
+}
+
+void dst_lines (size_t begin, size_t end, void *ctx)
+{
+  DstJob *job = ctx;
+  SpaceCharge *space_charge = job->space_charge;
+  size_t row = space_charge->n_z + 1;
+  size_t count = job->along_z ? space_charge->n_z : space_charge->n_y;
+  double complex *buffer = (double complex *) (space_charge->scratch
+                                               + get_team_worker ()
+                                                 * space_charge->scratch_size);
+  for (size_t line = begin; line < end; ++line)
+  {
+    if (job->along_z)
+    {
+      dst (job->grid + line * row, count, 1, buffer,
+           space_charge->twiddle_z);
+    }
+    else
+    {
+      dst (job->grid + line, count, row, buffer, space_charge->twiddle_y);
+    }
+  }
+}
+
+/* Solves laplacian(phi) = -rho / EPSILON_0 with phi = 0 on the boundary by
+ * diagonalising the 5 point Laplacian with sine transforms. */
+void solve_poisson (SpaceCharge *space_charge)
+{
+  size_t n_y = space_charge->n_y, n_z = space_charge->n_z;
+  size_t row = n_z + 1;
+  double *phi = space_charge->phi;
+  memcpy (phi, space_charge->rho, (n_y + 1) * row * sizeof (double));
+
+  DstJob along_z = {space_charge, phi, true};
+  DstJob along_y = {space_charge, phi, false};
+  team_for (space_charge->team, n_y, 1, dst_lines, &along_z);
+  team_for (space_charge->team, n_z, 1, dst_lines, &along_y);
+
+  double h_y = space_charge->h_y, h_z = space_charge->h_z;
+  double scale = (2.0 / n_y) * (2.0 / n_z) / EPSILON_0;
+  for (size_t j = 1; j < n_y; ++j)
+  {
+    double s_y = sin (M_PI * j / (2 * n_y));
+    for (size_t k = 1; k < n_z; ++k)
+    {
+      double s_z = sin (M_PI * k / (2 * n_z));
+      double mu = 4 * s_y * s_y / (h_y * h_y) + 4 * s_z * s_z / (h_z * h_z);
+      phi[j * row + k] *= scale / mu;
+    }
+  }
+
+  team_for (space_charge->team, n_y, 1, dst_lines, &along_z);
+  team_for (space_charge->team, n_z, 1, dst_lines, &along_y);
+  for (size_t k = 0; k <= n_z; ++k)
+  {
+    phi[k] = 0;
+    phi[n_y * row + k] = 0;
+  }
+  for (size_t j = 0; j <= n_y; ++j)
+  {
+    phi[j * row] = 0;
+    phi[j * row + n_z] = 0;
+  }
+}
+
+void get_node_fields (SpaceCharge *space_charge)
+{
+  size_t n_y = space_charge->n_y, n_z = space_charge->n_z;
+  size_t row = n_z + 1;
+  const double *phi = space_charge->phi;
+  for (size_t j = 0; j <= n_y; ++j)
+  {
+    size_t low_j = j ? j - 1 : j, high_j = j < n_y ? j + 1 : j;
+    for (size_t k = 0; k <= n_z; ++k)
+    {
+      size_t low_k = k ? k - 1 : k, high_k = k < n_z ? k + 1 : k;
+      space_charge->e_y[j * row + k] =
+          -(phi[high_j * row + k] - phi[low_j * row + k])
+          / ((high_j - low_j) * space_charge->h_y);
+      space_charge->e_z[j * row + k] =
+          -(phi[j * row + high_k] - phi[j * row + low_k])
+          / ((high_k - low_k) * space_charge->h_z);
+    }
+  }
+}
+
+/***********************************/
+/*        PARTICLE HELPERS         */
+/***********************************/
+
+/* Cloud-in-cell weights of the four nodes around (y, z); false when the
+ * particle is outside the grid. */
+bool get_cic_weights (SpaceCharge *space_charge, double y, double z,
+                      size_t *node, double weights[4])
+{
+  double u = (y - space_charge->y_0) / space_charge->h_y;
+  double w = (z - space_charge->z_0) / space_charge->h_z;
+  if (!(u >= 0 && w >= 0 && u < space_charge->n_y && w < space_charge->n_z))
+  { return false; }
+  size_t j = (size_t) u, k = (size_t) w;
+  double f_y = u - j, f_z = w - k;
+  *node = j * (space_charge->n_z + 1) + k;
+  weights[0] = (1 - f_y) * (1 - f_z);
+  weights[1] = (1 - f_y) * f_z;
+  weights[2] = f_y * (1 - f_z);
+  weights[3] = f_y * f_z;
+  return true;
+}
+
+void deposit_slab (size_t begin, size_t end, void *ctx)
+{
+  PushJob *job = ctx;
+  SpaceCharge *space_charge = job->space_charge;
+  Batch *batch = job->batch;
+  size_t row = space_charge->n_z + 1;
+  size_t nodes = (space_charge->n_y + 1) * row;
+  size_t per_slab = (batch->size + space_charge->slabs - 1)
+                    / space_charge->slabs;
+  double density = space_charge->macro_charge
+                   / (space_charge->h_y * space_charge->h_z);
+  for (size_t slab = begin; slab < end; ++slab)
+  {
+    double *rho = space_charge->slab_rho + slab * nodes;
+    memset (rho, 0, nodes * sizeof (double));
+    size_t last = (slab + 1) * per_slab;
+    for (size_t i = slab * per_slab; i < last && i < batch->size; ++i)
+    {
+      size_t node;
+      double weights[4];
+      if (job->done[i]
+          || !get_cic_weights (space_charge, batch->r_y[i], batch->r_z[i],
+                               &node, weights))
+      { continue; }
+      rho[node] += density * weights[0];
+      rho[node + 1] += density * weights[1];
+      rho[node + row] += density * weights[2];
+      rho[node + row + 1] += density * weights[3];
+    }
+  }
+}
+
+void reduce_rho (size_t begin, size_t end, void *ctx)
+{
+  SpaceCharge *space_charge = ctx;
+  size_t nodes = (space_charge->n_y + 1) * (space_charge->n_z + 1);
+  for (size_t node = begin; node < end; ++node)
+  {
+    double sum = 0;
+    for (size_t slab = 0; slab < space_charge->slabs; ++slab)
+    {
+      sum += space_charge->slab_rho[slab * nodes + node];
+    }
+    space_charge->rho[node] = sum;
+  }
+}
+
+/* Gathers the self-field at every live particle and advances it with the
+ * external fields plus that self-field, through the same rk_step as the
+ * single particle methods. */
+void push_particles (size_t begin, size_t end, void *ctx)
+{
+  PushJob *job = ctx;
+  if (job->method == ETD_RUNGE_KUTTA)
+  {
+    push_etd_particles (job, begin, end);
+    return;
+  }
+  Batch *batch = job->batch;
+  for (size_t i = begin; i < end; ++i)
+  {
+    if (job->done[i])
+    { continue; }
+    double e_y, e_z;
+    sample_space_charge (job->space_charge, batch->r_y[i], batch->r_z[i],
+                         &e_y, &e_z);
+    RkPhysics physics = {q / m, E + e_y, B, e_z};
+    Vec v = {batch->v_y[i], batch->v_z[i]};
+    RkState in = {0, {batch->r_y[i], batch->r_z[i]}, v,
+                  get_rk_a (&physics, v)}, out;
+    rk_step (job->tableau, &physics, &in, job->Dt, &out, NULL, NULL, NULL);
+    batch->r_y[i] = out.r._y;
+    batch->r_z[i] = out.r._z;
+    batch->v_y[i] = out.v._y;
+    batch->v_z[i] = out.v._z;
+    batch->steps[i]++;
+  }
+}
+
+/* The self-field at (r_y, r_z), 0 outside of the grid. */
+void sample_space_charge (SpaceCharge *space_charge, double r_y, double r_z,
+                          double *e_y, double *e_z)
+{
+  *e_y = 0;
+  *e_z = 0;
+  size_t row = space_charge->n_z + 1;
+  size_t node;
+  double weights[4];
+  if (get_cic_weights (space_charge, r_y, r_z, &node, weights))
+  {
+    const double *grid_y = space_charge->e_y, *grid_z = space_charge->e_z;
+    *e_y = weights[0] * grid_y[node] + weights[1] * grid_y[node + 1]
+           + weights[2] * grid_y[node + row]
+           + weights[3] * grid_y[node + row + 1];
+    *e_z = weights[0] * grid_z[node] + weights[1] * grid_z[node + 1]
+           + weights[2] * grid_z[node + row]
+           + weights[3] * grid_z[node + row + 1];
+  }
+}
+
+/* The perturbation the exponential integrator sees: the acceleration of
+ * the self-field, which stays frozen over the step as for the RK push. */
+Vec get_space_charge_a (double t, Vec r, Vec v, void *ctx)
+{
+  (void) t;
+  (void) v;
+  double e_y, e_z;
+  sample_space_charge (ctx, r._y, r._z, &e_y, &e_z);
+  return (Vec) {(q / m) * e_y, (q / m) * e_z};
+}
+
+/* The uniform fields are taken exactly and only the self-field is sampled
+ * at the stages, where the particle actually is at each of them. */
+void push_etd_particles (PushJob *job, size_t begin, size_t end)
+{
+  Batch *batch = job->batch;
+  EtdPhysics physics = {{q / m, E, B}, get_space_charge_a,
+                        job->space_charge};
+  for (size_t i = begin; i < end; ++i)
+  {
+    if (job->done[i])
+    { continue; }
+    RkState in = {0, {batch->r_y[i], batch->r_z[i]},
+                  {batch->v_y[i], batch->v_z[i]}}, out;
+    etd_step (&physics, &in, job->Dt, &out);
+    batch->r_y[i] = out.r._y;
+    batch->r_z[i] = out.r._z;
+    batch->v_y[i] = out.v._y;
+    batch->v_z[i] = out.v._z;
+    batch->steps[i]++;
+  }
+}
+
+size_t update_done (Batch *batch, bool *done)
+{
+  size_t active = 0;
+  for (size_t i = 0; i < batch->size; ++i)
+  {
+    if (!done[i])
+    {
+      bool exited = batch->r_z[i] > LENGTH;
+      done[i] = exited || batch->r_y[i] > R;
+      batch->did_exit[i] = exited;
+    }
+    active += !done[i];
+  }
+  return active;
+}
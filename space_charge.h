@@ -0,0 +1,37 @@
+#ifndef SPACE_CHARGE_H
+#define SPACE_CHARGE_H
+
+#include "wien_batch.h"
+#include "parallel.h"
+
+#define SPACE_CHARGE_N_Y 64
+#define SPACE_CHARGE_N_Z 512
+
+/* Particle-in-cell grid over y in [-R, R] and the length of the filter,
+ * with the potential grounded on its whole boundary. n_y and n_z count
+ * cells and must be powers of two. The team runs every loop of a step, and
+ * each of its workers deposits into its own slab of slab_rho and
+ * transforms grid lines in its own scratch_size doubles of scratch. */
+typedef struct SpaceCharge
+{
+    size_t n_y, n_z, slabs;
+    double y_0, z_0, h_y, h_z;
+    double macro_charge;
+    double *rho, *slab_rho, *phi, *e_y, *e_z;
+    double *twiddle_y, *twiddle_z;
+    WorkTeam *team;
+    double *scratch;
+    size_t scratch_size;
+}SpaceCharge;
+
+SpaceCharge *alloc_space_charge (size_t n_y, size_t n_z, double
+macro_charge);
+void free_space_charge (SpaceCharge **p_space_charge);
+bool solve_space_charge (SpaceCharge *space_charge, Batch *batch,
+                         const bool *done);
+bool run_space_charge (Batch *batch, Method method, double Dt, double
+beam_charge);
+bool export_space_charge (Method method, double T, size_t particles, double
+beam_charge);
+
+#endif
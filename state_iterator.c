@@ -0,0 +1,80 @@
+#include "state_iterator.h"
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* Takes ownership of starting_conditions. max_steps bounds the number of
+ * steps taken after it, NO_STEP_BUDGET leaves it unbounded. */
+void init_state_iterator (StateIterator *iterator, TimeState
+*starting_conditions, NEXT_STEP_METHOD *next_step_method, double Dt,
+                          uint64_t max_steps)
+{
+  *iterator = (StateIterator) {next_step_method, Dt, starting_conditions, 0,
+                               max_steps, NULL, NULL, false, false, false};
+  if (!starting_conditions || !next_step_method)
+  {
+    iterator->done = true;
+    iterator->failed = true;
+  }
+}
+
+/* stop is asked about every state handed out; once it returns true that
+ * state is the last one. */
+void set_iterator_stop (StateIterator *iterator, ITERATOR_STOP *stop,
+                        void *stop_ctx)
+{
+  iterator->stop = stop;
+  iterator->stop_ctx = stop_ctx;
+}
+
+/* Returns the starting conditions on the first call and the next state on
+ * every later one, or NULL once the budget is spent, the stop condition
+ * held or a step failed to allocate (failed is set then). The state is
+ * owned by the iterator and only valid until the next call. */
+TimeState *next_state (StateIterator *iterator)
+{
+  if (iterator->done)
+  { return NULL; }
+  if (iterator->started)
+  {
+    if (iterator->steps == iterator->max_steps)
+    {
+      iterator->done = true;
+      return NULL;
+    }
+    TimeState *next_time_state = iterator->next_step_method (iterator->curr,
+                                                             iterator->Dt);
+    if (!next_time_state)
+    {
+      iterator->done = true;
+      iterator->failed = true;
+      return NULL;
+    }
+    free_time_state (&iterator->curr);
+    iterator->curr = next_time_state;
+    iterator->steps++;
+  }
+  iterator->started = true;
+  if (iterator->stop && iterator->stop (iterator->curr, iterator->stop_ctx))
+  {
+    iterator->done = true;
+  }
+  return iterator->curr;
+}
+
+/* Hands the most recent state over to the caller, leaving the iterator
+ * exhausted. */
+TimeState *take_last_state (StateIterator *iterator)
+{
+  TimeState *last = iterator->curr;
+  iterator->curr = NULL;
+  iterator->done = true;
+  return last;
+}
+
+void free_state_iterator (StateIterator *iterator)
+{
+  free_time_state (&iterator->curr);
+  iterator->done = true;
+}
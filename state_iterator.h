@@ -0,0 +1,33 @@
+#ifndef STATE_ITERATOR_H
+#define STATE_ITERATOR_H
+
+#include "methods.h"
+
+#define NO_STEP_BUDGET UINT64_MAX
+
+typedef bool (ITERATOR_STOP)(TimeState *state, void *ctx);
+
+/* Pulls the states of one integration on demand instead of building a
+ * Timeline: only the state last handed out is alive, and the consumer
+ * decides how far to go. */
+typedef struct StateIterator
+{
+    NEXT_STEP_METHOD *next_step_method;
+    double Dt;
+    TimeState *curr;
+    uint64_t steps, max_steps;
+    ITERATOR_STOP *stop;
+    void *stop_ctx;
+    bool started, done, failed;
+}StateIterator;
+
+void init_state_iterator (StateIterator *iterator, TimeState
+*starting_conditions, NEXT_STEP_METHOD *next_step_method, double Dt,
+                          uint64_t max_steps);
+void set_iterator_stop (StateIterator *iterator, ITERATOR_STOP *stop,
+                        void *stop_ctx);
+TimeState *next_state (StateIterator *iterator);
+TimeState *take_last_state (StateIterator *iterator);
+void free_state_iterator (StateIterator *iterator);
+
+#endif
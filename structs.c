@@ -1,10 +1,32 @@
 #include "structs.h"
 
+#define POOL_CAPACITY 4096
+
+/* Per-thread caches of freed Vec and TimeState blocks. The blocks are still
+ * plain malloc allocations, so code that releases them with free () stays
+ * correct; the cache only saves the allocator round trip when a long-lived
+ * thread steps through many timelines. */
+typedef struct FreeBlock
+{
+    struct FreeBlock *next;
+}FreeBlock;
+
+typedef struct FreeList
+{
+    FreeBlock *head;
+    size_t size;
+}FreeList;
+
+static _Thread_local FreeList vec_pool, time_state_pool;
+
 /******************************************/
 /*        FUNCTIONS DECLARATIONS          */
 /******************************************/
 
 void free_vec(Vec **p_vec);
+void *pool_alloc (FreeList *pool, size_t size);
+void pool_free (FreeList *pool, void *block);
+void release_pool (FreeList *pool);
 
 /***********************************************/
 /*        H FUNCTIONS IMPLEMENTATIONS          */
@@ -18,7 +40,7 @@ Timeline *alloc_time_line()
 
 TimeState *alloc_time_state(double t,Vec *r, Vec *v, Vec *a)
 {
-  TimeState *time_state = malloc (sizeof (TimeState));
+  TimeState *time_state = pool_alloc (&time_state_pool, sizeof (TimeState));
   if (!time_state)
   {
     return NULL;
@@ -33,7 +55,7 @@ TimeState *alloc_time_state(double t,Vec *r, Vec *v, Vec *a)
 
 Vec *alloc_vec(double y, double z)
 {
-  Vec *vec = malloc (sizeof (Vec));
+  Vec *vec = pool_alloc (&vec_pool, sizeof (Vec));
   if (!vec) {return NULL;}
   vec->_y = y;
   vec->_z = z;
@@ -45,7 +67,7 @@ void free_time_line(Timeline **p_timeline)
   Timeline *timeline = *p_timeline;
   if (!timeline) {return;}
   TimeState *next_time_state = timeline->first;
-  for (int i = 0; i < timeline->size; ++i)
+  for (uint64_t i = 0; i < timeline->size; ++i)
   {
     TimeState *curr_time_state = next_time_state;
     next_time_state = curr_time_state->next;
@@ -83,6 +105,12 @@ void add_to_vec_vec(Vec *first, Vec *second)
   first->_z = first->_z + second->_z;
 }
 
+void release_allocation_pools ()
+{
+  release_pool (&vec_pool);
+  release_pool (&time_state_pool);
+}
+
 TimeState *clone_time_state(TimeState *time_state)
 {
   Vec *r = alloc_vec (time_state->r->_y, time_state->r->_z);
@@ -111,13 +139,49 @@ void free_time_state(TimeState **p_time_state)
   free_vec(&time_state->r);
   free_vec(&time_state->v);
   free_vec(&time_state->a);
-  free (time_state);
+  pool_free (&time_state_pool, time_state);
   *p_time_state = NULL;
 }
 
 void free_vec(Vec **p_vec)
 {
-  free(*p_vec);
+  pool_free (&vec_pool, *p_vec);
   *p_vec = NULL;
 }
 
+void *pool_alloc (FreeList *pool, size_t size)
+{
+  FreeBlock *block = pool->head;
+  if (!block)
+  { return malloc (size); }
+  pool->head = block->next;
+  pool->size--;
+  return block;
+}
+
+void pool_free (FreeList *pool, void *block)
+{
+  if (!block)
+  { return; }
+  if (pool->size == POOL_CAPACITY)
+  {
+    free (block);
+    return;
+  }
+  FreeBlock *free_block = block;
+  free_block->next = pool->head;
+  pool->head = free_block;
+  pool->size++;
+}
+
+void release_pool (FreeList *pool)
+{
+  while (pool->head)
+  {
+    FreeBlock *next = pool->head->next;
+    free (pool->head);
+    pool->head = next;
+  }
+  pool->size = 0;
+}
+
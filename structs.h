@@ -6,6 +6,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <math.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 /**************************/
 /*        CONSTS          */
@@ -19,6 +21,7 @@
 #define R 0.03f
 #define DIVISION_CONST 500
 #define V 15.f
+#define EPSILON_0 1.f
 
 /***************************/
 /*        STRUCTS          */
@@ -40,7 +43,7 @@ typedef struct Timeline
 {
     TimeState *first;
     TimeState *last;
-    unsigned int size;
+    uint64_t size;
 }Timeline;
 
 typedef TimeState * (NEXT_STEP_METHOD)(TimeState *, double Dt);
@@ -59,5 +62,6 @@ void add_to_vec_scalar(Vec *vec, double n);
 void mult_vec_vec(Vec *first, Vec *second);
 void add_to_vec_vec(Vec *first, Vec *second);
 TimeState *clone_time_state(TimeState *time_state);
+void release_allocation_pools ();
 
 #endif
\ No newline at end of file
@@ -1,35 +1,65 @@
 #include "timeline.h"
 
-#define ANALYTIC_CSV "../csv_files/analytic.csv"
-#define EULER_CSV "../csv_files/euler.csv"
-#define MIDPOINT_CSV "../csv_files/midpoint.csv"
-#define RUNGE_KUTTA_CSV "../csv_files/runge_kutta.csv"
+#define TIMELINE_CSV "../csv_files/%s.csv"
 #define TIMELINE_HEADERS "iterations,time,r_y,r_z,v_y,v_z,a_y,a_z\n"
-#define TIMELINE_ROW "%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf\n"
+#define TIMELINE_ROW "%" PRIu64 ",%lf,%lf,%lf,%lf,%lf,%lf,%lf\n"
 #define WRITE_MODE "w"
+#define CSV_EXTENSION ".csv"
+#define COMPRESSED_EXTENSION ".ntc"
+#define RAW_EXTENSION ".ntr"
+#define DENSE_EXTENSION "_dense.csv"
+#define READ_MODE "r"
+#define GRID_CAPACITY 1024
+#define MAX_DENSE_STEPS 100000000
+#define ADAPTIVE_SAFETY 0.9
+#define ADAPTIVE_MIN_FACTOR 0.2
+#define ADAPTIVE_MAX_FACTOR 5.0
+#define ADAPTIVE_SUMMARY "steps,rejected\n%zu,%zu\n"
 
 /******************************************/
 /*        FUNCTIONS DECLARATIONS          */
 /******************************************/
 
-TimeState *get_starting_conditions ();
 void init_time_line (Timeline *timeline, TimeState *starting_conditions);
 bool run_alg (Timeline *timeline, NEXT_STEP_METHOD next_step_func,
-              int dev_factor, double T);
+              uint64_t dev_factor, double T);
 char *get_timeline_path (Method method);
 void print_timeline (Timeline *timeline, char *path);
+bool export_analytic_trajectory (double T, char *path, bool compressed);
+bool stream_timeline (uint64_t dev_factor, double T, NEXT_STEP_METHOD
+next_step_method, char *path);
+bool compress_timeline (uint64_t dev_factor, double T, Method method,
+                        char *path);
+char *get_compressed_timeline_path (Method method);
+char *get_extended_timeline_path (Method method, char *extension);
+bool check_time_grid (const double *times, size_t num_of_times, double Dt);
+void get_dense_state (Method method, const RkState *in, const RkState *out,
+                      const RkStages *stages, double t, RkState *at);
+bool adaptive_rk_step (const Tableau *tableau, double tol, const RkState *in,
+                       double *Dt, RkState *out, RkStages *stages,
+                       size_t *rejected);
+double get_scaled_err (double err, double first, double sec, double tol);
+bool print_chunked_timeline (ChunkedTimeline *timeline, char *path);
+bool export_cached_timeline (Method method, double T, bool compressed,
+                             char *path);
+void get_state_values (TimeState *time_state, double *values);
 
 /***********************************************/
 /*        H FUNCTIONS IMPLEMENTATIONS          */
 /***********************************************/
 //
 Timeline *
-create_time_line (int dev_factor, double T, NEXT_STEP_METHOD next_step_method)
+create_time_line (uint64_t dev_factor, double T, NEXT_STEP_METHOD
+next_step_method)
 {
   TimeState *starting_conditions = get_starting_conditions ();
   Timeline *timeline = alloc_time_line ();
-  if (!starting_conditions || !alloc_time_line ())
-  { return NULL; }
+  if (!starting_conditions || !timeline)
+  {
+    free_time_state (&starting_conditions);
+    free (timeline);
+    return NULL;
+  }
   init_time_line (timeline, starting_conditions);
 
   if (!run_alg (timeline, next_step_method, dev_factor, T))
@@ -37,18 +67,242 @@ create_time_line (int dev_factor, double T, NEXT_STEP_METHOD next_step_method)
   return timeline;
 }
 
-bool export_one_timeline (Method method, double T)
+bool export_one_timeline (Method method, double T, bool compressed,
+                          bool cached)
 {
-  Timeline *timeline = create_time_line (DIVISION_CONST, T, get_method (method));
-  if (!timeline)
+  char *path = compressed ? get_compressed_timeline_path (method)
+                          : get_timeline_path (method);
+  if (!path)
+  { return false; }
+  bool ret;
+  if (cached)
+  {
+    ret = export_cached_timeline (method, T, compressed, path);
+  }
+  else if (method == ANALYTIC)
+  {
+    ret = export_analytic_trajectory (T, path, compressed);
+  }
+  else if (compressed)
+  {
+    ret = compress_timeline (DIVISION_CONST, T, method, path);
+  }
+  else
+  {
+    ret = stream_timeline (DIVISION_CONST, T, get_method (method), path);
+  }
+  free (path);
+  return ret;
+}
+
+/* Samples one integration at the requested times instead of at its steps.
+ * The integrator keeps its own Dt = T / dev_factor and every sample is
+ * taken from the dense output of the step it falls in, so the output grid
+ * no longer forces a small Dt. times must be ascending. With tol > 0 an
+ * embedded scheme instead starts at that Dt and adapts it to keep the
+ * estimate of each step's local error within tol, relative to 1 + |y|;
+ * the accepted and rejected step counts go to stdout. */
+bool export_dense_timeline (Method method, double T, uint64_t dev_factor,
+                            double tol, const double *times, size_t
+                            num_of_times)
+{
+  const Tableau *tableau = get_tableau (method);
+  bool stepped = tableau || method == ETD_RUNGE_KUTTA
+                 || method == GUIDING_CENTRE;
+  double Dt = T / dev_factor;
+  if ((!stepped && method != ANALYTIC) || dev_factor == 0
+      || (tol > 0 && !is_embedded_method (method))
+      || !check_time_grid (times, num_of_times, Dt))
+  { return false; }
+  TimeState *starting_conditions = get_starting_conditions ();
+  char *path = get_extended_timeline_path (method, DENSE_EXTENSION);
+  FILE *f = path ? fopen (path, WRITE_MODE) : NULL;
+  free (path);
+  if (!starting_conditions || !f)
   {
-    free_time_line (&timeline);
+    free_time_state (&starting_conditions);
+    if (f)
+    { fclose (f); }
     return false;
   }
+  RkState in = {starting_conditions->time, *starting_conditions->r,
+                *starting_conditions->v, *starting_conditions->a};
+  RkState out = in, at;
+  RkStages stages;
+  free_time_state (&starting_conditions);
+
+  fprintf (f, TIMELINE_HEADERS);
+  size_t steps = 0, rejected = 0;
+  bool ret = true;
+  for (size_t i = 0; ret && i < num_of_times; ++i)
+  {
+    while (ret && stepped && out.time < times[i])
+    {
+      in = out;
+      if (tol > 0)
+      {
+        ret = adaptive_rk_step (tableau, tol, &in, &Dt, &out, &stages,
+                                &rejected)
+              && ++steps <= MAX_DENSE_STEPS;
+      }
+      else if (tableau)
+      {
+        rk_step (tableau, &DEFAULT_PHYSICS, &in, Dt, &out, &stages, NULL,
+                 NULL);
+      }
+      else if (method == ETD_RUNGE_KUTTA)
+      { etd_step (&DEFAULT_ETD_PHYSICS, &in, Dt, &out); }
+      else
+      { gc_orbit_step (&DEFAULT_ETD_PHYSICS, &in, Dt, &out); }
+    }
+    get_dense_state (method, &in, &out, &stages, times[i], &at);
+    fprintf (f, TIMELINE_ROW, (uint64_t) i, at.time, at.r._y, at.r._z, at.v._y,
+             at.v._z, at.a._y, at.a._z);
+  }
+  if (ret && tol > 0)
+  { fprintf (stdout, ADAPTIVE_SUMMARY, steps, rejected); }
+  return !fclose (f) && ret;
+}
+
+/* num_of_samples intervals over [0, T], both ends included. */
+double *get_uniform_grid (double T, size_t num_of_samples)
+{
+  double *times = malloc ((num_of_samples + 1) * sizeof (double));
+  if (!times)
+  { return NULL; }
+  for (size_t i = 0; i <= num_of_samples; ++i)
+  {
+    times[i] = (T * i) / num_of_samples;
+  }
+  return times;
+}
+
+/* Reads a time grid of whitespace separated times. */
+double *read_time_grid (char *path, size_t *num_of_times)
+{
+  FILE *f = fopen (path, READ_MODE);
+  size_t capacity = GRID_CAPACITY;
+  double *times = malloc (capacity * sizeof (double));
+  if (!f || !times)
+  {
+    if (f)
+    { fclose (f); }
+    free (times);
+    return NULL;
+  }
+  size_t size = 0;
+  double t;
+  while (fscanf (f, "%lf", &t) == 1)
+  {
+    if (size == capacity)
+    {
+      capacity *= 2;
+      double *grown = realloc (times, capacity * sizeof (double));
+      if (!grown)
+      {
+        free (times);
+        fclose (f);
+        return NULL;
+      }
+      times = grown;
+    }
+    times[size++] = t;
+  }
+  bool ok = feof (f) && size > 0;
+  fclose (f);
+  if (!ok)
+  {
+    free (times);
+    return NULL;
+  }
+  *num_of_times = size;
+  return times;
+}
+
+/* Keeps the whole history of a run of any length: at most RESIDENT_CHUNKS
+ * chunks are held in memory and the rest is spilled to disk. */
+ChunkedTimeline *
+create_chunked_time_line (uint64_t dev_factor, double T, NEXT_STEP_METHOD
+*next_step_method)
+{
+  ChunkedTimeline *timeline = alloc_chunked_time_line (CHUNK_STATES,
+                                                       RESIDENT_CHUNKS);
+  if (!timeline)
+  { return NULL; }
+  StateIterator iterator;
+  init_state_iterator (&iterator, get_starting_conditions (),
+                       next_step_method, T / dev_factor, dev_factor);
+  TimeState *curr_time_state;
+  bool ret = true;
+  while (ret && (curr_time_state = next_state (&iterator)))
+  {
+    ret = append_chunked_state (timeline, curr_time_state);
+  }
+  ret = ret && !iterator.failed;
+  free_state_iterator (&iterator);
+  if (!ret)
+  { free_chunked_time_line (&timeline); }
+  return timeline;
+}
+
+bool export_chunked_timeline (Method method, double T, uint64_t dev_factor)
+{
+  if (dev_factor == 0)
+  { return false; }
+  ChunkedTimeline *timeline = create_chunked_time_line (dev_factor, T,
+                                                        get_method (method));
   char *path = get_timeline_path (method);
-  print_timeline (timeline, path);
+  bool ret = timeline && path && print_chunked_timeline (timeline, path);
+  free (path);
+  free_chunked_time_line (&timeline);
+  return ret;
+}
+
+/* Streams the timeline into the raw format, for analysis that maps it
+ * instead of integrating again. Like compress_timeline only the current
+ * state is held, so dev_factor is bounded by disk space alone. */
+bool export_raw_timeline (Method method, double T, uint64_t dev_factor)
+{
+  if (dev_factor == 0)
+  { return false; }
+  char *path = get_extended_timeline_path (method, RAW_EXTENSION);
+  RawTrajectoryWriter *writer = path ? open_raw_writer (path,
+                                                        TRAJECTORY_COLUMNS)
+                                     : NULL;
   free (path);
-  free_time_line (&timeline);
+  TimeState *curr_time_state = get_starting_conditions ();
+  if (!writer || !curr_time_state)
+  {
+    close_raw_writer (&writer);
+    free_time_state (&curr_time_state);
+    return false;
+  }
+
+  StateIterator iterator;
+  init_state_iterator (&iterator, curr_time_state, get_method (method),
+                       T / dev_factor, dev_factor);
+  double values[TRAJECTORY_COLUMNS];
+  bool ret = true;
+  while (ret && (curr_time_state = next_state (&iterator)))
+  {
+    get_state_values (curr_time_state, values);
+    ret = write_raw_row (writer, values);
+  }
+  ret = ret && !iterator.failed;
+  free_state_iterator (&iterator);
+  return close_raw_writer (&writer) && ret;
+}
+
+/* Fills the initial conditions part of a cache key from the same source
+ * the integrations start from. */
+bool get_starting_key (CacheKey *key)
+{
+  TimeState *starting_conditions = get_starting_conditions ();
+  if (!starting_conditions)
+  { return false; }
+  key->r_0 = *starting_conditions->r;
+  key->v_0 = *starting_conditions->v;
+  free_time_state (&starting_conditions);
   return true;
 }
 
@@ -84,10 +338,10 @@ void init_time_line (Timeline *timeline, TimeState *starting_conditions)
 }
 
 bool run_alg (Timeline *timeline, NEXT_STEP_METHOD next_step_func,
-              int dev_factor, double T)
+              uint64_t dev_factor, double T)
 {
   double Dt = T/dev_factor;
-  for (int i = 0; i < dev_factor; i++)
+  for (uint64_t i = 0; i < dev_factor; i++)
   {
     TimeState *next_time_state = next_step_func (timeline->last, Dt);
     if (!next_time_state)
@@ -101,28 +355,7 @@ bool run_alg (Timeline *timeline, NEXT_STEP_METHOD next_step_func,
 
 char *get_timeline_path (Method method)
 {
-  char *path = "";
-  switch (method)
-  {
-    case ANALYTIC:
-      path = ANALYTIC_CSV;
-      break;
-
-    case EULER:
-      path = EULER_CSV;
-      break;
-
-    case MIDPOINT:
-      path = MIDPOINT_CSV;
-      break;
-
-    case RUNGE_KUTTA:
-      path = RUNGE_KUTTA_CSV;
-      break;
-  }
-  char *ret = malloc (strlen (path) + 1);
-  strcpy (ret, path);
-  return ret;
+  return get_method_path (method, TIMELINE_CSV);
 }
 
 void print_timeline (Timeline *timeline, char *path)
@@ -130,7 +363,7 @@ void print_timeline (Timeline *timeline, char *path)
   FILE *f = fopen (path, WRITE_MODE);
   TimeState *curr_time_state = timeline->first;
   fprintf (f, TIMELINE_HEADERS);
-  for (int i = 0; i < timeline->size; ++i)
+  for (uint64_t i = 0; i < timeline->size; ++i)
   {
     fprintf (f, TIMELINE_ROW,
              i,
@@ -144,4 +377,273 @@ void print_timeline (Timeline *timeline, char *path)
     curr_time_state = curr_time_state->next;
   }
   fclose (f);
-}
\ No newline at end of file
+}
+
+bool export_analytic_trajectory (double T, char *path, bool compressed)
+{
+  Trajectory *trajectory = alloc_trajectory (DIVISION_CONST + 1);
+  if (!trajectory)
+  { return false; }
+  bool ret = fill_analytic_states (0, T / DIVISION_CONST, trajectory)
+             && (compressed ? compress_trajectory (trajectory, path)
+                            : print_trajectory (trajectory, path));
+  free_trajectory (&trajectory);
+  return ret;
+}
+
+/* Writes the timeline while it is being integrated: only the current state
+ * is kept and every row is handed to a writer thread, so formatting
+ * overlaps with stepping and memory does not grow with dev_factor. */
+bool stream_timeline (uint64_t dev_factor, double T, NEXT_STEP_METHOD
+next_step_method, char *path)
+{
+  TimeState *curr_time_state = get_starting_conditions ();
+  FILE *f = fopen (path, WRITE_MODE);
+  if (!curr_time_state || !f)
+  {
+    free_time_state (&curr_time_state);
+    if (f)
+    { fclose (f); }
+    return false;
+  }
+  fprintf (f, TIMELINE_HEADERS);
+  AsyncWriter *writer = open_async_writer (f, true, print_state_row);
+  if (!writer)
+  {
+    free_time_state (&curr_time_state);
+    fclose (f);
+    return false;
+  }
+
+  StateIterator iterator;
+  init_state_iterator (&iterator, curr_time_state, next_step_method,
+                       T / dev_factor, dev_factor);
+  WriterRow row;
+  while ((curr_time_state = next_state (&iterator)))
+  {
+    fill_state_row (&row, iterator.steps, curr_time_state);
+    push_row (writer, &row);
+  }
+  bool ret = !iterator.failed;
+  free_state_iterator (&iterator);
+  return close_async_writer (&writer) && ret;
+}
+
+bool compress_timeline (uint64_t dev_factor, double T, Method method,
+                        char *path)
+{
+  TrajectoryEncoder *encoder = open_trajectory_encoder (path,
+                                                        TRAJECTORY_COLUMNS);
+  TimeState *curr_time_state = get_starting_conditions ();
+  if (!encoder || !curr_time_state)
+  {
+    close_trajectory_encoder (&encoder);
+    free_time_state (&curr_time_state);
+    return false;
+  }
+
+  StateIterator iterator;
+  init_state_iterator (&iterator, curr_time_state, get_method (method),
+                       T / dev_factor, dev_factor);
+  double values[TRAJECTORY_COLUMNS];
+  bool ret = true;
+  while (ret && (curr_time_state = next_state (&iterator)))
+  {
+    get_state_values (curr_time_state, values);
+    ret = encode_row (encoder, values);
+  }
+  ret = ret && !iterator.failed;
+  free_state_iterator (&iterator);
+  return close_trajectory_encoder (&encoder) && ret;
+}
+
+/* Reads the timeline back in order, spilled chunks included, and hands
+ * the rows to a writer thread as stream_timeline does. */
+bool print_chunked_timeline (ChunkedTimeline *timeline, char *path)
+{
+  FILE *f = fopen (path, WRITE_MODE);
+  if (!f)
+  { return false; }
+  fprintf (f, TIMELINE_HEADERS);
+  AsyncWriter *writer = open_async_writer (f, true, print_state_row);
+  if (!writer)
+  {
+    fclose (f);
+    return false;
+  }
+  RkState state;
+  WriterRow row;
+  bool ret = true;
+  for (uint64_t i = 0; ret && i < timeline->size; ++i)
+  {
+    ret = get_chunked_state (timeline, i, &state);
+    if (!ret)
+    { break; }
+    row.index = i;
+    row.values[0] = state.time;
+    row.values[1] = state.r._y;
+    row.values[2] = state.r._z;
+    row.values[3] = state.v._y;
+    row.values[4] = state.v._z;
+    row.values[5] = state.a._y;
+    row.values[6] = state.a._z;
+    push_row (writer, &row);
+  }
+  return close_async_writer (&writer) && ret;
+}
+
+/* The cache holds every timeline in the compressed format; a miss computes
+ * it straight into the cache, and both hits and misses are then served from
+ * the entry, either copied or expanded back to the usual CSV. An entry that
+ * does not decode counts as a miss and is overwritten. */
+bool export_cached_timeline (Method method, double T, bool compressed,
+                             char *path)
+{
+  CacheKey key = {TIMELINE_RESULT, method, DIVISION_CONST, 0,
+                  T / DIVISION_CONST};
+  char cache_path[CACHE_PATH_SIZE], tmp_path[CACHE_PATH_SIZE];
+  if (!get_starting_key (&key)
+      || !get_cache_path (&key, cache_path, sizeof (cache_path)))
+  { return false; }
+  if (!lookup_cache (cache_path)
+      || !check_trajectory (cache_path, TRAJECTORY_COLUMNS))
+  {
+    if (!get_cache_tmp_path (cache_path, tmp_path, sizeof (tmp_path)))
+    { return false; }
+    bool ret = method == ANALYTIC
+               ? export_analytic_trajectory (T, tmp_path, true)
+               : compress_timeline (DIVISION_CONST, T, method, tmp_path);
+    if (!ret)
+    {
+      remove (tmp_path);
+      return false;
+    }
+    if (!commit_cache_entry (tmp_path, cache_path))
+    { return false; }
+  }
+  return compressed ? copy_cache_entry (cache_path, path)
+                    : decompress_trajectory (cache_path, path);
+}
+
+char *get_compressed_timeline_path (Method method)
+{
+  return get_extended_timeline_path (method, COMPRESSED_EXTENSION);
+}
+
+/* The timeline path with its .csv replaced by extension. */
+char *get_extended_timeline_path (Method method, char *extension)
+{
+  char *csv_path = get_timeline_path (method);
+  size_t length = strlen (csv_path) - strlen (CSV_EXTENSION);
+  char *path = malloc (length + strlen (extension) + 1);
+  if (path)
+  {
+    memcpy (path, csv_path, length);
+    strcpy (path + length, extension);
+  }
+  free (csv_path);
+  return path;
+}
+
+bool check_time_grid (const double *times, size_t num_of_times, double Dt)
+{
+  if (!times || !num_of_times || !(Dt > 0))
+  { return false; }
+  for (size_t i = 0; i < num_of_times; ++i)
+  {
+    if (!isfinite (times[i]) || times[i] < 0
+        || (i && times[i] < times[i - 1]))
+    { return false; }
+  }
+  return times[num_of_times - 1] / Dt <= MAX_DENSE_STEPS;
+}
+
+/* The state at t inside the step from in to out; the analytic method is
+ * evaluated exactly instead. */
+void get_dense_state (Method method, const RkState *in, const RkState *out,
+                      const RkStages *stages, double t, RkState *at)
+{
+  if (method == ANALYTIC || out->time == in->time)
+  {
+    at->time = t;
+    if (method == ANALYTIC)
+    { fill_analytic_state (t, &at->r, &at->v); }
+    else
+    {
+      at->r = in->r;
+      at->v = in->v;
+    }
+    at->a = get_rk_a (&DEFAULT_PHYSICS, at->v);
+    return;
+  }
+  /* The guiding centre moves on the chord of its step while the phase
+   * turns at omega, so the full orbit is rebuilt at t. */
+  if (method == GUIDING_CENTRE)
+  {
+    GuidingCentre gc_in, gc_out;
+    get_guiding_centre (&DEFAULT_ETD_PHYSICS, in, &gc_in);
+    get_guiding_centre (&DEFAULT_ETD_PHYSICS, out, &gc_out);
+    get_gc_state (&DEFAULT_ETD_PHYSICS, &gc_in, &gc_out, t, at);
+    return;
+  }
+  /* The exponential step is exact for the rotation over any part of a
+   * step, so it serves as its own dense output. */
+  if (method == ETD_RUNGE_KUTTA)
+  {
+    etd_step (&DEFAULT_ETD_PHYSICS, in, t - in->time, at);
+    return;
+  }
+  double theta = (t - in->time) / (out->time - in->time);
+  rk_dense (get_tableau (method), &DEFAULT_PHYSICS, in, out, stages, theta,
+            at);
+}
+
+/* Takes one step from in that passes the embedded error test, shrinking
+ * *Dt after every rejection, and leaves in *Dt the size the error of the
+ * accepted step suggests for the next one. The estimate belongs to the
+ * order - 1 solution, so it scales as Dt^order. Fails once Dt no longer
+ * changes the time. */
+bool adaptive_rk_step (const Tableau *tableau, double tol, const RkState *in,
+                       double *Dt, RkState *out, RkStages *stages,
+                       size_t *rejected)
+{
+  while (in->time + *Dt > in->time)
+  {
+    Vec err_r, err_v;
+    rk_step (tableau, &DEFAULT_PHYSICS, in, *Dt, out, stages, &err_r,
+             &err_v);
+    double err = fmax (fmax (get_scaled_err (err_r._y, in->r._y, out->r._y,
+                                             tol),
+                             get_scaled_err (err_r._z, in->r._z, out->r._z,
+                                             tol)),
+                       fmax (get_scaled_err (err_v._y, in->v._y, out->v._y,
+                                             tol),
+                             get_scaled_err (err_v._z, in->v._z, out->v._z,
+                                             tol)));
+    double factor = err > 0
+                    ? ADAPTIVE_SAFETY * pow (err, -1. / tableau->order)
+                    : ADAPTIVE_MAX_FACTOR;
+    factor = fmin (ADAPTIVE_MAX_FACTOR, fmax (ADAPTIVE_MIN_FACTOR, factor));
+    *Dt *= factor;
+    if (err <= 1)
+    { return true; }
+    ++*rejected;
+  }
+  return false;
+}
+
+double get_scaled_err (double err, double first, double sec, double tol)
+{
+  return fabs (err) / (tol * (1 + fmax (fabs (first), fabs (sec))));
+}
+
+void get_state_values (TimeState *time_state, double *values)
+{
+  values[0] = time_state->time;
+  values[1] = time_state->r->_y;
+  values[2] = time_state->r->_z;
+  values[3] = time_state->v->_y;
+  values[4] = time_state->v->_z;
+  values[5] = time_state->a->_y;
+  values[6] = time_state->a->_z;
+}
@@ -2,10 +2,32 @@
 #define TIMELINE_H
 
 # include "methods.h"
+#include "analytic_batch.h"
+#include "async_writer.h"
+#include "trajectory_codec.h"
+#include "state_iterator.h"
+#include "result_cache.h"
+#include "chunked_timeline.h"
+#include "raw_trajectory.h"
+#include "guiding_centre.h"
 #include <math.h>
 
 Timeline *
-create_time_line (int dev_factor, double T, NEXT_STEP_METHOD next_step_method);
-bool export_one_timeline (Method method, double T);
+create_time_line (uint64_t dev_factor, double T, NEXT_STEP_METHOD
+next_step_method);
+bool export_one_timeline (Method method, double T, bool compressed,
+                          bool cached);
+TimeState *get_starting_conditions ();
+bool get_starting_key (CacheKey *key);
+bool export_dense_timeline (Method method, double T, uint64_t dev_factor,
+                            double tol, const double *times, size_t
+                            num_of_times);
+double *get_uniform_grid (double T, size_t num_of_samples);
+double *read_time_grid (char *path, size_t *num_of_times);
+ChunkedTimeline *
+create_chunked_time_line (uint64_t dev_factor, double T, NEXT_STEP_METHOD
+*next_step_method);
+bool export_chunked_timeline (Method method, double T, uint64_t dev_factor);
+bool export_raw_timeline (Method method, double T, uint64_t dev_factor);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include "topology.h"
+#include <sched.h>
+
+#define READ_MODE "r"
+
+/* Process wide, set once from the CLI before any worker starts. */
+static TopologyPolicy topology_policy = TOPOLOGY_NONE;
+static Topology topology;
+static bool topology_loaded;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void load_process_topology ();
+bool read_cpu_list (FILE *f, cpu_set_t *set);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+bool load_topology (Topology *topology)
+{
+  cpu_set_t allowed;
+  if (sched_getaffinity (0, sizeof (allowed), &allowed))
+  { return false; }
+  topology->num_of_nodes = 0;
+  topology->num_of_cpus = 0;
+  cpu_set_t placed;
+  CPU_ZERO (&placed);
+  for (unsigned int node = 0; node < MAX_NODES; ++node)
+  {
+    char path[NODE_PATH_SIZE];
+    snprintf (path, sizeof (path), NODE_PATH_FORMAT, node);
+    FILE *f = fopen (path, READ_MODE);
+    if (!f)
+    { continue; }
+    cpu_set_t node_cpus;
+    bool ok = read_cpu_list (f, &node_cpus);
+    fclose (f);
+    if (!ok)
+    { continue; }
+    unsigned int begin = topology->num_of_cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE && cpu < MAX_CPUS; ++cpu)
+    {
+      if (CPU_ISSET (cpu, &node_cpus) && CPU_ISSET (cpu, &allowed)
+          && !CPU_ISSET (cpu, &placed))
+      {
+        CPU_SET (cpu, &placed);
+        topology->cpus[topology->num_of_cpus++] = cpu;
+      }
+    }
+    if (topology->num_of_cpus > begin)
+    { topology->node_begin[topology->num_of_nodes++] = begin; }
+  }
+  /* CPUs no node claimed, or every CPU when sysfs has no nodes, form one
+   * more node. */
+  unsigned int begin = topology->num_of_cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE && cpu < MAX_CPUS; ++cpu)
+  {
+    if (CPU_ISSET (cpu, &allowed) && !CPU_ISSET (cpu, &placed))
+    { topology->cpus[topology->num_of_cpus++] = cpu; }
+  }
+  if (topology->num_of_cpus > begin && topology->num_of_nodes < MAX_NODES)
+  { topology->node_begin[topology->num_of_nodes++] = begin; }
+  topology->node_begin[topology->num_of_nodes] = topology->num_of_cpus;
+  return topology->num_of_cpus > 0;
+}
+
+/* compact fills the CPUs of one node before moving on to the next, so few
+ * workers share one node's caches and memory; scatter deals workers out
+ * to the nodes in turn, so every node's memory bandwidth is used. Workers
+ * beyond the CPU count wrap around. -1 means leave the worker unpinned. */
+int get_policy_cpu (const Topology *topology, TopologyPolicy policy,
+                    unsigned int worker)
+{
+  if (policy == TOPOLOGY_NONE || !topology->num_of_cpus)
+  { return -1; }
+  worker %= topology->num_of_cpus;
+  if (policy == TOPOLOGY_COMPACT)
+  { return topology->cpus[worker]; }
+  unsigned int node = worker % topology->num_of_nodes;
+  unsigned int rank = worker / topology->num_of_nodes;
+  while (true)
+  {
+    unsigned int begin = topology->node_begin[node];
+    unsigned int size = topology->node_begin[node + 1] - begin;
+    if (rank < size)
+    { return topology->cpus[begin + rank]; }
+    /* Uneven nodes: the smaller ones ran out, carry on in the others. */
+    rank -= size;
+    node = (node + 1) % topology->num_of_nodes;
+  }
+}
+
+void set_topology_policy (TopologyPolicy policy)
+{
+  topology_policy = policy;
+}
+
+TopologyPolicy get_topology_policy ()
+{
+  return topology_policy;
+}
+
+int get_worker_cpu (unsigned int worker)
+{
+  if (topology_policy == TOPOLOGY_NONE)
+  { return -1; }
+  pthread_once (&topology_once, load_process_topology);
+  return topology_loaded
+         ? get_policy_cpu (&topology, topology_policy, worker) : -1;
+}
+
+/* Pins the calling thread; a negative cpu leaves it as it is. */
+bool pin_thread (int cpu)
+{
+  if (cpu < 0)
+  { return true; }
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+  return !pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+}
+
+/* Gives the calling thread back every CPU the process started with, for
+ * the caller of a parallel loop that pinned itself as worker 0. */
+bool unpin_thread ()
+{
+  if (topology_policy == TOPOLOGY_NONE || !topology_loaded)
+  { return true; }
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  for (unsigned int i = 0; i < topology.num_of_cpus; ++i)
+  {
+    CPU_SET (topology.cpus[i], &set);
+  }
+  return !pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+void load_process_topology ()
+{
+  topology_loaded = load_topology (&topology);
+}
+
+/* Parses the sysfs list format, e.g. "0-3,8-11". */
+bool read_cpu_list (FILE *f, cpu_set_t *set)
+{
+  CPU_ZERO (set);
+  int first, last;
+  char separator = ',';
+  while (separator == ',' && fscanf (f, "%d", &first) == 1)
+  {
+    last = first;
+    int c = fgetc (f);
+    if (c == '-')
+    {
+      if (fscanf (f, "%d", &last) != 1)
+      { return false; }
+      c = fgetc (f);
+    }
+    for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (cpu >= 0)
+      { CPU_SET (cpu, set); }
+    }
+    separator = (char) c;
+  }
+  return true;
+}
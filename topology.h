@@ -0,0 +1,38 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include "structs.h"
+#include <pthread.h>
+
+#define MAX_NODES 64
+#define MAX_CPUS 1024
+#define NODE_PATH_FORMAT "/sys/devices/system/node/node%u/cpulist"
+#define NODE_PATH_SIZE 64
+
+typedef enum TopologyPolicy
+{
+    TOPOLOGY_NONE,
+    TOPOLOGY_COMPACT,
+    TOPOLOGY_SCATTER
+}TopologyPolicy;
+
+/* The CPUs this process may run on, grouped by NUMA node: node n owns
+ * cpus[node_begin[n]] up to cpus[node_begin[n + 1]]. Without a node list
+ * in sysfs everything is one node. */
+typedef struct Topology
+{
+    unsigned int num_of_nodes, num_of_cpus;
+    int cpus[MAX_CPUS];
+    unsigned int node_begin[MAX_NODES + 1];
+}Topology;
+
+bool load_topology (Topology *topology);
+int get_policy_cpu (const Topology *topology, TopologyPolicy policy,
+                    unsigned int worker);
+void set_topology_policy (TopologyPolicy policy);
+TopologyPolicy get_topology_policy ();
+int get_worker_cpu (unsigned int worker);
+bool pin_thread (int cpu);
+bool unpin_thread ();
+
+#endif
@@ -0,0 +1,63 @@
+#include "trajectory.h"
+
+#define TIMELINE_HEADERS "iterations,time,r_y,r_z,v_y,v_z,a_y,a_z\n"
+#define TRAJECTORY_ROW "%zu,%lf,%lf,%lf,%lf,%lf,%lf,%lf\n"
+#define WRITE_MODE "w"
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+Trajectory *alloc_trajectory (size_t size)
+{
+  Trajectory *trajectory = malloc (sizeof (Trajectory));
+  if (!trajectory)
+  { return NULL; }
+  double *columns = malloc (TRAJECTORY_COLUMNS * size * sizeof (double));
+  if (!columns)
+  {
+    free (trajectory);
+    return NULL;
+  }
+  trajectory->size = size;
+  trajectory->time = columns;
+  trajectory->r_y = columns + size;
+  trajectory->r_z = columns + 2 * size;
+  trajectory->v_y = columns + 3 * size;
+  trajectory->v_z = columns + 4 * size;
+  trajectory->a_y = columns + 5 * size;
+  trajectory->a_z = columns + 6 * size;
+  return trajectory;
+}
+
+void free_trajectory (Trajectory **p_trajectory)
+{
+  Trajectory *trajectory = *p_trajectory;
+  if (!trajectory)
+  { return; }
+  free (trajectory->time);
+  free (trajectory);
+  *p_trajectory = NULL;
+}
+
+bool print_trajectory (Trajectory *trajectory, char *path)
+{
+  FILE *f = fopen (path, WRITE_MODE);
+  if (!f)
+  { return false; }
+  fprintf (f, TIMELINE_HEADERS);
+  for (size_t i = 0; i < trajectory->size; ++i)
+  {
+    fprintf (f, TRAJECTORY_ROW,
+             i,
+             trajectory->time[i],
+             trajectory->r_y[i],
+             trajectory->r_z[i],
+             trajectory->v_y[i],
+             trajectory->v_z[i],
+             trajectory->a_y[i],
+             trajectory->a_z[i]);
+  }
+  fclose (f);
+  return true;
+}
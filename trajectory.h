@@ -0,0 +1,21 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "structs.h"
+
+#define TRAJECTORY_COLUMNS 7
+
+/* Flat storage of a whole trajectory, one contiguous column per quantity.
+ * Unlike Timeline it costs a single allocation and can be filled in place
+ * by the batch generators. */
+typedef struct Trajectory
+{
+    size_t size;
+    double *time, *r_y, *r_z, *v_y, *v_z, *a_y, *a_z;
+}Trajectory;
+
+Trajectory *alloc_trajectory (size_t size);
+void free_trajectory (Trajectory **p_trajectory);
+bool print_trajectory (Trajectory *trajectory, char *path);
+
+#endif
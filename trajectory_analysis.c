@@ -0,0 +1,264 @@
+#include "trajectory_analysis.h"
+#include <sys/mman.h>
+
+#define CROSSINGS_CSV "../csv_files/analysis_crossings.csv"
+#define WRITE_MODE "w"
+#define CROSSING_HEADERS "boundary,direction,time,r_y,r_z,v_y,v_z\n"
+#define CROSSING_ROW "%s,%s,%.17g,%.17g,%.17g,%.17g,%.17g\n"
+#define STATS_HEADERS "rows,t_first,t_last,min_Dt,max_Dt,min_r_y,max_r_y,"\
+"min_r_z,max_r_z,min_speed,max_speed,mean_speed\n"
+#define STATS_ROW "%" PRIu64 ",%.17g,%.17g,%.6e,%.6e,%.17g,%.17g,%.17g,"\
+"%.17g,%.17g,%.17g,%.17g\n"
+#define ERRORS_HEADERS "l2_r,l2_v,max_r,max_v,t_max_r,t_max_v\n"
+#define ERRORS_ROW "%e,%e,%e,%e,%lf,%lf\n"
+#define OUTCOME_HEADERS "outcome,exit_crossings,plate_crossings,t_exit,"\
+"t_plate\n"
+#define OUTCOME_ROW "%s,%zu,%zu,%.17g,%.17g\n"
+#define STATE_HEADERS "time,r_y,r_z,v_y,v_z,a_y,a_z\n"
+#define STATE_ROW "%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n"
+#define EXIT_STR "exit"
+#define PLATE_STR "plate"
+#define INSIDE_STR "inside"
+#define UP_STR "up"
+#define DOWN_STR "down"
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void add_row_stats (TrajectoryStats *stats, const RkState *state, const
+RkState *prev);
+void add_row_errors (ErrorProfile *errors, const RkState *first, const
+RkState *state, double Dt);
+void find_crossings (const RkState *prev, const RkState *state, FILE *f,
+                     TrajectoryAnalysis *analysis);
+double get_boundary_offset (Boundary boundary, const RkState *state);
+void bisect_crossing (Boundary boundary, const RkState *prev, const RkState
+*state, RkState *at);
+char *get_boundary_str (Boundary boundary);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* One forward pass over the mapping, without integrating anything: the
+ * errors against the analytic solution from the first row's state, every
+ * boundary crossing, located inside its step by
+ * bisecting the cubic Hermite through the two rows, and the summary
+ * statistics. f, when not NULL, receives the crossings. Fails on a time
+ * column that is not strictly ascending. */
+bool analyze_trajectory (const MappedTrajectory *trajectory, FILE *f,
+                         TrajectoryAnalysis *analysis)
+{
+  *analysis = (TrajectoryAnalysis) {{0}};
+  analysis->outcome = NUM_OF_BOUNDARIES;
+  for (int i = 0; i < NUM_OF_BOUNDARIES; ++i)
+  {
+    analysis->first_crossing[i] = NAN;
+  }
+  if (trajectory->columns != TRAJECTORY_COLUMNS || !trajectory->size)
+  { return false; }
+  /* Only a hint: the pass reads every page once, front to back. */
+  madvise (trajectory->base, trajectory->length, MADV_SEQUENTIAL);
+  if (f)
+  { fprintf (f, CROSSING_HEADERS); }
+
+  RkState first, prev, state;
+  get_row_state (get_mapped_row (trajectory, 0), &first);
+  for (uint64_t i = 0; i < trajectory->size; ++i)
+  {
+    get_row_state (get_mapped_row (trajectory, i), &state);
+    if (i && !(state.time > prev.time))
+    { return false; }
+    add_row_stats (&analysis->stats, &state, i ? &prev : NULL);
+    add_row_errors (&analysis->errors, &first, &state,
+                    i ? state.time - prev.time : 0);
+    if (i)
+    { find_crossings (&prev, &state, f, analysis); }
+    prev = state;
+  }
+  analysis->stats.mean_speed /= (double) analysis->stats.rows;
+  analysis->errors.l2_r = sqrt (analysis->errors.sum_sq_r);
+  analysis->errors.l2_v = sqrt (analysis->errors.sum_sq_v);
+  return true;
+}
+
+/* Maps path, prints the analysis to stdout and the crossings to their CSV,
+ * then looks up the state at each of times. */
+bool export_trajectory_analysis (char *path, const double *times, size_t
+num_of_times)
+{
+  MappedTrajectory *trajectory = map_trajectory (path);
+  if (!trajectory)
+  { return false; }
+  /* Every time is checked up front so a bad one prints nothing. */
+  RkState state;
+  for (size_t i = 0; i < num_of_times; ++i)
+  {
+    if (!get_mapped_state (trajectory, times[i], &state))
+    {
+      unmap_trajectory (&trajectory);
+      return false;
+    }
+  }
+  FILE *f = fopen (CROSSINGS_CSV, WRITE_MODE);
+  TrajectoryAnalysis analysis;
+  bool ret = f && analyze_trajectory (trajectory, f, &analysis);
+  if (f)
+  { ret = !fclose (f) && ret; }
+  if (ret)
+  {
+    TrajectoryStats *stats = &analysis.stats;
+    fprintf (stdout, STATS_HEADERS);
+    fprintf (stdout, STATS_ROW, stats->rows, stats->t_first, stats->t_last,
+             stats->min_Dt, stats->max_Dt, stats->min_r_y, stats->max_r_y,
+             stats->min_r_z, stats->max_r_z, stats->min_speed,
+             stats->max_speed, stats->mean_speed);
+    ErrorProfile *errors = &analysis.errors;
+    fprintf (stdout, ERRORS_HEADERS);
+    fprintf (stdout, ERRORS_ROW, errors->l2_r, errors->l2_v, errors->max_r,
+             errors->max_v, errors->t_max_r, errors->t_max_v);
+    fprintf (stdout, OUTCOME_HEADERS);
+    fprintf (stdout, OUTCOME_ROW, get_boundary_str (analysis.outcome),
+             analysis.crossings[EXIT_BOUNDARY],
+             analysis.crossings[PLATE_BOUNDARY],
+             analysis.first_crossing[EXIT_BOUNDARY],
+             analysis.first_crossing[PLATE_BOUNDARY]);
+  }
+  if (ret && num_of_times)
+  { fprintf (stdout, STATE_HEADERS); }
+  for (size_t i = 0; i < num_of_times && ret; ++i)
+  {
+    get_mapped_state (trajectory, times[i], &state);
+    fprintf (stdout, STATE_ROW, state.time, state.r._y, state.r._z,
+             state.v._y, state.v._z, state.a._y, state.a._z);
+  }
+  unmap_trajectory (&trajectory);
+  return ret;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+void add_row_stats (TrajectoryStats *stats, const RkState *state, const
+RkState *prev)
+{
+  double speed = sqrt (state->v._y * state->v._y + state->v._z * state->v._z);
+  if (!prev)
+  {
+    *stats = (TrajectoryStats) {0, state->time, state->time, INFINITY, 0,
+                                state->r._y, state->r._y, state->r._z,
+                                state->r._z, speed, speed, 0};
+  }
+  else
+  {
+    double Dt = state->time - prev->time;
+    stats->min_Dt = fmin (stats->min_Dt, Dt);
+    stats->max_Dt = fmax (stats->max_Dt, Dt);
+  }
+  stats->rows++;
+  stats->t_last = state->time;
+  stats->min_r_y = fmin (stats->min_r_y, state->r._y);
+  stats->max_r_y = fmax (stats->max_r_y, state->r._y);
+  stats->min_r_z = fmin (stats->min_r_z, state->r._z);
+  stats->max_r_z = fmax (stats->max_r_z, state->r._z);
+  stats->min_speed = fmin (stats->min_speed, speed);
+  stats->max_speed = fmax (stats->max_speed, speed);
+  stats->mean_speed += speed;
+}
+
+/* Like get_error_profile, with each squared error weighted by the step
+ * that led to its row, so l2 stays sqrt(sum err^2 Dt) on uneven grids.
+ * The reference starts from first, so runs from any start are scored
+ * against their own solution; the fields are the compiled-in ones, as the
+ * raw format does not store them. */
+void add_row_errors (ErrorProfile *errors, const RkState *first, const
+RkState *state, double Dt)
+{
+  Vec r, v;
+  fill_analytic_state_from (&DEFAULT_PHYSICS, &first->r, &first->v,
+                            state->time - first->time, &r, &v);
+  Vec state_r = state->r, state_v = state->v;
+  double err_r = get_dist (&r, &state_r);
+  double err_v = get_dist (&v, &state_v);
+  errors->sum_sq_r += err_r * err_r * Dt;
+  errors->sum_sq_v += err_v * err_v * Dt;
+  if (err_r > errors->max_r)
+  {
+    errors->max_r = err_r;
+    errors->t_max_r = state->time;
+  }
+  if (err_v > errors->max_v)
+  {
+    errors->max_v = err_v;
+    errors->t_max_v = state->time;
+  }
+  errors->samples++;
+}
+
+void find_crossings (const RkState *prev, const RkState *state, FILE *f,
+                     TrajectoryAnalysis *analysis)
+{
+  for (Boundary boundary = 0; boundary < NUM_OF_BOUNDARIES; ++boundary)
+  {
+    double before = get_boundary_offset (boundary, prev);
+    double after = get_boundary_offset (boundary, state);
+    if ((before > 0) == (after > 0))
+    { continue; }
+    RkState at;
+    bisect_crossing (boundary, prev, state, &at);
+    if (!analysis->crossings[boundary]++)
+    {
+      analysis->first_crossing[boundary] = at.time;
+      if (analysis->outcome == NUM_OF_BOUNDARIES
+          || at.time < analysis->first_crossing[analysis->outcome])
+      { analysis->outcome = boundary; }
+    }
+    if (f)
+    {
+      fprintf (f, CROSSING_ROW, get_boundary_str (boundary),
+               after > 0 ? UP_STR : DOWN_STR, at.time, at.r._y, at.r._z,
+               at.v._y, at.v._z);
+    }
+  }
+}
+
+/* Positive beyond the boundary, the side check_for_exit tests for. */
+double get_boundary_offset (Boundary boundary, const RkState *state)
+{
+  return boundary == EXIT_BOUNDARY ? state->r._z - LENGTH
+                                   : state->r._y - R;
+}
+
+/* The two rows bracket the crossing; bisection over the step fraction
+ * narrows it on the interpolant. */
+void bisect_crossing (Boundary boundary, const RkState *prev, const RkState
+*state, RkState *at)
+{
+  bool rising = get_boundary_offset (boundary, state) > 0;
+  double low = 0, high = 1;
+  for (int i = 0; i < CROSSING_ITERATIONS; ++i)
+  {
+    double mid = (low + high) / 2;
+    hermite_state (prev, state, mid, at);
+    if ((get_boundary_offset (boundary, at) > 0) == rising)
+    { high = mid; }
+    else
+    { low = mid; }
+  }
+  hermite_state (prev, state, high, at);
+}
+
+char *get_boundary_str (Boundary boundary)
+{
+  switch (boundary)
+  {
+    case EXIT_BOUNDARY:
+      return EXIT_STR;
+    case PLATE_BOUNDARY:
+      return PLATE_STR;
+    default:
+      return INSIDE_STR;
+  }
+}
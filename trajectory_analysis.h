@@ -0,0 +1,45 @@
+#ifndef TRAJECTORY_ANALYSIS_H
+#define TRAJECTORY_ANALYSIS_H
+
+#include "raw_trajectory.h"
+#include "log_log_errors.h"
+
+#define CROSSING_ITERATIONS 60
+
+typedef enum Boundary
+{
+    EXIT_BOUNDARY,
+    PLATE_BOUNDARY,
+    NUM_OF_BOUNDARIES
+}Boundary;
+
+/* Summary statistics of the stored rows. speed is |v|. */
+typedef struct TrajectoryStats
+{
+    uint64_t rows;
+    double t_first, t_last, min_Dt, max_Dt;
+    double min_r_y, max_r_y, min_r_z, max_r_z;
+    double min_speed, max_speed, mean_speed;
+}TrajectoryStats;
+
+/* Everything one streaming pass over a stored trajectory yields. crossings
+ * counts the times the trajectory crossed r_z = LENGTH (the exit) and
+ * r_y = R (the plate) in either direction, and first_crossing is the time
+ * of the first one, NAN without any. outcome is the boundary crossed
+ * first, the same rule check_for_exit applies, NUM_OF_BOUNDARIES when the
+ * particle stayed inside. */
+typedef struct TrajectoryAnalysis
+{
+    TrajectoryStats stats;
+    ErrorProfile errors;
+    size_t crossings[NUM_OF_BOUNDARIES];
+    double first_crossing[NUM_OF_BOUNDARIES];
+    Boundary outcome;
+}TrajectoryAnalysis;
+
+bool analyze_trajectory (const MappedTrajectory *trajectory, FILE *f,
+                         TrajectoryAnalysis *analysis);
+bool export_trajectory_analysis (char *path, const double *times, size_t
+num_of_times);
+
+#endif
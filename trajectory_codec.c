@@ -0,0 +1,424 @@
+#include "trajectory_codec.h"
+
+#define CODEC_MAGIC "NTRC001"
+#define CODEC_END_MAGIC "NTRCEND"
+#define MAGIC_SIZE 8
+#define WIDTH_BITS 6
+#define TRAILER_SIZE (2 * sizeof (uint64_t) + MAGIC_SIZE)
+#define WRITE_BINARY_MODE "wb"
+#define READ_BINARY_MODE "rb"
+#define WRITE_MODE "w"
+#define TIMELINE_HEADERS "iterations,time,r_y,r_z,v_y,v_z,a_y,a_z\n"
+#define ROW_INDEX "%" PRIu64
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool write_bits (BitBuffer *buffer, uint64_t value, unsigned int n);
+bool flush_bits (BitBuffer *buffer);
+uint64_t read_bits (TrajectoryDecoder *decoder, unsigned int n);
+uint64_t predict (ColumnState *state, uint64_t row_in_block);
+void update_state (ColumnState *state, uint64_t bits);
+bool flush_block (TrajectoryEncoder *encoder);
+bool load_block (TrajectoryDecoder *decoder);
+uint64_t double_to_bits (double value);
+double bits_to_double (uint64_t bits);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+TrajectoryEncoder *open_trajectory_encoder (char *path, uint32_t columns)
+{
+  if (!columns || columns > CODEC_MAX_COLUMNS)
+  { return NULL; }
+  TrajectoryEncoder *encoder = calloc (1, sizeof (TrajectoryEncoder));
+  if (!encoder)
+  { return NULL; }
+  encoder->f = fopen (path, WRITE_BINARY_MODE);
+  uint32_t block_rows = CODEC_BLOCK_ROWS;
+  if (!encoder->f
+      || fwrite (CODEC_MAGIC, MAGIC_SIZE, 1, encoder->f) != 1
+      || fwrite (&columns, sizeof (uint32_t), 1, encoder->f) != 1
+      || fwrite (&block_rows, sizeof (uint32_t), 1, encoder->f) != 1)
+  {
+    if (encoder->f)
+    { fclose (encoder->f); }
+    free (encoder);
+    return NULL;
+  }
+  encoder->columns = columns;
+  return encoder;
+}
+
+bool encode_row (TrajectoryEncoder *encoder, const double *values)
+{
+  for (uint32_t c = 0; c < encoder->columns; ++c)
+  {
+    ColumnState *state = &encoder->state[c];
+    uint64_t bits = double_to_bits (values[c]);
+    uint64_t residual = bits - predict (state, encoder->block_rows);
+    uint64_t zigzag = (residual << 1) ^ (uint64_t) ((int64_t) residual >> 63);
+    update_state (state, bits);
+
+    if (!zigzag)
+    {
+      if (!write_bits (&encoder->block, 0, 1))
+      { return false; }
+      continue;
+    }
+    unsigned int width = 64 - __builtin_clzll (zigzag);
+    bool ok;
+    if (width <= state->width && state->width < width + 1 + WIDTH_BITS)
+    {
+      ok = write_bits (&encoder->block, 2, 2)
+           && write_bits (&encoder->block, zigzag, state->width);
+    }
+    else
+    {
+      state->width = width;
+      ok = write_bits (&encoder->block, 3, 2)
+           && write_bits (&encoder->block, width - 1, WIDTH_BITS)
+           && write_bits (&encoder->block, zigzag, width);
+    }
+    if (!ok)
+    { return false; }
+  }
+  encoder->rows++;
+  if (++encoder->block_rows == CODEC_BLOCK_ROWS)
+  {
+    return flush_block (encoder);
+  }
+  return true;
+}
+
+bool close_trajectory_encoder (TrajectoryEncoder **p_encoder)
+{
+  TrajectoryEncoder *encoder = *p_encoder;
+  if (!encoder)
+  { return false; }
+  bool ret = !encoder->block_rows || flush_block (encoder);
+  uint64_t num_of_blocks = encoder->num_of_blocks;
+  ret = ret
+        && fwrite (encoder->index, sizeof (uint64_t), num_of_blocks,
+                   encoder->f) == num_of_blocks
+        && fwrite (&num_of_blocks, sizeof (uint64_t), 1, encoder->f) == 1
+        && fwrite (&encoder->rows, sizeof (uint64_t), 1, encoder->f) == 1
+        && fwrite (CODEC_END_MAGIC, MAGIC_SIZE, 1, encoder->f) == 1;
+  ret = !fclose (encoder->f) && ret;
+  free (encoder->block.data);
+  free (encoder->index);
+  free (encoder);
+  *p_encoder = NULL;
+  return ret;
+}
+
+TrajectoryDecoder *open_trajectory_decoder (char *path)
+{
+  TrajectoryDecoder *decoder = calloc (1, sizeof (TrajectoryDecoder));
+  if (!decoder)
+  { return NULL; }
+  decoder->f = fopen (path, READ_BINARY_MODE);
+  char magic[MAGIC_SIZE], end_magic[MAGIC_SIZE];
+  uint32_t block_rows;
+  uint64_t num_of_blocks;
+  bool ok = decoder->f
+            && fread (magic, MAGIC_SIZE, 1, decoder->f) == 1
+            && fread (&decoder->columns, sizeof (uint32_t), 1, decoder->f) == 1
+            && fread (&block_rows, sizeof (uint32_t), 1, decoder->f) == 1
+            && !memcmp (magic, CODEC_MAGIC, MAGIC_SIZE)
+            && block_rows == CODEC_BLOCK_ROWS && decoder->columns
+            && decoder->columns <= CODEC_MAX_COLUMNS
+            && !fseek (decoder->f, -(long) TRAILER_SIZE, SEEK_END)
+            && fread (&num_of_blocks, sizeof (uint64_t), 1, decoder->f) == 1
+            && fread (&decoder->rows, sizeof (uint64_t), 1, decoder->f) == 1
+            && fread (end_magic, MAGIC_SIZE, 1, decoder->f) == 1
+            && !memcmp (end_magic, CODEC_END_MAGIC, MAGIC_SIZE);
+  if (ok && num_of_blocks)
+  {
+    decoder->num_of_blocks = num_of_blocks;
+    decoder->index = malloc (num_of_blocks * sizeof (uint64_t));
+    long index_offset = -(long) (TRAILER_SIZE
+                                 + num_of_blocks * sizeof (uint64_t));
+    ok = decoder->index
+         && !fseek (decoder->f, index_offset, SEEK_END)
+         && fread (decoder->index, sizeof (uint64_t), num_of_blocks,
+                   decoder->f) == num_of_blocks
+         && !fseek (decoder->f, (long) decoder->index[0], SEEK_SET);
+  }
+  if (!ok)
+  {
+    close_trajectory_decoder (&decoder);
+    return NULL;
+  }
+  return decoder;
+}
+
+bool decode_row (TrajectoryDecoder *decoder, double *values)
+{
+  if (decoder->row >= decoder->rows)
+  { return false; }
+  uint64_t row_in_block = decoder->row % CODEC_BLOCK_ROWS;
+  if (!row_in_block && !load_block (decoder))
+  { return false; }
+
+  for (uint32_t c = 0; c < decoder->columns; ++c)
+  {
+    ColumnState *state = &decoder->state[c];
+    uint64_t zigzag = 0;
+    if (read_bits (decoder, 1))
+    {
+      if (read_bits (decoder, 1))
+      {
+        state->width = (unsigned int) read_bits (decoder, WIDTH_BITS) + 1;
+      }
+      zigzag = read_bits (decoder, state->width);
+    }
+    uint64_t residual = (zigzag >> 1) ^ (0 - (zigzag & 1));
+    uint64_t bits = residual + predict (state, row_in_block);
+    update_state (state, bits);
+    values[c] = bits_to_double (bits);
+  }
+  decoder->row++;
+  return decoder->bit_pos <= 8 * decoder->block_size;
+}
+
+bool seek_trajectory_row (TrajectoryDecoder *decoder, uint64_t row)
+{
+  if (row >= decoder->rows)
+  { return false; }
+  uint64_t block = row / CODEC_BLOCK_ROWS;
+  if (fseek (decoder->f, (long) decoder->index[block], SEEK_SET))
+  { return false; }
+  decoder->row = block * CODEC_BLOCK_ROWS;
+  double values[CODEC_MAX_COLUMNS];
+  while (decoder->row < row)
+  {
+    if (!decode_row (decoder, values))
+    { return false; }
+  }
+  return true;
+}
+
+void close_trajectory_decoder (TrajectoryDecoder **p_decoder)
+{
+  TrajectoryDecoder *decoder = *p_decoder;
+  if (!decoder)
+  { return; }
+  if (decoder->f)
+  { fclose (decoder->f); }
+  free (decoder->block);
+  free (decoder->index);
+  free (decoder);
+  *p_decoder = NULL;
+}
+
+bool compress_trajectory (Trajectory *trajectory, char *path)
+{
+  TrajectoryEncoder *encoder = open_trajectory_encoder (path,
+                                                        TRAJECTORY_COLUMNS);
+  if (!encoder)
+  { return false; }
+  bool ret = true;
+  for (size_t i = 0; i < trajectory->size && ret; ++i)
+  {
+    double values[TRAJECTORY_COLUMNS] = {trajectory->time[i],
+                                         trajectory->r_y[i],
+                                         trajectory->r_z[i],
+                                         trajectory->v_y[i],
+                                         trajectory->v_z[i],
+                                         trajectory->a_y[i],
+                                         trajectory->a_z[i]};
+    ret = encode_row (encoder, values);
+  }
+  return close_trajectory_encoder (&encoder) && ret;
+}
+
+bool decompress_trajectory (char *path, char *csv_path)
+{
+  TrajectoryDecoder *decoder = open_trajectory_decoder (path);
+  if (!decoder)
+  { return false; }
+  FILE *f = fopen (csv_path, WRITE_MODE);
+  if (!f)
+  {
+    close_trajectory_decoder (&decoder);
+    return false;
+  }
+  if (decoder->columns == TRAJECTORY_COLUMNS)
+  { fprintf (f, TIMELINE_HEADERS); }
+  double values[CODEC_MAX_COLUMNS];
+  bool ret = true;
+  for (uint64_t i = 0; i < decoder->rows; ++i)
+  {
+    ret = decode_row (decoder, values);
+    if (!ret)
+    { break; }
+    fprintf (f, ROW_INDEX, i);
+    for (uint32_t c = 0; c < decoder->columns; ++c)
+    {
+      fprintf (f, ",%lf", values[c]);
+    }
+    fprintf (f, "\n");
+  }
+  ret = !fclose (f) && ret;
+  close_trajectory_decoder (&decoder);
+  return ret;
+}
+
+/* Decodes every row, so a truncated or mangled file is caught before it is
+ * served. */
+bool check_trajectory (char *path, uint32_t columns)
+{
+  TrajectoryDecoder *decoder = open_trajectory_decoder (path);
+  bool ret = decoder && decoder->columns == columns;
+  double values[CODEC_MAX_COLUMNS];
+  for (uint64_t i = 0; ret && i < decoder->rows; ++i)
+  {
+    ret = decode_row (decoder, values);
+  }
+  close_trajectory_decoder (&decoder);
+  return ret;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+uint64_t double_to_bits (double value)
+{
+  uint64_t bits;
+  memcpy (&bits, &value, sizeof (bits));
+  return bits;
+}
+
+double bits_to_double (uint64_t bits)
+{
+  double value;
+  memcpy (&value, &bits, sizeof (value));
+  return value;
+}
+
+/* Constant, linear and then quadratic extrapolation as the block fills. */
+uint64_t predict (ColumnState *state, uint64_t row_in_block)
+{
+  if (row_in_block == 0)
+  { return 0; }
+  if (row_in_block == 1)
+  { return state->prev; }
+  if (row_in_block == 2)
+  { return 2 * state->prev - state->prev_2; }
+  return 3 * state->prev - 3 * state->prev_2 + state->prev_3;
+}
+
+void update_state (ColumnState *state, uint64_t bits)
+{
+  state->prev_3 = state->prev_2;
+  state->prev_2 = state->prev;
+  state->prev = bits;
+}
+
+bool write_bits (BitBuffer *buffer, uint64_t value, unsigned int n)
+{
+  if (n > 32)
+  {
+    return write_bits (buffer, value >> 32, n - 32)
+           && write_bits (buffer, value, 32);
+  }
+  if (buffer->size + 8 > buffer->capacity)
+  {
+    size_t capacity = buffer->capacity ? 2 * buffer->capacity : 4096;
+    uint8_t *data = realloc (buffer->data, capacity);
+    if (!data)
+    { return false; }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+  buffer->acc = (buffer->acc << n) | (value & ((1ull << n) - 1));
+  buffer->bits += n;
+  while (buffer->bits >= 8)
+  {
+    buffer->bits -= 8;
+    buffer->data[buffer->size++] = (uint8_t) (buffer->acc >> buffer->bits);
+  }
+  return true;
+}
+
+bool flush_bits (BitBuffer *buffer)
+{
+  if (buffer->bits)
+  {
+    return write_bits (buffer, 0, 8 - buffer->bits);
+  }
+  return true;
+}
+
+uint64_t read_bits (TrajectoryDecoder *decoder, unsigned int n)
+{
+  uint64_t value = 0;
+  while (n)
+  {
+    size_t byte = decoder->bit_pos >> 3;
+    if (byte >= decoder->block_size)
+    {
+      decoder->bit_pos += n;
+      return value << n;
+    }
+    unsigned int available = 8 - (decoder->bit_pos & 7);
+    unsigned int take = n < available ? n : available;
+    uint64_t bits = (decoder->block[byte] >> (available - take))
+                    & ((1u << take) - 1);
+    value = (value << take) | bits;
+    decoder->bit_pos += take;
+    n -= take;
+  }
+  return value;
+}
+
+bool flush_block (TrajectoryEncoder *encoder)
+{
+  if (encoder->num_of_blocks == encoder->index_capacity)
+  {
+    size_t capacity = encoder->index_capacity ? 2 * encoder->index_capacity
+                                              : 64;
+    uint64_t *index = realloc (encoder->index, capacity * sizeof (uint64_t));
+    if (!index)
+    { return false; }
+    encoder->index = index;
+    encoder->index_capacity = capacity;
+  }
+  long offset = ftell (encoder->f);
+  if (offset < 0 || !flush_bits (&encoder->block))
+  { return false; }
+  encoder->index[encoder->num_of_blocks++] = (uint64_t) offset;
+
+  uint32_t header[2] = {encoder->block_rows, (uint32_t) encoder->block.size};
+  bool ret = fwrite (header, sizeof (uint32_t), 2, encoder->f) == 2
+             && fwrite (encoder->block.data, 1, encoder->block.size,
+                        encoder->f) == encoder->block.size;
+  encoder->block.size = 0;
+  encoder->block.bits = 0;
+  encoder->block_rows = 0;
+  memset (encoder->state, 0, sizeof (encoder->state));
+  return ret;
+}
+
+bool load_block (TrajectoryDecoder *decoder)
+{
+  uint32_t header[2];
+  if (fread (header, sizeof (uint32_t), 2, decoder->f) != 2)
+  { return false; }
+  if (header[1] > decoder->block_capacity)
+  {
+    uint8_t *block = realloc (decoder->block, header[1]);
+    if (!block)
+    { return false; }
+    decoder->block = block;
+    decoder->block_capacity = header[1];
+  }
+  decoder->block_size = header[1];
+  decoder->bit_pos = 0;
+  memset (decoder->state, 0, sizeof (decoder->state));
+  return fread (decoder->block, 1, header[1], decoder->f) == header[1];
+}
@@ -0,0 +1,65 @@
+#ifndef TRAJECTORY_CODEC_H
+#define TRAJECTORY_CODEC_H
+
+#include "trajectory.h"
+#include <stdint.h>
+
+#define CODEC_BLOCK_ROWS 4096
+#define CODEC_MAX_COLUMNS 16
+
+/* Lossless compressed trajectories. Each column is predicted by quadratic
+ * extrapolation of its last three values, done on the raw IEEE bit patterns
+ * so encoder and decoder agree bit for bit on any platform, and only the
+ * significant bits of the zigzagged residual are stored. Rows are framed
+ * in blocks of CODEC_BLOCK_ROWS that reset the predictor, and a block index
+ * at the end of the file gives random access to any row. */
+typedef struct ColumnState
+{
+    uint64_t prev, prev_2, prev_3;
+    unsigned int width;
+}ColumnState;
+
+typedef struct BitBuffer
+{
+    uint8_t *data;
+    size_t size, capacity;
+    uint64_t acc;
+    unsigned int bits;
+}BitBuffer;
+
+typedef struct TrajectoryEncoder
+{
+    FILE *f;
+    uint32_t columns;
+    uint64_t rows;
+    uint32_t block_rows;
+    ColumnState state[CODEC_MAX_COLUMNS];
+    BitBuffer block;
+    uint64_t *index;
+    size_t num_of_blocks, index_capacity;
+}TrajectoryEncoder;
+
+typedef struct TrajectoryDecoder
+{
+    FILE *f;
+    uint32_t columns;
+    uint64_t rows, row;
+    ColumnState state[CODEC_MAX_COLUMNS];
+    uint8_t *block;
+    size_t block_size, block_capacity, bit_pos;
+    uint64_t *index;
+    size_t num_of_blocks;
+}TrajectoryDecoder;
+
+TrajectoryEncoder *open_trajectory_encoder (char *path, uint32_t columns);
+bool encode_row (TrajectoryEncoder *encoder, const double *values);
+bool close_trajectory_encoder (TrajectoryEncoder **p_encoder);
+TrajectoryDecoder *open_trajectory_decoder (char *path);
+bool decode_row (TrajectoryDecoder *decoder, double *values);
+bool seek_trajectory_row (TrajectoryDecoder *decoder, uint64_t row);
+void close_trajectory_decoder (TrajectoryDecoder **p_decoder);
+bool compress_trajectory (Trajectory *trajectory, char *path);
+bool decompress_trajectory (char *path, char *csv_path);
+bool check_trajectory (char *path, uint32_t columns);
+
+#endif
@@ -0,0 +1,21 @@
+#include "vec3.h"
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+Field3 get_default_field ()
+{
+  return get_tilted_field (0, 0);
+}
+
+/* Rotates E about the beam (z) axis away from y and B about the same axis
+ * away from -x, both angles in radians. */
+Field3 get_tilted_field (double e_tilt, double b_tilt)
+{
+  Field3 field;
+  field.e = vec3 (-E * sin (e_tilt), E * cos (e_tilt), 0);
+  field.b = vec3 (-B * cos (b_tilt), -B * sin (b_tilt), 0);
+  field.map = NULL;
+  return field;
+}
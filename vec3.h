@@ -0,0 +1,55 @@
+#ifndef VEC3_H
+#define VEC3_H
+
+#include "structs.h"
+
+/* Three dimensional vector padded to four doubles, so a Vec3 fills exactly
+ * one 256 bit vector register and never straddles a cache line. */
+typedef struct Vec3
+{
+    double _x, _y, _z, _pad;
+} __attribute__ ((aligned (32))) Vec3;
+
+/* Fields of arbitrary orientation. With no map they are uniform; the 2D
+ * code path corresponds to e = (0, E, 0) and b = (-B, 0, 0). When map is
+ * set, e and b are ignored and the fields are interpolated from it. */
+typedef struct Field3
+{
+    Vec3 e, b;
+    const struct FieldMap *map;
+}Field3;
+
+static inline Vec3 vec3 (double x, double y, double z)
+{
+  Vec3 ret = {x, y, z, 0};
+  return ret;
+}
+
+static inline Vec3 add_vec3 (Vec3 first, Vec3 second)
+{
+  return vec3 (first._x + second._x, first._y + second._y,
+               first._z + second._z);
+}
+
+static inline Vec3 scale_vec3 (Vec3 vec, double n)
+{
+  return vec3 (vec._x * n, vec._y * n, vec._z * n);
+}
+
+static inline Vec3 cross_vec3 (Vec3 first, Vec3 second)
+{
+  return vec3 (first._y * second._z - first._z * second._y,
+               first._z * second._x - first._x * second._z,
+               first._x * second._y - first._y * second._x);
+}
+
+/* Lorentz acceleration (q / m) (e + v x b). */
+static inline Vec3 get_a_3d (Vec3 v, const Field3 *field)
+{
+  return scale_vec3 (add_vec3 (field->e, cross_vec3 (v, field->b)), q / m);
+}
+
+Field3 get_default_field ();
+Field3 get_tilted_field (double e_tilt, double b_tilt);
+
+#endif
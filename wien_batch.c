@@ -0,0 +1,228 @@
+#include "wien_batch.h"
+
+#define WIEN_BATCH_PARTICLES 10000
+#define WIEN_BATCH_CSV "../csv_files/wien_batch.csv"
+#define WIEN_BATCH_VALIDATION_CSV "../csv_files/wien_batch_validation.csv"
+#define BATCH_HEADERS "particle,species,did_exit,steps,r_y,r_z,v_y,v_z\n"
+#define BATCH_ROW "%zu,%u,%d,%u,%lf,%lf,%lf,%lf\n"
+#define BATCH_3D_HEADERS "particle,species,did_exit,steps,r_x,r_y,r_z,v_x,"\
+"v_y,v_z\n"
+#define BATCH_3D_ROW "%zu,%u,%d,%u,%lf,%lf,%lf,%lf,%lf,%lf\n"
+#define VALIDATION_HEADERS "particle,did_exit,ref_did_exit,steps,ref_steps,"\
+"dev_r,dev_v\n"
+#define VALIDATION_ROW "%zu,%d,%d,%u,%u,%e,%e\n"
+#define SUMMARY_HEADERS "particles,exited\n"
+#define SUMMARY_ROW "%zu,%zu\n"
+#define SPECIES_HEADERS "species,charge,mass,particles,exited,transmission,"\
+"std_err\n"
+#define SPECIES_ROW "%u,%g,%g,%zu,%zu,%.17g,%.17g\n"
+#define VALIDATION_SUMMARY_HEADERS "particles,max_dev_r,max_dev_v,"\
+"outcome_mismatches\n"
+#define VALIDATION_SUMMARY_ROW "%zu,%e,%e,%zu\n"
+#define WRITE_MODE "w"
+
+/* The single species of q and m, for runs given no mix. */
+static const Species DEFAULT_SPECIES = {q, m, 1};
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool validate_wien_batch (Batch *batch, Batch *reference, char *path);
+void get_species_mix (const Species **species, unsigned int
+*num_of_species);
+unsigned int draw_species (const double *cdf, unsigned int num_of_species);
+void print_species_stats (Batch *batch, const Species *species, unsigned int
+num_of_species);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* A mix of species runs as one batch. T is the period of q / m, so the
+ * step is rescaled to DIVISION_CONST steps of the fastest gyration of the
+ * mix. */
+bool export_wien_batch (Method method, double T, Precision precision,
+                        bool validate, const Field3 *field,
+                        const Species *species, unsigned int num_of_species)
+{
+  get_species_mix (&species, &num_of_species);
+  double max_qm = get_max_species_qm (species, num_of_species);
+  if (!(max_qm > 0))
+  { return false; }
+  double Dt = (T / DIVISION_CONST) * (q / m) / max_qm;
+  Batch *(*alloc) (size_t) = field ? alloc_batch_3d : alloc_batch;
+  Batch *batch = alloc (WIEN_BATCH_PARTICLES);
+  Batch *reference = validate ? alloc (WIEN_BATCH_PARTICLES) : NULL;
+  if (!batch || (validate && !reference))
+  {
+    free_batch (&batch);
+    free_batch (&reference);
+    return false;
+  }
+  init_wien_batch (batch, species, num_of_species);
+
+  bool ret;
+  if (validate)
+  {
+    copy_batch (reference, batch);
+    ret = run_batch (reference, method, Dt, DOUBLE_PRECISION, field)
+          && run_batch (batch, method, Dt, precision, field)
+          && validate_wien_batch (batch, reference, WIEN_BATCH_VALIDATION_CSV);
+  }
+  else
+  {
+    ret = run_batch (batch, method, Dt, precision, field)
+          && print_wien_batch (batch, species, num_of_species,
+                               WIEN_BATCH_CSV);
+  }
+  free_batch (&batch);
+  free_batch (&reference);
+  return ret;
+}
+
+/* Every particle draws its species by share, so the species interleave
+ * within the tiles rather than filling tiles of their own. */
+void init_wien_batch (Batch *batch, const Species *species, unsigned int
+num_of_species)
+{
+  get_species_mix (&species, &num_of_species);
+  double cdf[MAX_SPECIES], total = 0;
+  for (unsigned int i = 0; i < num_of_species; ++i)
+  {
+    total += species[i].share;
+    cdf[i] = total;
+  }
+  for (unsigned int i = 0; i < num_of_species; ++i)
+  {
+    cdf[i] /= total;
+  }
+  srand (time (NULL));
+  for (size_t i = 0; i < batch->size; ++i)
+  {
+    unsigned int s = draw_species (cdf, num_of_species);
+    batch->species[i] = (unsigned char) s;
+    batch->qm[i] = get_species_qm (&species[s]);
+    batch->r_y[i] = get_rand_double (R);
+    batch->r_z[i] = 0;
+    batch->v_y[i] = get_rand_double (V);
+    batch->v_z[i] = E / B;
+    if (batch->r_x)
+    {
+      batch->r_x[i] = 0;
+      batch->v_x[i] = 0;
+    }
+  }
+}
+
+bool print_wien_batch (Batch *batch, const Species *species, unsigned int
+num_of_species, char *path)
+{
+  FILE *f = fopen (path, WRITE_MODE);
+  if (!f)
+  { return false; }
+  size_t exited = 0;
+  fprintf (f, batch->r_x ? BATCH_3D_HEADERS : BATCH_HEADERS);
+  for (size_t i = 0; i < batch->size; ++i)
+  {
+    if (batch->r_x)
+    {
+      fprintf (f, BATCH_3D_ROW, i, batch->species[i], batch->did_exit[i],
+               batch->steps[i], batch->r_x[i], batch->r_y[i], batch->r_z[i],
+               batch->v_x[i], batch->v_y[i], batch->v_z[i]);
+    }
+    else
+    {
+      fprintf (f, BATCH_ROW, i, batch->species[i], batch->did_exit[i],
+               batch->steps[i], batch->r_y[i], batch->r_z[i], batch->v_y[i],
+               batch->v_z[i]);
+    }
+    exited += batch->did_exit[i];
+  }
+  fclose (f);
+  fprintf (stdout, SUMMARY_HEADERS);
+  fprintf (stdout, SUMMARY_ROW, batch->size, exited);
+  get_species_mix (&species, &num_of_species);
+  print_species_stats (batch, species, num_of_species);
+  return true;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+bool validate_wien_batch (Batch *batch, Batch *reference, char *path)
+{
+  FILE *f = fopen (path, WRITE_MODE);
+  if (!f)
+  { return false; }
+  double max_dev_r = 0;
+  double max_dev_v = 0;
+  size_t mismatches = 0;
+  fprintf (f, VALIDATION_HEADERS);
+  for (size_t i = 0; i < batch->size; ++i)
+  {
+    double dev_r = hypot (batch->r_y[i] - reference->r_y[i],
+                          batch->r_z[i] - reference->r_z[i]);
+    double dev_v = hypot (batch->v_y[i] - reference->v_y[i],
+                          batch->v_z[i] - reference->v_z[i]);
+    if (batch->r_x)
+    {
+      dev_r = hypot (dev_r, batch->r_x[i] - reference->r_x[i]);
+      dev_v = hypot (dev_v, batch->v_x[i] - reference->v_x[i]);
+    }
+    fprintf (f, VALIDATION_ROW, i, batch->did_exit[i], reference->did_exit[i],
+             batch->steps[i], reference->steps[i], dev_r, dev_v);
+    max_dev_r = fmax (max_dev_r, dev_r);
+    max_dev_v = fmax (max_dev_v, dev_v);
+    mismatches += batch->did_exit[i] != reference->did_exit[i]
+                  || batch->steps[i] != reference->steps[i];
+  }
+  fclose (f);
+  fprintf (stdout, VALIDATION_SUMMARY_HEADERS);
+  fprintf (stdout, VALIDATION_SUMMARY_ROW, batch->size, max_dev_r, max_dev_v,
+           mismatches);
+  return true;
+}
+
+void get_species_mix (const Species **species, unsigned int
+*num_of_species)
+{
+  if (!*species || !*num_of_species)
+  {
+    *species = &DEFAULT_SPECIES;
+    *num_of_species = 1;
+  }
+}
+
+unsigned int draw_species (const double *cdf, unsigned int num_of_species)
+{
+  double u = (double) rand () / ((double) RAND_MAX + 1);
+  unsigned int s = 0;
+  while (s + 1 < num_of_species && cdf[s] <= u)
+  {
+    ++s;
+  }
+  return s;
+}
+
+/* Transmission of every species with its binomial standard error. */
+void print_species_stats (Batch *batch, const Species *species, unsigned int
+num_of_species)
+{
+  size_t particles[MAX_SPECIES] = {0}, exited[MAX_SPECIES] = {0};
+  for (size_t i = 0; i < batch->size; ++i)
+  {
+    particles[batch->species[i]]++;
+    exited[batch->species[i]] += batch->did_exit[i];
+  }
+  fprintf (stdout, SPECIES_HEADERS);
+  for (unsigned int s = 0; s < num_of_species; ++s)
+  {
+    double n = (double) particles[s];
+    double p = particles[s] ? exited[s] / n : 0;
+    double std_err = particles[s] ? sqrt (p * (1 - p) / n) : 0;
+    fprintf (stdout, SPECIES_ROW, s, species[s].charge, species[s].mass,
+             particles[s], exited[s], p, std_err);
+  }
+}
@@ -0,0 +1,15 @@
+#ifndef WIEN_BATCH_H
+#define WIEN_BATCH_H
+
+#include "wien_filter.h"
+#include "batch.h"
+
+bool export_wien_batch (Method method, double T, Precision precision,
+                        bool validate, const Field3 *field,
+                        const Species *species, unsigned int num_of_species);
+void init_wien_batch (Batch *batch, const Species *species, unsigned int
+num_of_species);
+bool print_wien_batch (Batch *batch, const Species *species, unsigned int
+num_of_species, char *path);
+
+#endif
@@ -0,0 +1,268 @@
+#include "wien_boundary.h"
+
+#define BOUNDARY_CSV "../csv_files/wien_boundary.csv"
+#define WRITE_MODE "w"
+#define BOUNDARY_HEADERS "angle,Dr_y,Dv_y\n"
+#define BOUNDARY_ROW "%.17g,%.17g,%.17g\n"
+#define SUMMARY_HEADERS "points,integrations,resolution,area,acceptance\n"
+#define SUMMARY_ROW "%zu,%zu,%g,%.17g,%.17g\n"
+
+/* The rays of one round, traced by whichever worker takes them. */
+typedef struct RayRound
+{
+    WienBoundary *boundary;
+    BoundaryRay *rays;
+}RayRound;
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool get_outcome (WienBoundary *boundary, double Dr_y, double Dv_y);
+double bisect_edge (WienBoundary *boundary, double x, double y, double
+s_max);
+double find_v_edge (WienBoundary *boundary);
+void trace_rays (size_t begin, size_t end, void *ctx);
+bool add_rays (WienBoundary *boundary, const double *angles, size_t
+num_of_angles);
+size_t get_gap_angles (WienBoundary *boundary, double *angles);
+Vec get_ray_point (const BoundaryRay *ray);
+double get_ray_s_max (double angle);
+int compare_rays (const void *first, const void *sec);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* The region of exiting starts is star shaped around Dr = Dv = 0, which
+ * drifts straight through, so along every ray from there the outcome flips
+ * once and bisection finds where. The Dv_y axis is bisected first to size
+ * the square to the region, which is far narrower than V. The rays of one
+ * round are independent and spread over the cores. */
+bool trace_wien_boundary (Method method, double T, double resolution,
+                          WienBoundary *boundary)
+{
+  *boundary = (WienBoundary) {method, T / DIVISION_CONST, V, resolution};
+  if (!(resolution > 0) || resolution >= 1 || !get_outcome (boundary, 0, 0))
+  { return false; }
+  boundary->v_span = fmin (2 * find_v_edge (boundary), V);
+
+  double angles[BOUNDARY_RAYS + 1];
+  for (int i = 0; i <= BOUNDARY_RAYS; ++i)
+  {
+    angles[i] = (M_PI / 2) * i / BOUNDARY_RAYS;
+  }
+  size_t num_of_angles = BOUNDARY_RAYS + 1;
+  double *gaps = NULL;
+  for (int round = 0; round < BOUNDARY_ROUNDS && num_of_angles; ++round)
+  {
+    if (!add_rays (boundary, gaps ? gaps : angles, num_of_angles))
+    {
+      free (gaps);
+      free_wien_boundary (boundary);
+      return false;
+    }
+    free (gaps);
+    gaps = malloc (boundary->size * sizeof (double));
+    if (!gaps)
+    {
+      free_wien_boundary (boundary);
+      return false;
+    }
+    num_of_angles = get_gap_angles (boundary, gaps);
+  }
+  free (gaps);
+
+  /* Shoelace over the origin and the boundary points in angle order. */
+  double area = 0;
+  for (size_t i = 0; i + 1 < boundary->size; ++i)
+  {
+    Vec first = get_ray_point (&boundary->rays[i]);
+    Vec sec = get_ray_point (&boundary->rays[i + 1]);
+    area += (first._y * sec._z - sec._y * first._z) / 2;
+  }
+  boundary->area = area * R * boundary->v_span;
+  boundary->acceptance = boundary->area / (R * V);
+  return true;
+}
+
+void free_wien_boundary (WienBoundary *boundary)
+{
+  free (boundary->rays);
+  boundary->rays = NULL;
+  boundary->size = 0;
+}
+
+bool export_wien_boundary (Method method, double T, double resolution)
+{
+  WienBoundary boundary;
+  if (!trace_wien_boundary (method, T, resolution, &boundary))
+  { return false; }
+  FILE *f = fopen (BOUNDARY_CSV, WRITE_MODE);
+  if (!f)
+  {
+    free_wien_boundary (&boundary);
+    return false;
+  }
+  fprintf (f, BOUNDARY_HEADERS);
+  for (size_t i = 0; i < boundary.size; ++i)
+  {
+    Vec point = get_ray_point (&boundary.rays[i]);
+    fprintf (f, BOUNDARY_ROW, boundary.rays[i].angle, point._y * R,
+             point._z * boundary.v_span);
+  }
+  fprintf (stdout, SUMMARY_HEADERS);
+  fprintf (stdout, SUMMARY_ROW, boundary.size,
+           atomic_load (&boundary.integrations), resolution, boundary.area,
+           boundary.acceptance);
+  free_wien_boundary (&boundary);
+  return !fclose (f);
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+bool get_outcome (WienBoundary *boundary, double Dr_y, double Dv_y)
+{
+  Vec Dr = {Dr_y, 0}, Dv = {Dv_y, 0};
+  bool did_exit = false;
+  if (boundary->method == GUIDING_CENTRE)
+  {
+    RkState start = {0, Dr, {Dv_y, E / B}}, last;
+    run_guiding_centre (&DEFAULT_ETD_PHYSICS, &start,
+                        get_gc_Dt (&DEFAULT_ETD_PHYSICS, LENGTH), LENGTH, R,
+                        GC_MAX_STEPS, &last, &did_exit);
+    atomic_fetch_add (&boundary->integrations, 1);
+    return did_exit;
+  }
+  StateIterator iterator;
+  init_state_iterator (&iterator, get_wien_starting_conditions (&Dr, &Dv),
+                       get_method (boundary->method), boundary->Dt,
+                       NO_STEP_BUDGET);
+  set_iterator_stop (&iterator, check_for_wien_stop, &did_exit);
+  while (next_state (&iterator))
+  {}
+  if (iterator.failed)
+  { atomic_store (&boundary->failed, true); }
+  free_state_iterator (&iterator);
+  atomic_fetch_add (&boundary->integrations, 1);
+  return did_exit;
+}
+
+/* Distance along the normalised direction (x, y) where starts stop
+ * exiting, to BISECTION_SHARE of the resolution; s_max if they still
+ * exit there. */
+double bisect_edge (WienBoundary *boundary, double x, double y, double
+s_max)
+{
+  double v_span = boundary->v_span;
+  if (get_outcome (boundary, s_max * x * R, s_max * y * v_span))
+  { return s_max; }
+  double low = 0, high = s_max;
+  double tolerance = BISECTION_SHARE * boundary->resolution;
+  while (high - low > tolerance && !atomic_load (&boundary->failed))
+  {
+    double mid = (low + high) / 2;
+    if (get_outcome (boundary, mid * x * R, mid * y * v_span))
+    { low = mid; }
+    else
+    { high = mid; }
+  }
+  return (low + high) / 2;
+}
+
+/* Where starts on the Dv_y axis stop exiting, to BISECTION_SHARE of the
+ * resolution relative to the edge itself: halving from V brackets it
+ * first, whatever its scale. */
+double find_v_edge (WienBoundary *boundary)
+{
+  double high = V;
+  while (!get_outcome (boundary, 0, high / 2)
+         && !atomic_load (&boundary->failed))
+  {
+    high /= 2;
+  }
+  double low = high / 2;
+  double tolerance = BISECTION_SHARE * boundary->resolution * low;
+  while (high - low > tolerance && !atomic_load (&boundary->failed))
+  {
+    double mid = (low + high) / 2;
+    if (get_outcome (boundary, 0, mid))
+    { low = mid; }
+    else
+    { high = mid; }
+  }
+  return (low + high) / 2;
+}
+
+void trace_rays (size_t begin, size_t end, void *ctx)
+{
+  RayRound *round = ctx;
+  WienBoundary *boundary = round->boundary;
+  for (size_t i = begin; i < end; ++i)
+  {
+    BoundaryRay *ray = &round->rays[i];
+    ray->s = bisect_edge (boundary, cos (ray->angle), sin (ray->angle),
+                          get_ray_s_max (ray->angle));
+  }
+}
+
+/* Traces the new rays in parallel and merges them in angle order. */
+bool add_rays (WienBoundary *boundary, const double *angles, size_t
+num_of_angles)
+{
+  size_t size = boundary->size;
+  BoundaryRay *rays = realloc (boundary->rays, (size + num_of_angles)
+                                               * sizeof (BoundaryRay));
+  if (!rays)
+  { return false; }
+  boundary->rays = rays;
+  for (size_t i = 0; i < num_of_angles; ++i)
+  {
+    rays[size + i] = (BoundaryRay) {angles[i], 0};
+  }
+  RayRound round = {boundary, rays + size};
+  bool ret = steal_for (num_of_angles, 1, trace_rays, &round)
+             && !atomic_load (&boundary->failed);
+  boundary->size = size + num_of_angles;
+  qsort (rays, boundary->size, sizeof (BoundaryRay), compare_rays);
+  return ret;
+}
+
+/* The midpoint angles of neighbours whose boundary points are more than
+ * the resolution apart. */
+size_t get_gap_angles (WienBoundary *boundary, double *angles)
+{
+  size_t num_of_angles = 0;
+  for (size_t i = 0; i + 1 < boundary->size; ++i)
+  {
+    Vec first = get_ray_point (&boundary->rays[i]);
+    Vec sec = get_ray_point (&boundary->rays[i + 1]);
+    if (get_dist (&first, &sec) > boundary->resolution)
+    {
+      angles[num_of_angles++] = (boundary->rays[i].angle
+                                 + boundary->rays[i + 1].angle) / 2;
+    }
+  }
+  return num_of_angles;
+}
+
+/* The boundary point of a ray in the normalised square. */
+Vec get_ray_point (const BoundaryRay *ray)
+{
+  return (Vec) {ray->s * cos (ray->angle), ray->s * sin (ray->angle)};
+}
+
+/* Where the ray leaves the unit square. */
+double get_ray_s_max (double angle)
+{
+  return 1 / fmax (cos (angle), sin (angle));
+}
+
+int compare_rays (const void *first, const void *sec)
+{
+  double a = ((const BoundaryRay *) first)->angle;
+  double b = ((const BoundaryRay *) sec)->angle;
+  return (a > b) - (a < b);
+}
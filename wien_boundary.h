@@ -0,0 +1,40 @@
+#ifndef WIEN_BOUNDARY_H
+#define WIEN_BOUNDARY_H
+
+#include "wien_filter.h"
+#include "log_log_errors.h"
+
+#define BOUNDARY_RAYS 16
+#define BOUNDARY_ROUNDS 12
+#define DEFAULT_RESOLUTION 0.01
+#define BISECTION_SHARE 0.1
+
+/* One ray from the origin of the normalised (Dr_y / R, Dv_y / v_span)
+ * square, and the distance along it at which starts stop exiting. */
+typedef struct BoundaryRay
+{
+    double angle, s;
+}BoundaryRay;
+
+/* The acceptance boundary traced by bisecting along rays. Rays are added
+ * between neighbours whose boundary points are further apart than the
+ * resolution, so the polyline follows the edge where it bends. v_span is
+ * the Dv_y range the square covers, area the acceptance area in (Dr_y,
+ * Dv_y) and acceptance its share of [0, R] x [0, V]. */
+typedef struct WienBoundary
+{
+    Method method;
+    double Dt, v_span, resolution;
+    BoundaryRay *rays;
+    size_t size;
+    atomic_size_t integrations;
+    atomic_bool failed;
+    double area, acceptance;
+}WienBoundary;
+
+bool trace_wien_boundary (Method method, double T, double resolution,
+                          WienBoundary *boundary);
+void free_wien_boundary (WienBoundary *boundary);
+bool export_wien_boundary (Method method, double T, double resolution);
+
+#endif
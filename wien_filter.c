@@ -7,36 +7,52 @@
 /******************************************/
 
 int get_rand (int max);
-double get_rand_double (double max_val);
+void print_exit_row (FILE *f, const WriterRow *row);
+void run_gc_particles (WienScan *scan, size_t begin, size_t end);
 
 /***********************************************/
 /*        H FUNCTIONS IMPLEMENTATIONS          */
 /***********************************************/
 
-bool export_wien_filter (Method method, double T)
+/* A particle that hits the plates stops after a few steps while one that
+ * is transmitted runs the whole LENGTH, so the particles are spread over
+ * the cores by steal_for rather than in fixed slices. The starts are still
+ * drawn serially from rand, and exits are printed in particle order. */
+bool export_wien_filter (Method method, double T, size_t particles)
 {
   srand (time (NULL));
-  int particles = pow (10, 1);
-  FILE *f = fopen ("../csv_files/test.csv", "w");
-  fprintf (stdout, "iteration,v_y,v_z\n");
-
-  for (int i = 0; i < particles; ++i)
+  WienScan scan;
+  if (!alloc_wien_scan (&scan, method, T / DIVISION_CONST, particles))
+  { return false; }
+  for (size_t i = 0; i < particles; ++i)
   {
-    Vec Dr = {get_rand_double (R), 0};
-    Vec Dv = {get_rand_double (V), 0};
-    bool did_exit;
-    Timeline *wien_timeline = create_wien_time_line(DIVISION_CONST, T,
-                                                    get_method(method), &Dr,
-                                                    &Dv, &did_exit);
-    if(!wien_timeline) { return NULL; }
+    scan.Dr[i] = (Vec) {get_rand_double (R), 0};
+    scan.Dv[i] = (Vec) {get_rand_double (V), 0};
+  }
+  if (!steal_for (particles, 0, run_wien_particles, &scan)
+      || atomic_load (&scan.failed))
+  {
+    free_wien_scan (&scan);
+    return false;
+  }
 
-    if (did_exit)
+  fprintf (stdout, "iteration,v_y,v_z\n");
+  AsyncWriter *writer = open_async_writer (stdout, false, print_exit_row);
+  if (!writer)
+  {
+    free_wien_scan (&scan);
+    return false;
+  }
+  for (size_t i = 0; i < particles; ++i)
+  {
+    if (scan.did_exit[i])
     {
-      fprintf (stdout, "%d,%lf,%lf\n", i, wien_timeline->last->v->_y, wien_timeline->last->v->_z);
+      WriterRow row = {i, {scan.v_exit[i]._y, scan.v_exit[i]._z}};
+      push_row (writer, &row);
     }
-
   }
-  return true;
+  free_wien_scan (&scan);
+  return close_async_writer (&writer);
 }
 
 /***************************/
@@ -56,4 +72,84 @@ double get_rand_double (double max_val)
     return 0.f;
   }
   return max_val/rand_int;
-}
\ No newline at end of file
+}
+
+void print_exit_row (FILE *f, const WriterRow *row)
+{
+  fprintf (f, "%zu,%lf,%lf\n", row->index, row->values[0], row->values[1]);
+}
+
+bool alloc_wien_scan (WienScan *scan, Method method, double Dt, size_t
+particles)
+{
+  *scan = (WienScan) {method, Dt,
+                      alloc_first_touch (particles, sizeof (Vec)),
+                      alloc_first_touch (particles, sizeof (Vec)),
+                      alloc_first_touch (particles, sizeof (Vec)),
+                      alloc_first_touch (particles, sizeof (bool)), false};
+  if (!scan->Dr || !scan->Dv || !scan->v_exit || !scan->did_exit)
+  {
+    free_wien_scan (scan);
+    return false;
+  }
+  return true;
+}
+
+void run_wien_particles (size_t begin, size_t end, void *ctx)
+{
+  WienScan *scan = ctx;
+  if (scan->method == GUIDING_CENTRE)
+  {
+    run_gc_particles (scan, begin, end);
+    return;
+  }
+  NEXT_STEP_METHOD *next_step_method = get_method (scan->method);
+  for (size_t i = begin; i < end; ++i)
+  {
+    bool did_exit = false;
+    StateIterator iterator;
+    init_state_iterator (&iterator, get_wien_starting_conditions
+                         (&scan->Dr[i], &scan->Dv[i]), next_step_method,
+                         scan->Dt, NO_STEP_BUDGET);
+    set_iterator_stop (&iterator, check_for_wien_stop, &did_exit);
+    while (next_state (&iterator))
+    {}
+    if (iterator.failed)
+    {
+      atomic_store (&scan->failed, true);
+    }
+    else
+    {
+      scan->did_exit[i] = did_exit;
+      scan->v_exit[i] = *iterator.curr->v;
+    }
+    free_state_iterator (&iterator);
+  }
+}
+
+/* The guiding centre keeps to a step set by the drift instead of the
+ * scan's Dt, and reconstructs the full orbit only where its ring reaches
+ * the plate or the exit, so the outcome is that of the full orbit. One
+ * still inside after GC_MAX_STEPS steps counts as not exiting. */
+void run_gc_particles (WienScan *scan, size_t begin, size_t end)
+{
+  double Dt = get_gc_Dt (&DEFAULT_ETD_PHYSICS, LENGTH);
+  for (size_t i = begin; i < end; ++i)
+  {
+    RkState start = {0, scan->Dr[i],
+                     {scan->Dv[i]._y, E / B + scan->Dv[i]._z}}, last;
+    bool did_exit = false;
+    run_guiding_centre (&DEFAULT_ETD_PHYSICS, &start, Dt, LENGTH, R,
+                        GC_MAX_STEPS, &last, &did_exit);
+    scan->did_exit[i] = did_exit;
+    scan->v_exit[i] = last.v;
+  }
+}
+
+void free_wien_scan (WienScan *scan)
+{
+  free (scan->Dr);
+  free (scan->Dv);
+  free (scan->v_exit);
+  free (scan->did_exit);
+}
@@ -2,9 +2,31 @@
 #define WIEN_FILTER_H
 
 #include "wien_timeline.h"
+#include "async_writer.h"
+#include "parallel.h"
+#include "guiding_centre.h"
+#include <stdatomic.h>
 #include <time.h>
 #include <math.h>
 
-bool export_wien_filter (Method method, double T);
+#define WIEN_FILTER_PARTICLES 10
+
+/* One Monte Carlo run: starts drawn up front, outcomes filled in by
+ * whichever worker ends up integrating each particle. */
+typedef struct WienScan
+{
+    Method method;
+    double Dt;
+    Vec *Dr, *Dv, *v_exit;
+    bool *did_exit;
+    atomic_bool failed;
+}WienScan;
+
+bool export_wien_filter (Method method, double T, size_t particles);
+double get_rand_double (double max_val);
+bool alloc_wien_scan (WienScan *scan, Method method, double Dt, size_t
+particles);
+void run_wien_particles (size_t begin, size_t end, void *ctx);
+void free_wien_scan (WienScan *scan);
 
 #endif
\ No newline at end of file
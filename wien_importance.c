@@ -0,0 +1,260 @@
+#include "wien_importance.h"
+
+#define IMPORTANCE_CSV "../csv_files/wien_importance.csv"
+#define WRITE_MODE "w"
+#define PARTICLE_HEADERS "iteration,Dr_y,Dv_y,weight,did_exit\n"
+#define PARTICLE_ROW "%zu,%.17g,%.17g,%.17g,%d\n"
+#define SUMMARY_HEADERS "estimator,particles,transmission,std_err\n"
+#define SUMMARY_ROW "%s,%zu,%.17g,%.17g\n"
+#define GAIN_HEADERS "variance_ratio,ess\n"
+#define GAIN_ROW "%.6g,%.6g\n"
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool run_importance_pilot (Method method, double Dt, size_t particles,
+                           Rng *rng, Proposal *proposal,
+                           ImportanceEstimate *estimate);
+void adapt_proposal (const size_t *drawn, const size_t *passed, Proposal
+*proposal);
+void init_proposal (Proposal *proposal);
+void get_cell_bounds (int cell, double *r_low, double *r_high, double
+*v_low, double *v_high);
+double get_v_edge (int bin);
+void draw_in_cell (int cell, Rng *rng, Vec *Dr, Vec *Dv);
+int draw_proposal_cell (const Proposal *proposal, Rng *rng);
+bool run_importance_scan (WienScan *scan, size_t particles);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* The target is uniform over [0, R] x [0, V]. A pilot of particles /
+ * PILOT_SHARE, but at least one particle per cell, stratified evenly over
+ * the cells, measures the transmission of every cell, and the main run
+ * draws from a proposal that puts its particles where particles are
+ * transmitted, instead of deep in the region that hits the plates. Each
+ * particle carries the weight target / proposal of its cell, so the
+ * weighted mean stays an unbiased estimate of the uniform transmission.
+ * f, when not NULL, receives every main run particle with its weight. */
+bool run_wien_importance (Method method, double T, size_t particles,
+                          uint64_t seed, FILE *f,
+                          ImportanceEstimate *estimate)
+{
+  size_t pilot_particles = particles / PILOT_SHARE;
+  if (pilot_particles < IMPORTANCE_CELLS)
+  { pilot_particles = IMPORTANCE_CELLS; }
+  if (!particles)
+  { return false; }
+  double Dt = T / DIVISION_CONST;
+  Rng rng;
+  seed_rng (&rng, seed);
+  Proposal proposal;
+  if (!run_importance_pilot (method, Dt, pilot_particles, &rng, &proposal,
+                             estimate))
+  { return false; }
+
+  WienScan scan;
+  double *weights = malloc (particles * sizeof (double));
+  if (!weights || !alloc_wien_scan (&scan, method, Dt, particles))
+  {
+    free (weights);
+    return false;
+  }
+  for (size_t i = 0; i < particles; ++i)
+  {
+    int cell = draw_proposal_cell (&proposal, &rng);
+    draw_in_cell (cell, &rng, &scan.Dr[i], &scan.Dv[i]);
+    weights[i] = proposal.target[cell] / proposal.mass[cell];
+  }
+  if (!run_importance_scan (&scan, particles))
+  {
+    free (weights);
+    return false;
+  }
+
+  double sum = 0, sum_sq = 0, weight_sum = 0, weight_sum_sq = 0;
+  if (f)
+  { fprintf (f, PARTICLE_HEADERS); }
+  for (size_t i = 0; i < particles; ++i)
+  {
+    double value = scan.did_exit[i] ? weights[i] : 0;
+    sum += value;
+    sum_sq += value * value;
+    weight_sum += weights[i];
+    weight_sum_sq += weights[i] * weights[i];
+    if (f)
+    {
+      fprintf (f, PARTICLE_ROW, i, scan.Dr[i]._y, scan.Dv[i]._y, weights[i],
+               scan.did_exit[i]);
+    }
+  }
+  free_wien_scan (&scan);
+  free (weights);
+
+  double n = (double) particles;
+  double mean = sum / n;
+  double variance = (sum_sq - n * mean * mean) / (n - 1);
+  estimate->particles = particles;
+  estimate->transmission = mean;
+  estimate->std_err = sqrt (fmax (variance, 0) / n);
+  estimate->ess = weight_sum * weight_sum / weight_sum_sq;
+  estimate->variance_ratio = variance > 0 ? mean * (1 - mean) / variance
+                                          : INFINITY;
+  return true;
+}
+
+bool export_wien_importance (Method method, double T, size_t particles,
+                             uint64_t seed)
+{
+  FILE *f = fopen (IMPORTANCE_CSV, WRITE_MODE);
+  if (!f)
+  { return false; }
+  ImportanceEstimate estimate;
+  bool ret = run_wien_importance (method, T, particles, seed, f, &estimate);
+  if (fclose (f) || !ret)
+  { return false; }
+  fprintf (stdout, SUMMARY_HEADERS);
+  fprintf (stdout, SUMMARY_ROW, "pilot", estimate.pilot_particles,
+           estimate.pilot_transmission, estimate.pilot_std_err);
+  fprintf (stdout, SUMMARY_ROW, "importance", estimate.particles,
+           estimate.transmission, estimate.std_err);
+  fprintf (stdout, GAIN_HEADERS);
+  fprintf (stdout, GAIN_ROW, estimate.variance_ratio, estimate.ess);
+  return true;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+bool run_importance_pilot (Method method, double Dt, size_t particles,
+                           Rng *rng, Proposal *proposal,
+                           ImportanceEstimate *estimate)
+{
+  WienScan scan;
+  if (!alloc_wien_scan (&scan, method, Dt, particles))
+  { return false; }
+  for (size_t i = 0; i < particles; ++i)
+  {
+    draw_in_cell (i % IMPORTANCE_CELLS, rng, &scan.Dr[i], &scan.Dv[i]);
+  }
+  if (!run_importance_scan (&scan, particles))
+  { return false; }
+  size_t drawn[IMPORTANCE_CELLS] = {0}, passed[IMPORTANCE_CELLS] = {0};
+  for (size_t i = 0; i < particles; ++i)
+  {
+    drawn[i % IMPORTANCE_CELLS]++;
+    passed[i % IMPORTANCE_CELLS] += scan.did_exit[i];
+  }
+  free_wien_scan (&scan);
+
+  init_proposal (proposal);
+  double mean = 0, variance = 0;
+  for (int i = 0; i < IMPORTANCE_CELLS; ++i)
+  {
+    double f = (double) passed[i] / drawn[i];
+    mean += proposal->target[i] * f;
+    variance += pow (proposal->target[i], 2) * f * (1 - f) / drawn[i];
+  }
+  estimate->pilot_particles = particles;
+  estimate->pilot_transmission = mean;
+  estimate->pilot_std_err = sqrt (variance);
+  adapt_proposal (drawn, passed, proposal);
+  return true;
+}
+
+/* The second moment sum (target^2 f / mass) of the weighted estimate,
+ * f the transmission of a cell, is least with the mass proportional to
+ * target sqrt (f), with f taken from the pilot. A DEFENSIVE_SHARE of the
+ * target itself keeps the cells the pilot saw no transmission in
+ * reachable, and bounds the weights by 1 / DEFENSIVE_SHARE. Without any
+ * transmission in the pilot the proposal stays the target. */
+void adapt_proposal (const size_t *drawn, const size_t *passed, Proposal
+*proposal)
+{
+  double score[IMPORTANCE_CELLS], total = 0;
+  for (int i = 0; i < IMPORTANCE_CELLS; ++i)
+  {
+    score[i] = proposal->target[i] * sqrt ((double) passed[i] / drawn[i]);
+    total += score[i];
+  }
+  if (total == 0)
+  { return; }
+  double running = 0;
+  for (int i = 0; i < IMPORTANCE_CELLS; ++i)
+  {
+    proposal->mass[i] = (1 - DEFENSIVE_SHARE) * score[i] / total
+                        + DEFENSIVE_SHARE * proposal->target[i];
+    running += proposal->mass[i];
+    proposal->cdf[i] = running;
+  }
+  proposal->cdf[IMPORTANCE_CELLS - 1] = 1;
+}
+
+/* Starts the proposal out as the target. */
+void init_proposal (Proposal *proposal)
+{
+  double running = 0;
+  for (int i = 0; i < IMPORTANCE_CELLS; ++i)
+  {
+    double r_low, r_high, v_low, v_high;
+    get_cell_bounds (i, &r_low, &r_high, &v_low, &v_high);
+    proposal->target[i] = ((r_high - r_low) / R) * ((v_high - v_low) / V);
+    proposal->mass[i] = proposal->target[i];
+    running += proposal->mass[i];
+    proposal->cdf[i] = running;
+  }
+  proposal->cdf[IMPORTANCE_CELLS - 1] = 1;
+}
+
+void get_cell_bounds (int cell, double *r_low, double *r_high, double
+*v_low, double *v_high)
+{
+  int bin_r = cell / IMPORTANCE_BINS, bin_v = cell % IMPORTANCE_BINS;
+  *r_low = ((double) R * bin_r) / IMPORTANCE_BINS;
+  *r_high = ((double) R * (bin_r + 1)) / IMPORTANCE_BINS;
+  *v_low = get_v_edge (bin_v);
+  *v_high = get_v_edge (bin_v + 1);
+}
+
+/* 0, then V 2^(bin - IMPORTANCE_BINS) up to V itself. */
+double get_v_edge (int bin)
+{
+  return bin ? ldexp (V, bin - IMPORTANCE_BINS) : 0;
+}
+
+void draw_in_cell (int cell, Rng *rng, Vec *Dr, Vec *Dv)
+{
+  double r_low, r_high, v_low, v_high;
+  get_cell_bounds (cell, &r_low, &r_high, &v_low, &v_high);
+  *Dr = (Vec) {r_low + get_rng_uniform (rng) * (r_high - r_low), 0};
+  *Dv = (Vec) {v_low + get_rng_uniform (rng) * (v_high - v_low), 0};
+}
+
+int draw_proposal_cell (const Proposal *proposal, Rng *rng)
+{
+  double u = get_rng_uniform (rng);
+  int low = 0, high = IMPORTANCE_CELLS - 1;
+  while (low < high)
+  {
+    int mid = (low + high) / 2;
+    if (proposal->cdf[mid] > u)
+    { high = mid; }
+    else
+    { low = mid + 1; }
+  }
+  return low;
+}
+
+bool run_importance_scan (WienScan *scan, size_t particles)
+{
+  if (!steal_for (particles, 0, run_wien_particles, scan)
+      || atomic_load (&scan->failed))
+  {
+    free_wien_scan (scan);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef WIEN_IMPORTANCE_H
+#define WIEN_IMPORTANCE_H
+
+#include "wien_filter.h"
+#include "rng.h"
+
+#define IMPORTANCE_BINS 16
+#define IMPORTANCE_CELLS (IMPORTANCE_BINS * IMPORTANCE_BINS)
+#define PILOT_SHARE 5
+#define DEFENSIVE_SHARE 0.1
+
+/* Piecewise constant proposal over the (Dr_y, Dv_y) rectangle [0, R] x
+ * [0, V], one cell per bin pair. The Dr_y bins are even; the Dv_y bins
+ * halve towards 0, where the transmitted particles are. target holds the
+ * uniform target's probability of each cell, mass the proposal's and cdf
+ * the running sum of mass, for drawing a cell by bisection. */
+typedef struct Proposal
+{
+    double target[IMPORTANCE_CELLS];
+    double mass[IMPORTANCE_CELLS];
+    double cdf[IMPORTANCE_CELLS];
+}Proposal;
+
+/* Transmission of the uniform target, estimated from the stratified pilot
+ * and by importance sampling from the adapted proposal. variance_ratio is
+ * the variance plain sampling would have at the main run's size over the
+ * variance actually achieved, and ess the effective sample size of the
+ * weights. */
+typedef struct ImportanceEstimate
+{
+    size_t pilot_particles, particles;
+    double pilot_transmission, pilot_std_err;
+    double transmission, std_err;
+    double variance_ratio, ess;
+}ImportanceEstimate;
+
+bool run_wien_importance (Method method, double T, size_t particles,
+                          uint64_t seed, FILE *f,
+                          ImportanceEstimate *estimate);
+bool export_wien_importance (Method method, double T, size_t particles,
+                             uint64_t seed);
+
+#endif
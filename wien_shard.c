@@ -0,0 +1,371 @@
+#include "wien_shard.h"
+
+#define SHARD_PATH_FORMAT "../csv_files/wien_shard_%u_of_%u.wsr"
+#define SUMMARY_CSV "../csv_files/wien_filter_summary.csv"
+#define HISTOGRAM_CSV "../csv_files/wien_filter_histogram.csv"
+#define SHARD_PATH_SIZE 64
+#define READ_MODE "rb"
+#define WRITE_MODE "wb"
+#define TEXT_WRITE_MODE "w"
+#define EXIT_HEADERS "iteration,v_y,v_z\n"
+#define EXIT_ROW "%llu,%lf,%lf\n"
+#define SUMMARY_HEADERS "particles,exited,hit,mean_v_y,mean_v_z,std_v_y,"\
+"std_v_z\n"
+#define SUMMARY_ROW "%llu,%llu,%llu,%.17g,%.17g,%.17g,%.17g\n"
+#define HISTOGRAM_HEADERS "v_y_low,v_y_high,count\n"
+#define HISTOGRAM_ROW "%lf,%lf,%llu\n"
+#define HISTOGRAM_V (E / B)
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+void draw_particle_start (uint64_t seed, uint64_t index, Vec *Dr, Vec *Dv);
+void get_shard_blocks (uint64_t particles, uint32_t shard,
+                       uint32_t num_of_shards, uint64_t *begin,
+                       uint64_t *end);
+void accumulate_block (ShardBlock *block, WienScan *scan, uint64_t first,
+                       uint64_t begin, uint64_t end);
+int get_histogram_bin (double v_y);
+bool check_shards (WienShard **shards, size_t num_of_shards);
+int compare_shards (const void *first, const void *sec);
+bool print_summary (WienShard **shards, size_t num_of_shards);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* Integrates the particles of the shard's blocks and keeps one accumulator
+ * per block plus the exit rows. */
+WienShard *run_wien_shard (Method method, double T, size_t particles,
+                           uint64_t seed, uint32_t shard,
+                           uint32_t num_of_shards)
+{
+  if (!num_of_shards || shard >= num_of_shards)
+  { return NULL; }
+  uint64_t block_begin, block_end;
+  get_shard_blocks (particles, shard, num_of_shards, &block_begin,
+                    &block_end);
+  uint64_t first = block_begin * SHARD_BLOCK;
+  uint64_t last = block_end * SHARD_BLOCK;
+  if (last > particles)
+  { last = particles; }
+  if (first > last)
+  { first = last; }
+  size_t count = last - first;
+
+  WienShard *wien_shard = calloc (1, sizeof (WienShard));
+  WienScan scan;
+  if (!wien_shard || !alloc_wien_scan (&scan, method, T / DIVISION_CONST,
+                                       count))
+  {
+    free (wien_shard);
+    return NULL;
+  }
+  for (size_t i = 0; i < count; ++i)
+  {
+    draw_particle_start (seed, first + i, &scan.Dr[i], &scan.Dv[i]);
+  }
+  if (!steal_for (count, 0, run_wien_particles, &scan)
+      || atomic_load (&scan.failed))
+  {
+    free_wien_scan (&scan);
+    free (wien_shard);
+    return NULL;
+  }
+
+  ShardHeader *header = &wien_shard->header;
+  memcpy (header->magic, SHARD_MAGIC, sizeof (header->magic));
+  header->method = method;
+  header->shard = shard;
+  header->num_of_shards = num_of_shards;
+  header->particles = particles;
+  header->seed = seed;
+  header->num_of_blocks = block_end - block_begin;
+  header->Dt = scan.Dt;
+  for (size_t i = 0; i < count; ++i)
+  {
+    header->num_of_rows += scan.did_exit[i];
+  }
+  wien_shard->blocks = calloc (header->num_of_blocks + 1,
+                               sizeof (ShardBlock));
+  wien_shard->rows = calloc (header->num_of_rows + 1, sizeof (ShardRow));
+  if (!wien_shard->blocks || !wien_shard->rows)
+  {
+    free_wien_scan (&scan);
+    free_wien_shard (&wien_shard);
+    return NULL;
+  }
+  for (uint64_t b = 0; b < header->num_of_blocks; ++b)
+  {
+    uint64_t begin = (block_begin + b) * SHARD_BLOCK;
+    uint64_t end = begin + SHARD_BLOCK > last ? last : begin + SHARD_BLOCK;
+    wien_shard->blocks[b].index = block_begin + b;
+    accumulate_block (&wien_shard->blocks[b], &scan, first, begin, end);
+  }
+  size_t row = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (scan.did_exit[i])
+    {
+      wien_shard->rows[row++] = (ShardRow) {first + i, scan.v_exit[i]._y,
+                                            scan.v_exit[i]._z};
+    }
+  }
+  free_wien_scan (&scan);
+  return wien_shard;
+}
+
+bool write_wien_shard (WienShard *wien_shard, char *path)
+{
+  FILE *f = fopen (path, WRITE_MODE);
+  if (!f)
+  { return false; }
+  ShardHeader *header = &wien_shard->header;
+  bool ret = fwrite (header, sizeof (ShardHeader), 1, f) == 1
+             && fwrite (wien_shard->blocks, sizeof (ShardBlock),
+                        header->num_of_blocks, f) == header->num_of_blocks
+             && fwrite (wien_shard->rows, sizeof (ShardRow),
+                        header->num_of_rows, f) == header->num_of_rows;
+  return !fclose (f) && ret;
+}
+
+WienShard *read_wien_shard (char *path)
+{
+  FILE *f = fopen (path, READ_MODE);
+  WienShard *wien_shard = f ? calloc (1, sizeof (WienShard)) : NULL;
+  if (!wien_shard)
+  {
+    if (f)
+    { fclose (f); }
+    return NULL;
+  }
+  ShardHeader *header = &wien_shard->header;
+  bool ret = fread (header, sizeof (ShardHeader), 1, f) == 1
+             && !memcmp (header->magic, SHARD_MAGIC, sizeof (header->magic))
+             && header->num_of_blocks <= header->particles / SHARD_BLOCK + 1
+             && header->num_of_rows <= header->particles;
+  if (ret)
+  {
+    wien_shard->blocks = calloc (header->num_of_blocks + 1,
+                                 sizeof (ShardBlock));
+    wien_shard->rows = calloc (header->num_of_rows + 1, sizeof (ShardRow));
+    ret = wien_shard->blocks && wien_shard->rows
+          && fread (wien_shard->blocks, sizeof (ShardBlock),
+                    header->num_of_blocks, f) == header->num_of_blocks
+          && fread (wien_shard->rows, sizeof (ShardRow),
+                    header->num_of_rows, f) == header->num_of_rows;
+  }
+  fclose (f);
+  if (!ret)
+  { free_wien_shard (&wien_shard); }
+  return wien_shard;
+}
+
+void free_wien_shard (WienShard **p_wien_shard)
+{
+  WienShard *wien_shard = *p_wien_shard;
+  if (!wien_shard)
+  { return; }
+  free (wien_shard->blocks);
+  free (wien_shard->rows);
+  free (wien_shard);
+  *p_wien_shard = NULL;
+}
+
+/* Prints the exit rows of a complete set of shards to stdout, like
+ * export_wien_filter, and writes the summary and histogram CSVs. The
+ * shards are put in order first, so the order they were given in does
+ * not matter. */
+bool print_wien_shards (WienShard **shards, size_t num_of_shards)
+{
+  qsort (shards, num_of_shards, sizeof (WienShard *), compare_shards);
+  if (!check_shards (shards, num_of_shards))
+  { return false; }
+  fprintf (stdout, EXIT_HEADERS);
+  for (size_t s = 0; s < num_of_shards; ++s)
+  {
+    for (uint64_t i = 0; i < shards[s]->header.num_of_rows; ++i)
+    {
+      ShardRow *row = &shards[s]->rows[i];
+      fprintf (stdout, EXIT_ROW, (unsigned long long) row->index, row->v_y,
+               row->v_z);
+    }
+  }
+  return print_summary (shards, num_of_shards);
+}
+
+/* Runs one shard and stores it for merge_wien_shards. Shard 0 of 1 is a
+ * whole run and is printed straight away instead. */
+bool export_wien_shard (Method method, double T, size_t particles, uint64_t
+seed, uint32_t shard, uint32_t num_of_shards)
+{
+  WienShard *wien_shard = run_wien_shard (method, T, particles, seed, shard,
+                                          num_of_shards);
+  if (!wien_shard)
+  { return false; }
+  bool ret;
+  if (num_of_shards == 1)
+  {
+    ret = print_wien_shards (&wien_shard, 1);
+  }
+  else
+  {
+    char path[SHARD_PATH_SIZE];
+    snprintf (path, sizeof (path), SHARD_PATH_FORMAT, shard, num_of_shards);
+    ret = write_wien_shard (wien_shard, path);
+  }
+  free_wien_shard (&wien_shard);
+  return ret;
+}
+
+bool merge_wien_shards (char **paths, size_t num_of_paths)
+{
+  WienShard **shards = calloc (num_of_paths, sizeof (WienShard *));
+  if (!shards)
+  { return false; }
+  bool ret = true;
+  for (size_t i = 0; i < num_of_paths && ret; ++i)
+  {
+    shards[i] = read_wien_shard (paths[i]);
+    ret = shards[i] != NULL;
+  }
+  ret = ret && print_wien_shards (shards, num_of_paths);
+  for (size_t i = 0; i < num_of_paths; ++i)
+  {
+    free_wien_shard (&shards[i]);
+  }
+  free (shards);
+  return ret;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+/* Same distribution as the rand based starts of export_wien_filter, but a
+ * pure function of (seed, index). */
+void draw_particle_start (uint64_t seed, uint64_t index, Vec *Dr, Vec *Dv)
+{
+  Rng rng;
+  seed_rng (&rng, seed);
+  seed_rng (&rng, next_rng (&rng) ^ index);
+  *Dr = (Vec) {get_rng_double (&rng, R), 0};
+  *Dv = (Vec) {get_rng_double (&rng, V), 0};
+}
+
+void get_shard_blocks (uint64_t particles, uint32_t shard,
+                       uint32_t num_of_shards, uint64_t *begin,
+                       uint64_t *end)
+{
+  uint64_t num_of_blocks = (particles + SHARD_BLOCK - 1) / SHARD_BLOCK;
+  *begin = num_of_blocks * shard / num_of_shards;
+  *end = num_of_blocks * (shard + 1) / num_of_shards;
+}
+
+void accumulate_block (ShardBlock *block, WienScan *scan, uint64_t first,
+                       uint64_t begin, uint64_t end)
+{
+  for (uint64_t k = begin; k < end; ++k)
+  {
+    size_t i = k - first;
+    if (!scan->did_exit[i])
+    {
+      block->hit++;
+      continue;
+    }
+    Vec *v = &scan->v_exit[i];
+    block->exited++;
+    block->sum_v_y += v->_y;
+    block->sum_v_z += v->_z;
+    block->sum_sq_v_y += v->_y * v->_y;
+    block->sum_sq_v_z += v->_z * v->_z;
+    block->histogram[get_histogram_bin (v->_y)]++;
+  }
+}
+
+int get_histogram_bin (double v_y)
+{
+  int bin = (int) floor ((v_y + HISTOGRAM_V) / (2 * HISTOGRAM_V)
+                         * SHARD_BINS);
+  if (bin < 0)
+  { return 0; }
+  return bin >= SHARD_BINS ? SHARD_BINS - 1 : bin;
+}
+
+/* The shards, already sorted, must come from the same campaign and be
+ * exactly shards 0 to N - 1 of it. */
+bool check_shards (WienShard **shards, size_t num_of_shards)
+{
+  ShardHeader *first = &shards[0]->header;
+  if (first->num_of_shards != num_of_shards)
+  { return false; }
+  for (size_t s = 0; s < num_of_shards; ++s)
+  {
+    ShardHeader *header = &shards[s]->header;
+    if (header->shard != s || header->num_of_shards != first->num_of_shards
+        || header->method != first->method
+        || header->particles != first->particles
+        || header->seed != first->seed || header->Dt != first->Dt)
+    { return false; }
+  }
+  return true;
+}
+
+int compare_shards (const void *first, const void *sec)
+{
+  uint32_t a = (*(WienShard *const *) first)->header.shard;
+  uint32_t b = (*(WienShard *const *) sec)->header.shard;
+  return (a > b) - (a < b);
+}
+
+bool print_summary (WienShard **shards, size_t num_of_shards)
+{
+  ShardBlock total = {0};
+  for (size_t s = 0; s < num_of_shards; ++s)
+  {
+    for (uint64_t b = 0; b < shards[s]->header.num_of_blocks; ++b)
+    {
+      ShardBlock *block = &shards[s]->blocks[b];
+      total.exited += block->exited;
+      total.hit += block->hit;
+      total.sum_v_y += block->sum_v_y;
+      total.sum_v_z += block->sum_v_z;
+      total.sum_sq_v_y += block->sum_sq_v_y;
+      total.sum_sq_v_z += block->sum_sq_v_z;
+      for (int i = 0; i < SHARD_BINS; ++i)
+      {
+        total.histogram[i] += block->histogram[i];
+      }
+    }
+  }
+
+  double n = total.exited ? (double) total.exited : NAN;
+  double mean_v_y = total.sum_v_y / n;
+  double mean_v_z = total.sum_v_z / n;
+  FILE *f = fopen (SUMMARY_CSV, TEXT_WRITE_MODE);
+  if (!f)
+  { return false; }
+  fprintf (f, SUMMARY_HEADERS);
+  fprintf (f, SUMMARY_ROW,
+           (unsigned long long) shards[0]->header.particles,
+           (unsigned long long) total.exited,
+           (unsigned long long) total.hit, mean_v_y, mean_v_z,
+           sqrt (fmax (total.sum_sq_v_y / n - mean_v_y * mean_v_y, 0)),
+           sqrt (fmax (total.sum_sq_v_z / n - mean_v_z * mean_v_z, 0)));
+  fclose (f);
+
+  f = fopen (HISTOGRAM_CSV, TEXT_WRITE_MODE);
+  if (!f)
+  { return false; }
+  fprintf (f, HISTOGRAM_HEADERS);
+  double width = 2 * HISTOGRAM_V / SHARD_BINS;
+  for (int i = 0; i < SHARD_BINS; ++i)
+  {
+    fprintf (f, HISTOGRAM_ROW, -HISTOGRAM_V + i * width,
+             -HISTOGRAM_V + (i + 1) * width,
+             (unsigned long long) total.histogram[i]);
+  }
+  fclose (f);
+  return true;
+}
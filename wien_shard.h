@@ -0,0 +1,55 @@
+#ifndef WIEN_SHARD_H
+#define WIEN_SHARD_H
+
+#include "wien_filter.h"
+#include "rng.h"
+#include <inttypes.h>
+
+#define SHARD_MAGIC "NWSHD01"
+#define SHARD_BLOCK 1024
+#define SHARD_BINS 64
+
+/* Sharded wien_filter campaigns. Particle k always starts from an Rng
+ * seeded by (seed, k), and the index space is cut into fixed blocks of
+ * SHARD_BLOCK particles whose accumulators are summed in block order, so
+ * any split into shards merges to bit for bit the result of one run. */
+typedef struct ShardHeader
+{
+    char magic[8];
+    uint32_t method, shard, num_of_shards, reserved;
+    uint64_t particles, seed, num_of_blocks, num_of_rows;
+    double Dt;
+}ShardHeader;
+
+typedef struct ShardBlock
+{
+    uint64_t index, exited, hit;
+    double sum_v_y, sum_v_z, sum_sq_v_y, sum_sq_v_z;
+    uint64_t histogram[SHARD_BINS];
+}ShardBlock;
+
+typedef struct ShardRow
+{
+    uint64_t index;
+    double v_y, v_z;
+}ShardRow;
+
+typedef struct WienShard
+{
+    ShardHeader header;
+    ShardBlock *blocks;
+    ShardRow *rows;
+}WienShard;
+
+WienShard *run_wien_shard (Method method, double T, size_t particles,
+                           uint64_t seed, uint32_t shard,
+                           uint32_t num_of_shards);
+bool write_wien_shard (WienShard *wien_shard, char *path);
+WienShard *read_wien_shard (char *path);
+void free_wien_shard (WienShard **p_wien_shard);
+bool print_wien_shards (WienShard **shards, size_t num_of_shards);
+bool export_wien_shard (Method method, double T, size_t particles, uint64_t
+seed, uint32_t shard, uint32_t num_of_shards);
+bool merge_wien_shards (char **paths, size_t num_of_paths);
+
+#endif
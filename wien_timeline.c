@@ -1,11 +1,8 @@
 #include "wien_timeline.h"
 
-#define WIEN_ANALYTIC_CSV "../csv_files/wien_analytic.csv"
-#define WIEN_EULER_CSV "../csv_files/wien_euler.csv"
-#define WIEN_MIDPOINT_CSV "../csv_files/wien_midpoint.csv"
-#define WIEN_RUNGE_KUTTA_CSV "../csv_files/wien_runge_kutta.csv"
+#define WIEN_TIMELINE_CSV "../csv_files/wien_%s.csv"
 #define TIMELINE_HEADERS "iterations,time,r_y,r_z,v_y,v_z,a_y,a_z\n"
-#define TIMELINE_ROW "%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf\n"
+#define TIMELINE_ROW "%" PRIu64 ",%lf,%lf,%lf,%lf,%lf,%lf,%lf\n"
 #define DID_EXIT "did exit,yes\n"
 #define DIDNT_EXIT "did exit,no\n"
 #define WRITE_MODE "w"
@@ -14,11 +11,10 @@
 /*        FUNCTIONS DECLARATIONS          */
 /******************************************/
 
-TimeState *get_wien_starting_conditions (Vec *Dr, Vec *Dv);
 void init_wien_time_line (Timeline *timeline, TimeState *starting_conditions);
 bool run_wien_alg (Timeline *timeline, NEXT_STEP_METHOD next_step_func,
-              int dev_factor, double T, bool *did_exit);
-bool check_for_exit(Vec *r, bool *did_exit);
+              uint64_t dev_factor, double T, bool *did_exit);
+Timeline *create_gc_wien_time_line (Vec *Dr, Vec *Dv, bool *did_exit);
 char *get_wien_timeline_path (Method method);
 void print_wien_timeline (Timeline *timeline, char *path, bool did_exit);
 
@@ -27,13 +23,17 @@ void print_wien_timeline (Timeline *timeline, char *path, bool did_exit);
 /***********************************************/
 
 Timeline *
-create_wien_time_line (int dev_factor, double T, NEXT_STEP_METHOD
+create_wien_time_line (uint64_t dev_factor, double T, NEXT_STEP_METHOD
 next_step_method, Vec *Dr, Vec *Dv, bool *did_exit)
 {
   TimeState *starting_conditions = get_wien_starting_conditions (Dr, Dv);
   Timeline *timeline = alloc_time_line ();
-  if (!starting_conditions || !alloc_time_line ())
-  { return NULL; }
+  if (!starting_conditions || !timeline)
+  {
+    free_time_state (&starting_conditions);
+    free (timeline);
+    return NULL;
+  }
   init_wien_time_line (timeline, starting_conditions);
 
   if (!run_wien_alg (timeline, next_step_method, dev_factor, T, did_exit))
@@ -44,18 +44,22 @@ next_step_method, Vec *Dr, Vec *Dv, bool *did_exit)
 bool export_one_wien_timeline (Method method, Vec *Dr, Vec *Dv, double T)
 {
   bool did_exit;
-  Timeline *timeline = create_wien_time_line (DIVISION_CONST, T, get_method
-  (method), Dr, Dv, &did_exit);
+  Timeline *timeline = method == GUIDING_CENTRE
+                       ? create_gc_wien_time_line (Dr, Dv, &did_exit)
+                       : create_wien_time_line (DIVISION_CONST, T, get_method
+                                                (method), Dr, Dv, &did_exit);
   if (!timeline)
   {
     free_time_line (&timeline);
     return false;
   }
   char *path = get_wien_timeline_path (method);
-  print_wien_timeline (timeline, path, did_exit);
+  bool ret = path != NULL;
+  if (ret)
+  { print_wien_timeline (timeline, path, did_exit); }
   free (path);
   free_time_line (&timeline);
-  return true;
+  return ret;
 }
 
 /***************************/
@@ -96,11 +100,11 @@ void init_wien_time_line (Timeline *timeline, TimeState *starting_conditions)
 }
 
 bool run_wien_alg (Timeline *timeline, NEXT_STEP_METHOD next_step_func,
-                   int dev_factor, double T, bool *did_exit)
+                   uint64_t dev_factor, double T, bool *did_exit)
 {
   double Dt = T/dev_factor;
-  bool stop_condition = true;
-  while (stop_condition)
+  bool stop_condition = false;
+  while (!stop_condition)
   {
     TimeState *next_time_state = next_step_func (timeline->last, Dt);
     if (!next_time_state)
@@ -113,6 +117,43 @@ bool run_wien_alg (Timeline *timeline, NEXT_STEP_METHOD next_step_func,
   return true;
 }
 
+/* The guiding centre keeps to the step get_gc_Dt sets instead of
+ * T / dev_factor, and its last row is the full orbit where it crosses the
+ * exit or the plate rather than the end of that step. A centre still
+ * inside after GC_MAX_STEPS steps counts as not exiting. */
+Timeline *create_gc_wien_time_line (Vec *Dr, Vec *Dv, bool *did_exit)
+{
+  TimeState *starting_conditions = get_wien_starting_conditions (Dr, Dv);
+  Timeline *timeline = alloc_time_line ();
+  if (!starting_conditions || !timeline)
+  {
+    free_time_state (&starting_conditions);
+    free (timeline);
+    return NULL;
+  }
+  init_wien_time_line (timeline, starting_conditions);
+  RkState start = {starting_conditions->time, *starting_conditions->r,
+                   *starting_conditions->v, *starting_conditions->a};
+  GcIterator iterator;
+  init_gc_iterator (&iterator, &DEFAULT_ETD_PHYSICS, &start,
+                    get_gc_Dt (&DEFAULT_ETD_PHYSICS, LENGTH), LENGTH, R,
+                    GC_MAX_STEPS);
+  while (next_gc_state (&iterator))
+  {
+    TimeState *next_time_state = alloc_rk_time_state (&iterator.state);
+    if (!next_time_state)
+    {
+      free_time_line (&timeline);
+      return NULL;
+    }
+    timeline->last->next = next_time_state;
+    timeline->last = next_time_state;
+    timeline->size++;
+  }
+  *did_exit = iterator.crossed && iterator.did_exit;
+  return timeline;
+}
+
 bool check_for_exit(Vec *r, bool *did_exit)
 {
   if (r->_z > LENGTH)
@@ -128,30 +169,16 @@ bool check_for_exit(Vec *r, bool *did_exit)
   return false;
 }
 
-char *get_wien_timeline_path (Method method)
+/* Iterator stop condition of a wien run, did_exit points at the caller's
+ * flag. Like run_wien_alg it never stops on the starting conditions. */
+bool check_for_wien_stop (TimeState *state, void *did_exit)
 {
-  char *path = "";
-  switch (method)
-  {
-    case ANALYTIC:
-      path = WIEN_ANALYTIC_CSV;
-      break;
-
-    case EULER:
-      path = WIEN_EULER_CSV;
-      break;
-
-    case MIDPOINT:
-      path = WIEN_MIDPOINT_CSV;
-      break;
+  return state->time > 0 && check_for_exit (state->r, did_exit);
+}
 
-    case RUNGE_KUTTA:
-      path = WIEN_RUNGE_KUTTA_CSV;
-      break;
-  }
-  char *ret = malloc (strlen (path) + 1);
-  strcpy (ret, path);
-  return ret;
+char *get_wien_timeline_path (Method method)
+{
+  return get_method_path (method, WIEN_TIMELINE_CSV);
 }
 
 void print_wien_timeline (Timeline *timeline, char *path, bool did_exit)
@@ -171,7 +198,7 @@ void print_wien_timeline (Timeline *timeline, char *path, bool did_exit)
   }
 
   fprintf (f, TIMELINE_HEADERS);
-  for (int i = 0; i < timeline->size; ++i)
+  for (uint64_t i = 0; i < timeline->size; ++i)
   {
     fprintf (f, TIMELINE_ROW,
              i,
@@ -1,12 +1,16 @@
 #ifndef WIEN_TIMELINE_H
 #define WIEN_TIMELINE_H
 
-#include "methods.h"
+#include "state_iterator.h"
+#include "guiding_centre.h"
 #include <math.h>
 
 Timeline *
-create_wien_time_line (int dev_factor, double T, NEXT_STEP_METHOD
+create_wien_time_line (uint64_t dev_factor, double T, NEXT_STEP_METHOD
 next_step_method, Vec *Dr, Vec *Dv, bool *did_exit);
 bool export_one_wien_timeline (Method method, Vec *Dr, Vec *Dv, double T);
+TimeState *get_wien_starting_conditions (Vec *Dr, Vec *Dv);
+bool check_for_exit(Vec *r, bool *did_exit);
+bool check_for_wien_stop (TimeState *state, void *did_exit);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,463 @@
+#include "worker.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define LINE_SIZE 1024
+#define WORKER_MAX_STEPS 1000000
+#define TOKEN_DELIMITERS " \t\r\n"
+#define SHUTDOWN_STR "shutdown"
+#define READ_MODE "r"
+#define WRITE_MODE "w"
+#define TIMELINE_HEADERS "iterations,time,r_y,r_z,v_y,v_z,a_y,a_z\n"
+#define TIMELINE_ROW "%" PRIu64 ",%lf,%lf,%lf,%lf,%lf,%lf,%lf\n"
+#define PARSE_ERR_ROW "id=%ld status=error msg=bad_job\n"
+#define FAILED_ROW "id=%ld status=error msg=failed\n"
+#define TIMELINE_RESULT_ROW "id=%ld status=ok time=%lf r=%lf,%lf v=%lf,%lf\n"
+#define ERRORS_RESULT_ROW "id=%ld status=ok dt=%e err_r=%e err_v=%e\n"
+#define WIEN_RESULT_ROW "id=%ld status=ok did_exit=%d steps=%" PRIu64 \
+" r=%lf,%lf v=%lf,%lf\n"
+
+/* Analytic end states already computed for some T, shared by all jobs. */
+typedef struct AnalyticTable
+{
+    double T[WORKER_TABLE_SIZE];
+    TimeState *state[WORKER_TABLE_SIZE];
+    size_t size;
+    pthread_mutex_t lock;
+}AnalyticTable;
+
+static AnalyticTable analytic_table = {{0}, {NULL}, 0,
+                                       PTHREAD_MUTEX_INITIALIZER};
+
+/******************************************/
+/*        FUNCTIONS DECLARATIONS          */
+/******************************************/
+
+bool parse_job (char *line, Job *job);
+bool parse_pair (char *str, Vec *vec);
+void run_job (void *arg);
+TimeState *run_job_steps (Job *job, uint64_t *steps, bool *did_exit);
+TimeState *run_gc_job_steps (Job *job, FILE *f, uint64_t *steps, bool
+*did_exit);
+void print_rk_row (FILE *f, uint64_t step, const RkState *state);
+TimeState *get_job_starting_conditions (Job *job);
+bool get_job_reference (Job *job, Vec *r, Vec *v);
+bool get_cached_analytic_T (double T, Vec *r, Vec *v);
+void free_analytic_table ();
+bool serve_connection (int fd, ThreadPool *pool, bool *shutdown);
+
+/***********************************************/
+/*        H FUNCTIONS IMPLEMENTATIONS          */
+/***********************************************/
+
+/* Reads one job per line from in until EOF or a shutdown line and streams
+ * one result line per job to out, in completion order. */
+WorkerStatus run_worker (FILE *in, FILE *out, unsigned int num_of_threads)
+{
+  ThreadPool *pool = create_thread_pool (num_of_threads);
+  if (!pool)
+  { return WORKER_ALLOC_FAILED; }
+  WorkerOutput output = {out};
+  pthread_mutex_init (&output.lock, NULL);
+
+  char line[LINE_SIZE];
+  while (fgets (line, sizeof (line), in))
+  {
+    if (!strncmp (line, SHUTDOWN_STR, strlen (SHUTDOWN_STR)))
+    { break; }
+    Job *job = calloc (1, sizeof (Job));
+    if (!job)
+    { break; }
+    job->output = &output;
+    if (!parse_job (line, job))
+    {
+      pthread_mutex_lock (&output.lock);
+      fprintf (out, PARSE_ERR_ROW, job->id);
+      fflush (out);
+      pthread_mutex_unlock (&output.lock);
+      free (job);
+      continue;
+    }
+    if (!submit_task (pool, run_job, job))
+    {
+      free (job);
+      break;
+    }
+  }
+  destroy_thread_pool (&pool);
+  pthread_mutex_destroy (&output.lock);
+  free_analytic_table ();
+  return ferror (in) || ferror (out) ? WORKER_IO_FAILED : WORKER_DONE;
+}
+
+/* Serves job streams over a local socket, one connection after the other,
+ * with the same pool and tables reused by every connection. */
+WorkerStatus run_socket_worker (char *socket_path, unsigned int
+num_of_threads)
+{
+  struct sockaddr_un address = {0};
+  address.sun_family = AF_UNIX;
+  if (strlen (socket_path) >= sizeof (address.sun_path))
+  { return WORKER_IO_FAILED; }
+  strcpy (address.sun_path, socket_path);
+  ThreadPool *pool = create_thread_pool (num_of_threads);
+  if (!pool)
+  { return WORKER_ALLOC_FAILED; }
+  int listener = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (listener >= 0)
+  { unlink (socket_path); }
+  if (listener < 0
+      || bind (listener, (struct sockaddr *) &address, sizeof (address))
+      || listen (listener, 8))
+  {
+    if (listener >= 0)
+    { close (listener); }
+    destroy_thread_pool (&pool);
+    return WORKER_IO_FAILED;
+  }
+
+  bool shutdown = false;
+  while (!shutdown)
+  {
+    int fd = accept (listener, NULL, NULL);
+    if (fd < 0 && errno == EINTR)
+    { continue; }
+    if (fd < 0 || !serve_connection (fd, pool, &shutdown))
+    { break; }
+  }
+  destroy_thread_pool (&pool);
+  close (listener);
+  unlink (socket_path);
+  free_analytic_table ();
+  return shutdown ? WORKER_DONE : WORKER_IO_FAILED;
+}
+
+/***************************/
+/*        HELPERS          */
+/***************************/
+
+bool serve_connection (int fd, ThreadPool *pool, bool *shutdown)
+{
+  FILE *in = fdopen (fd, READ_MODE);
+  int out_fd = dup (fd);
+  FILE *out = out_fd < 0 ? NULL : fdopen (out_fd, WRITE_MODE);
+  if (!in || !out)
+  {
+    if (in)
+    { fclose (in); }
+    else
+    { close (fd); }
+    if (out_fd >= 0 && !out)
+    { close (out_fd); }
+    return false;
+  }
+  WorkerOutput output = {out};
+  pthread_mutex_init (&output.lock, NULL);
+
+  char line[LINE_SIZE];
+  while (fgets (line, sizeof (line), in))
+  {
+    if (!strncmp (line, SHUTDOWN_STR, strlen (SHUTDOWN_STR)))
+    {
+      *shutdown = true;
+      break;
+    }
+    Job *job = calloc (1, sizeof (Job));
+    if (!job)
+    { break; }
+    job->output = &output;
+    if (!parse_job (line, job) || !submit_task (pool, run_job, job))
+    {
+      pthread_mutex_lock (&output.lock);
+      fprintf (out, PARSE_ERR_ROW, job->id);
+      fflush (out);
+      pthread_mutex_unlock (&output.lock);
+      free (job);
+    }
+  }
+  wait_thread_pool (pool);
+  pthread_mutex_destroy (&output.lock);
+  fclose (out);
+  fclose (in);
+  return true;
+}
+
+bool parse_job (char *line, Job *job)
+{
+  job->action = JOB_TIMELINE;
+  job->method = RUNGE_KUTTA;
+  job->steps = DIVISION_CONST;
+  job->T = (2 * M_PI) / ((q * B) / m);
+  double dt = 0;
+  char *save = NULL;
+  for (char *token = strtok_r (line, TOKEN_DELIMITERS, &save); token;
+       token = strtok_r (NULL, TOKEN_DELIMITERS, &save))
+  {
+    char *value = strchr (token, '=');
+    if (!value)
+    { return false; }
+    *value++ = '\0';
+    bool ok = true;
+    if (!strcmp (token, "id"))
+    { ok = sscanf (value, "%ld", &job->id) == 1; }
+    else if (!strcmp (token, "action"))
+    {
+      if (!strcmp (value, "timeline"))
+      { job->action = JOB_TIMELINE; }
+      else if (!strcmp (value, "errors"))
+      { job->action = JOB_ERRORS; }
+      else if (!strcmp (value, "wien"))
+      { job->action = JOB_WIEN; }
+      else
+      { ok = false; }
+    }
+    else if (!strcmp (token, "method"))
+    {
+      job->method = get_method_by_name (value);
+      ok = job->method != NON_METHOD;
+    }
+    else if (!strcmp (token, "steps"))
+    {
+      ok = *value != '-' && sscanf (value, "%" SCNu64, &job->steps) == 1
+           && job->steps > 0;
+    }
+    else if (!strcmp (token, "dt"))
+    { ok = sscanf (value, "%lf", &dt) == 1 && dt > 0; }
+    else if (!strcmp (token, "T"))
+    { ok = sscanf (value, "%lf", &job->T) == 1 && job->T > 0; }
+    else if (!strcmp (token, "r"))
+    { ok = job->has_r = parse_pair (value, &job->r); }
+    else if (!strcmp (token, "v"))
+    { ok = job->has_v = parse_pair (value, &job->v); }
+    else if (!strcmp (token, "out"))
+    {
+      ok = strlen (value) < WORKER_PATH_SIZE;
+      if (ok)
+      { strcpy (job->out, value); }
+    }
+    else
+    { ok = false; }
+    if (!ok)
+    { return false; }
+  }
+  if (dt > 0)
+  { job->T = dt * job->steps; }
+  /* The analytic method only knows the default start. */
+  return job->method != ANALYTIC
+         || (job->action != JOB_WIEN && !job->has_r && !job->has_v);
+}
+
+bool parse_pair (char *str, Vec *vec)
+{
+  return sscanf (str, "%lf,%lf", &vec->_y, &vec->_z) == 2;
+}
+
+void run_job (void *arg)
+{
+  Job *job = arg;
+  WorkerOutput *output = job->output;
+  uint64_t steps = 0;
+  bool did_exit = false;
+  TimeState *last = run_job_steps (job, &steps, &did_exit);
+  Vec analytic_r, analytic_v;
+  bool ok = last && (job->action != JOB_ERRORS
+                     || get_job_reference (job, &analytic_r, &analytic_v));
+
+  pthread_mutex_lock (&output->lock);
+  if (!ok)
+  {
+    fprintf (output->f, FAILED_ROW, job->id);
+  }
+  else if (job->action == JOB_ERRORS)
+  {
+    fprintf (output->f, ERRORS_RESULT_ROW, job->id, job->T / job->steps,
+             get_dist (&analytic_r, last->r), get_dist (&analytic_v, last->v));
+  }
+  else if (job->action == JOB_WIEN)
+  {
+    fprintf (output->f, WIEN_RESULT_ROW, job->id, did_exit, steps,
+             last->r->_y, last->r->_z, last->v->_y, last->v->_z);
+  }
+  else
+  {
+    fprintf (output->f, TIMELINE_RESULT_ROW, job->id, last->time, last->r->_y,
+             last->r->_z, last->v->_y, last->v->_z);
+  }
+  fflush (output->f);
+  pthread_mutex_unlock (&output->lock);
+  free_time_state (&last);
+  free (job);
+}
+
+/* Steps the job keeping only the current state and returns the last one.
+ * Rows go to job->out when the job names an output file. */
+TimeState *run_job_steps (Job *job, uint64_t *steps, bool *did_exit)
+{
+  FILE *f = job->out[0] ? fopen (job->out, WRITE_MODE) : NULL;
+  if (job->out[0] && !f)
+  { return NULL; }
+  if (f)
+  { fprintf (f, TIMELINE_HEADERS); }
+
+  bool wien = job->action == JOB_WIEN;
+  if (wien && job->method == GUIDING_CENTRE)
+  {
+    TimeState *last = run_gc_job_steps (job, f, steps, did_exit);
+    if (f)
+    { fclose (f); }
+    return last;
+  }
+  StateIterator iterator;
+  init_state_iterator (&iterator, get_job_starting_conditions (job),
+                       get_method (job->method), job->T / job->steps,
+                       wien ? WORKER_MAX_STEPS : (size_t) job->steps);
+  if (wien)
+  { set_iterator_stop (&iterator, check_for_wien_stop, did_exit); }
+  TimeState *state;
+  while ((state = next_state (&iterator)))
+  {
+    if (f)
+    {
+      fprintf (f, TIMELINE_ROW, (uint64_t) iterator.steps, state->time,
+               state->r->_y, state->r->_z, state->v->_y, state->v->_z,
+               state->a->_y, state->a->_z);
+    }
+  }
+  if (f)
+  { fclose (f); }
+  *steps = iterator.steps;
+  if (iterator.failed)
+  {
+    free_state_iterator (&iterator);
+    return NULL;
+  }
+  return take_last_state (&iterator);
+}
+
+/* A wien guiding centre steps at get_gc_Dt instead of T / steps, like
+ * wien_filter, and its last state is the full orbit where it crosses the
+ * exit or the plate. */
+TimeState *run_gc_job_steps (Job *job, FILE *f, uint64_t *steps, bool
+*did_exit)
+{
+  TimeState *starting_conditions = get_job_starting_conditions (job);
+  if (!starting_conditions)
+  { return NULL; }
+  RkState start = {starting_conditions->time, *starting_conditions->r,
+                   *starting_conditions->v, *starting_conditions->a};
+  free_time_state (&starting_conditions);
+  GcIterator iterator;
+  init_gc_iterator (&iterator, &DEFAULT_ETD_PHYSICS, &start,
+                    get_gc_Dt (&DEFAULT_ETD_PHYSICS, LENGTH), LENGTH, R,
+                    GC_MAX_STEPS);
+  print_rk_row (f, 0, &iterator.state);
+  while (next_gc_state (&iterator))
+  { print_rk_row (f, iterator.steps, &iterator.state); }
+  *steps = iterator.steps;
+  *did_exit = iterator.crossed && iterator.did_exit;
+  return alloc_rk_time_state (&iterator.state);
+}
+
+void print_rk_row (FILE *f, uint64_t step, const RkState *state)
+{
+  if (f)
+  {
+    fprintf (f, TIMELINE_ROW, step, state->time, state->r._y, state->r._z,
+             state->v._y, state->v._z, state->a._y, state->a._z);
+  }
+}
+
+TimeState *get_job_starting_conditions (Job *job)
+{
+  if (job->action == JOB_WIEN)
+  {
+    Vec Dr = job->has_r ? job->r : (Vec) {0, 0};
+    Vec Dv = job->has_v ? job->v : (Vec) {0, 0};
+    return get_wien_starting_conditions (&Dr, &Dv);
+  }
+  TimeState *starting_conditions = get_starting_conditions ();
+  if (!starting_conditions)
+  { return NULL; }
+  if (job->has_r)
+  { *starting_conditions->r = job->r; }
+  if (job->has_v)
+  {
+    *starting_conditions->v = job->v;
+    starting_conditions->a->_y = (q / m) * (E - B * job->v._z);
+    starting_conditions->a->_z = (q / m) * (B * job->v._y);
+  }
+  return starting_conditions;
+}
+
+/* The exact end state an errors job is scored against. Jobs from the
+ * default start share the analytic table; jobs that set r or v get the
+ * closed form from their own start. */
+bool get_job_reference (Job *job, Vec *r, Vec *v)
+{
+  if (!job->has_r && !job->has_v)
+  { return get_cached_analytic_T (job->T, r, v); }
+  TimeState *start = get_job_starting_conditions (job);
+  if (!start)
+  { return false; }
+  fill_analytic_state_from (&DEFAULT_PHYSICS, start->r, start->v, job->T, r,
+                            v);
+  free_time_state (&start);
+  return true;
+}
+
+/* Errors jobs over the same T share one analytic end state; once the table
+ * is full the state is computed per job and dropped again. The state is
+ * computed outside the lock, so a slow T never holds up the lookups of
+ * the other workers; when two workers race on one T the later insert is
+ * dropped. */
+bool get_cached_analytic_T (double T, Vec *r, Vec *v)
+{
+  bool found = false;
+  pthread_mutex_lock (&analytic_table.lock);
+  for (size_t i = 0; i < analytic_table.size && !found; ++i)
+  {
+    if (analytic_table.T[i] == T)
+    {
+      *r = *analytic_table.state[i]->r;
+      *v = *analytic_table.state[i]->v;
+      found = true;
+    }
+  }
+  pthread_mutex_unlock (&analytic_table.lock);
+  if (found)
+  { return true; }
+
+  TimeState *state = get_analytic_T (T);
+  if (!state)
+  { return false; }
+  *r = *state->r;
+  *v = *state->v;
+  pthread_mutex_lock (&analytic_table.lock);
+  bool cached = false;
+  for (size_t i = 0; i < analytic_table.size && !cached; ++i)
+  {
+    cached = analytic_table.T[i] == T;
+  }
+  if (!cached && analytic_table.size < WORKER_TABLE_SIZE)
+  {
+    analytic_table.T[analytic_table.size] = T;
+    analytic_table.state[analytic_table.size++] = state;
+    state = NULL;
+  }
+  pthread_mutex_unlock (&analytic_table.lock);
+  free_time_state (&state);
+  return true;
+}
+
+void free_analytic_table ()
+{
+  pthread_mutex_lock (&analytic_table.lock);
+  for (size_t i = 0; i < analytic_table.size; ++i)
+  {
+    free_time_state (&analytic_table.state[i]);
+  }
+  analytic_table.size = 0;
+  pthread_mutex_unlock (&analytic_table.lock);
+}
@@ -0,0 +1,51 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "log_log_errors.h"
+#include "wien_timeline.h"
+#include "parallel.h"
+
+#define WORKER_PATH_SIZE 256
+#define WORKER_TABLE_SIZE 64
+
+typedef enum JobAction
+{
+    JOB_TIMELINE,
+    JOB_ERRORS,
+    JOB_WIEN
+}JobAction;
+
+typedef enum WorkerStatus
+{
+    WORKER_DONE,
+    WORKER_ALLOC_FAILED,
+    WORKER_IO_FAILED
+}WorkerStatus;
+
+typedef struct WorkerOutput
+{
+    FILE *f;
+    pthread_mutex_t lock;
+}WorkerOutput;
+
+/* One line of the job stream, e.g.
+ * id=3 action=timeline method=runge_kutta steps=500 dt=0.1 v=0,6 out=a.csv
+ * Unset fields fall back to the values the one-shot CLI uses. */
+typedef struct Job
+{
+    long id;
+    JobAction action;
+    Method method;
+    uint64_t steps;
+    double T;
+    Vec r, v;
+    bool has_r, has_v;
+    char out[WORKER_PATH_SIZE];
+    WorkerOutput *output;
+}Job;
+
+WorkerStatus run_worker (FILE *in, FILE *out, unsigned int num_of_threads);
+WorkerStatus run_socket_worker (char *socket_path, unsigned int
+num_of_threads);
+
+#endif